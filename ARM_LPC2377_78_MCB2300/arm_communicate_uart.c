@@ -1,276 +1,954 @@
-/*Communication between a linux host machine and ARM LPC2377/78 Microncontroller based MCB2300 board 
-* Implementation of custom protocol on a standard UART/RS-232 protocol
-*
-*-------------------------------------------------------------------------
-*  Custom Protocol:
-	Start bits--1B
-	Identifier--1B
-	Payload length--1B
-	Mode (Read/Write)--1B
-	Future use--4B
-	User payload
-	Stop bits--1B
-
-* Example: fe|01|08|01|00000000|0102030405060708|ff
-
---------------------------------------------------------------------------
-* Linux machine can read / write the data from / to MCB2300 ARM Microcontroller (LPC2377/78) 
-* on standard UART by sending these control bytes to ARM Microcontroller
-* ARM Microcontroller receives these control bytes and sends / receives the data according to the mode bits
-
-* Write mode -- writes the data to output devices based on identifier
-LED-----0
-LCD-----1
-
-* Read mode -- reads the data from ADC (Sensor / pot is attached)
-ADC-----0 (default)
-
-*/
-
-#include "library.h"
-
-unsigned char *pdata;
-
-struct Header
-{
-	/*
-	Start bits--1B
-	Identifier--1B
-	Payload length--1B
-	Mode (Read/Write)--1B
-	Future use--4B
-	User payload (Depends on mode)
-	Stop bits--1B
-	*/
-	unsigned char start_bits, identifier, length_payload, mode;	//For Header fields;
-	unsigned char r1,r2,r3,r4;
-	unsigned char stop_bits;
-
-}head;
-
-void delay(void)	//Delay for displaying the LEDs.
-{
-	unsigned char i;
-	int j;
-	for(i=0;i<100;i++)
-		for(j=0; j<50000; j++);
-}
-
-int main()
-{
-	char i;
-	int read;
-	int ind1=0,ind2=0;
-	   
-	SerialInit();
-	Init_GPIO();
-	Init_ADC();
-	LcdInit();
-	LcdClear();
-
-	//	FIO2PIN = 0x01;		Just to debug the code
-	  
-	while(1)
-	{
-		do
-		{
-	   		do
-		  	{
-				//	Storing header;
-				do
-				{
-					//	printf("Entering do while\n");					
-					//	FIO2PIN = 0x11;     Just to debug the code
-					while((head.start_bits = getkey()) != 0xFE);	// Waiting for Start bits(0xFE) once again;	
-					head.identifier = getkey();			// Storing header bytes;			
-					head.length_payload = getkey();		
-					head.mode = getkey();		
-					head.r1 = getkey();
-					head.r2 = getkey();
-					head.r3 = getkey();
-					head.r4 = getkey();
-						
-					if((head.identifier & 0xFC) != BID)		// Checking for a Board ID. If BID is error, send a NACK;
-						sendchar(NACK);
-							
-	 			}while((head.identifier & 0xFC) != BID); 		// Control goes back to start, if BID error occurs;
-			
-				//	FIO2PIN = 0x22;       Just to debug the code
-			        //	printf("checking mode error\n");			
-				//	check for mode error;
-
-				if(!((head.mode == 0x01) || (head.mode == 0x02)))	// Checking for mode error, if mode error occurs send NACK;
-					sendchar(NACK);
-
-		   	}while(!((head.mode == 0x01) || (head.mode == 0x02)));		// Control goes back to start if Mode error occurs;
-			 
-		   	//	FIO2PIN = 0x33;      Just to debug the code		  
-			//	Dynamic memory allocation;
-			pdata = malloc(head.length_payload * sizeof(char));
-
-			if (pdata == NULL)
-			{
-			//	If any error in memory allocation, send NACK;
-				free(pdata);
-				sendchar(NACK);
-		  	}
-		}while(pdata == NULL);					//Control goes back to start if any error in memory allocation;
-
-		//	printf("memory allocated\n");
-		//	FIO2PIN = 0x44;     Just to debug the code
-
-		switch(head.mode)					// Entering Switch case;
-		{
-			default:		// Default--- Write mode;
-			{
-				sendchar(0x0f);	// Send ACK after receiving the header correctly and  memory allocation is done;
-				//	FIO2PIN = 0x55;		Just to debug the code
-				for(i=0;i<head.length_payload;i++)	// Storing the data bytes in aloocated memory;
-				{
-					*(pdata + i) = (char) getkey();
-				}
-				//	FIO2PIN = 0x66;         Just to debug the code
-				head.stop_bits = getkey();
-				if(head.stop_bits != 0x01)		// Checking Stop Bits error;
-				{
-					sendchar(NACK);			// If any error in Stop bits, send NACK;
-					//	printf("Stop bits error\t");
-						free(pdata);		//Free the allocated memory if Stop Bits error occurs;
-						ind1 = 1;
-						break;	
-				}
-				//	printf("entering the switch\t");  
-				if(ind1 != 1)
-				{
-					sendchar(ACK);			// Send ACK if everything is Perfect(including Stop bits);
-					ind1 = 0;
-					switch(head.identifier & 0x03)	// Checking Peripheral ID
-					{						
-						case 0:
-							//	FIO2PIN = 0xee;			Just to debug the code
-							device0_write();			// Write the data to the LED;
-							free(pdata);				// free the memory after writting the data
-							break;
-
-						default:
-							//	FIO2PIN = 0xbb;			Just to debug the code
-							device1_write();			// Write the data to the LCD;
-							free(pdata);				// free the memory after writting the data
-							break;
-					}
-				}
-				break;
-					   
-			}
-					
-			case 1:			// Case 1--- Read mode;		
-			{
-				sendchar(ACK);			// Send ACK after receiving the header correctly;
-				//	printf("Read mode\t");
-				//	FIO2PIN = 0x77;
-				switch(head.identifier & 0x03)	//  Checking peripheral ID;
-				{
-					default:
-						device0_read();							
-				}
-					
-				for(i=0; i<head.length_payload; i++)	//Write the read data to UART from allocated memory;
-				{
-					read =  *(pdata + i);
-					sendchar(read);
-				}
-				free(pdata);				// Free the data after sending the payload;
-				//	FIO2PIN = 0x88;	
-				head.stop_bits = getkey();		// Waiting for Stop bits from other end;
-				if(head.stop_bits != 0x01)
-				{
-					sendchar(NACK);
-					ind2 = 1;			// If any error in Stop bits send NACK;
-					break;							
-				}
-				if(ind2 != 1)
-				{
-					ind2 = 0;
-					sendchar(ACK);			// If everything is correct send ACK(including Stop bits);
-				}
-				break;
-			 }				
-		 }
-		//	 printf("Exiting from switch\n");
-	  }
-  }
-
- 
-void device0_write(void)			// Writting the data to LED;
-{
-	char j;	
-	for(j=0; j<head.length_payload; j++)
-	{
-		FIO2PIN =  *(pdata + j);
-		delay();	
-	}
- }
-
-void device1_write(void)			// Writting the data to LCD(displays first 16 characters);
-{
-	unsigned char i=0,j=0,ch;
-	LcdClear();
-	for(j=0;( (j<8) && (i<head.length_payload));i++, j++)
-	{		
-		ch = *(pdata + j);
-		//	LcdWriteData(ch);
-		LCD_display(ch);
-	}
-		
-	if(head.length_payload > 8)
-	{
-		LcdSetCursor (0,1);			
-		for(j=8,i=8; ((i<16) && (j<head.length_payload)); i++,j++)
-		{
-			ch = *(pdata + i);
-			//	LcdWriteData(ch);
-			LCD_display(ch);
-		}
-	}	 
-}
-
-void LCD_display(unsigned char data)		//Converting Digital Data into ASCII 
-{
-	unsigned char res;
-	unsigned char q,rem;
-	if((data > 0x0F) && (data < 0x100))
-	{
-        	q = data/0x10;
-        	rem = data % 0x10;
-        	res = (char) q;
-        	data = rem;
-
-		if(res < 0x0a)
-			res += 0x30;
-		else
-			res += 0x37;
-	 LcdWriteData(res);
-	}
-	if(data < 0x10) 
-	{
-        	res = (char) data;		 
-		if(res < 0x0a)
-			res += 0x30;
-		else
-			res += 0x37;
-	 	LcdWriteData(res);
-	}       
-}
-
-void device0_read(void)				// Read the data from ADC in Read mode;
-{
-	char j;
-	for(j=0;j<head.length_payload;j++)
-	{
-		AD0CR |= 0x01000000;
-		while((AD0DR0 & (1 << 31))==0);
-		*(pdata + j) = ((AD0DR0 >> 6) & 0xFF);
-		//	printf("adc value1: %x ",*(pdata+j));	
-	}
-}
-
+/*Communication between a linux host machine and ARM LPC2377/78 Microncontroller based MCB2300 board 
+* Implementation of custom protocol on a standard UART/RS-232 protocol
+*
+*-------------------------------------------------------------------------
+*  Custom Protocol:
+	Start bits--1B
+	Identifier--1B
+	Payload length--1B
+	Mode (Read/Write)--1B
+	Future use--4B
+	User payload
+	Stop bits--1B
+
+* Example: fe|01|08|01|00000000|0102030405060708|ff
+
+--------------------------------------------------------------------------
+* Linux machine can read / write the data from / to MCB2300 ARM Microcontroller (LPC2377/78) 
+* on standard UART by sending these control bytes to ARM Microcontroller
+* ARM Microcontroller receives these control bytes and sends / receives the data according to the mode bits
+
+* Write mode -- writes the data to output devices based on identifier
+LED-----0 (queued, one byte per step on Timer2, see led.c)
+LCD-----1
+LED step----2 payload = step interval in ms (2B LE, 1..65535)
+
+* Read mode -- reads the data from ADC (Sensor / pot is attached)
+ADC-----0 (default)
+  mode 01: one byte per sample (the 8 most significant bits)
+  mode 05: full 10 bit samples, 4 samples packed into 5 bytes
+  mode 06: channels AD0.0-AD0.7 selected by r2 scanned length times, interleaved
+  mode bit 0x10 (MODE_TS): the data is followed by the Timer0 count (TICK_HZ, 4B LE)
+	taken just before the first sample; a read of length 0 returns only the
+	count and serves the host to estimate the clock offset and drift
+Profile-----mode 07: cycle counts of the firmware phases (prof.c), PROF_STATS_LEN
+	bytes; peripheral 1 clears the counts after reading them
+Hello-------mode 09: capabilities (hello_read), HELLO_LEN bytes, then test
+	pattern bytes PROBE_BYTE(i) up to the length, to probe the line
+
+* Baud mode 0A (stop-and-wait only) -- payload = rate (4B LE) followed by any
+	number of PROBE_BYTE(i); a frame with the current rate confirms it, any
+	other table rate is switched to after the ACK and falls back to the old
+	one unless confirmed within BAUD_CONFIRM_MS (serial.c); a confirmed rate
+	goes back to UART_BAUD once no frame came for BAUD_IDLE_MS
+  Example, switch to 460800 Baud:
+	fe|00|04|0a|00000000|00080700|01
+
+* Compound mode 08 -- the payload is a list of sub-operations, each
+	peripheral (identifier bits 1..0)--1B, mode (01/05/07 read, 02 write)--1B,
+	length--1B, data--length B (writes only)
+  run in order; the frame is sent like a write and answered like a read with
+  the data of all read sub-operations, in order (stamp: the first read)
+  Example, LEDs 55, LCD 12 34, 8 ADC samples:
+	fe|00|0c|08|00000000|00020155 0102021234 000108|01
+
+* COBS framing (cobs.c) -- a windowed frame without start and stop bytes,
+	COBS encoded and sent between 0x00 delimiters; every reply is one
+	encoded frame too (status, seq, data, stamp, CRC). The host opts in with
+	a plain windowed SYNC carrying SYNC_COBS in r2 (answered plainly); from
+	then on a frame starting with 0x00 instead of fe is taken as COBS framed.
+	A SYNC without the flag or any stop-and-wait frame ends the COBS session,
+	as does a COBS frame that fails to decode after a first byte of fe (a
+	stop-and-wait header after a host died in the middle of a COBS frame).
+  Example, read of 8 ADC samples with seq 05:
+	00|0104082105010101|00     (decoded: 00|08|21|05|00000000)
+
+*/
+
+#include "library.h"
+
+unsigned char *pdata;
+
+struct Header
+{
+	/*
+	Start bits--1B
+	Identifier--1B
+	Payload length--1B
+	Mode (Read/Write)--1B
+	Future use--4B (r1 = sequence number in windowed mode, r2 = length bits 15..8
+			with MODE_EXT, r3:r4 = CRC with MODE_CRC)
+	User payload (Depends on mode)
+	Stop bits--1B
+	*/
+	unsigned char start_bits, identifier, length_payload, mode;	//For Header fields;
+	unsigned char r1,r2,r3,r4;
+	unsigned char stop_bits;
+	unsigned int length;			// Payload length, including r2 for MODE_EXT frames;
+
+}head;
+
+struct Slot					// Windowed frame held back until the frames before it arrive;
+{
+	struct Header head;
+	unsigned char *pdata;
+	unsigned char used;
+}window[WINDOW];
+
+unsigned short rx_crc;				// CRC of the frame being received, see getkey_crc();
+unsigned long stamp;				// T0TC at the first sample of the last read;
+unsigned long frame_start;			// T3TC at the start byte of the last header (PROF_FRAME);
+
+unsigned char expected_seq;			// Next sequence number to execute in windowed mode;
+unsigned char gap_nacked;			// NACK already sent for the current sequence gap;
+unsigned char cobs;				// The frame being answered came COBS framed, so do its replies;
+unsigned char cobs_session;			// Host opted in with SYNC_COBS, a 0x00 starts a COBS frame;
+
+int main()
+{
+	unsigned long t;
+
+	ProfInit();
+	SerialInit(UART_BAUD);
+	PoolInit();
+	Init_GPIO();
+	Init_ADC();
+	Init_Timer0();
+	LedInit();
+	LcdInit();
+	LcdFbInit();
+
+	//	FIO2PIN = 0x01;		Just to debug the code
+	  
+	while(1)
+	{
+		receive_header();
+		t = frame_start;			// A stream's stop frame moves frame_start;
+		if(head.start_bits == 0x00)		// COBS framed, always windowed;
+			cobs_frame();
+		else if(head.mode & MODE_SEQ)		// Windowed frame, answered with status + sequence number;
+			windowed_frame();
+		else
+			legacy_frame();			// Stop-and-wait frame;
+		PROF_END(PROF_FRAME, t);
+	}
+}
+
+void Init_GPIO(void)
+{
+	PINSEL4 = 0x00000000;
+	PINMODE4 = 0x00000000;
+	FIO2DIR = 0x000000FF;
+	FIO2PIN = 0x00000000;
+}
+
+void Init_ADC(void)
+{
+	PCONP|=(1<<12);
+	PINSEL1|=0x00004000;
+	AD0CR = 0x00240301;
+}
+
+void Init_Timer0(void)				// Free running at TICK_HZ, stamps the samples;
+{
+	PCONP|=(1<<1);
+	T0TCR = 0x02;
+	T0PR = TIMER_PCLK / TICK_HZ - 1;
+	T0MCR = 0x00;
+	T0TCR = 0x01;
+}
+
+void receive_header(void)			// Storing header;
+{
+	unsigned long t;
+
+	PROF_BEGIN(t);
+	while(!SerialAvailable() && LcdFbFlush());	// LCD cells changed by the last writes, while the line is idle;
+	while(((head.start_bits = getkey()) != 0xFE) && ((head.start_bits != 0x00) || !cobs_session));	// Waiting for Start bits(0xFE), or a COBS delimiter in a COBS session;
+	PROF_END(PROF_IDLE, t);
+	PROF_BEGIN(frame_start);
+	if(head.start_bits == 0x00)
+		return;					// cobs_frame() decodes the header itself;
+	rx_crc = CRC16_INIT;
+	head.identifier = getkey_crc();			// Storing header bytes;
+	head.length_payload = getkey_crc();
+	head.mode = getkey_crc();
+	head.r1 = getkey_crc();
+	head.r2 = getkey_crc();
+	head.r3 = getkey();				// CRC, not part of itself;
+	head.r4 = getkey();
+	header_length();
+	PROF_END(PROF_HEADER, frame_start);
+}
+
+void header_length(void)			// Payload length from the header fields;
+{
+	head.length = head.length_payload;
+	if((head.mode & MODE_OP) == MODE_SCAN)		// Scan: length rounds over the channels in r2;
+		head.length *= channels(head.r2);
+	else if(head.mode & MODE_EXT)			// Extended frame, 16 bit length;
+		head.length |= head.r2 << 8;
+}
+
+unsigned char getkey_crc(void)			// getkey() that adds the byte to rx_crc as it arrives;
+{
+	unsigned char ch = getkey();
+
+	rx_crc = CRC16_UPDATE(rx_crc, ch);
+	return ch;
+}
+
+int crc_ok(void)				// Frame CRC matches r3:r4, or the frame carries none;
+{
+	return !(head.mode & MODE_CRC) || (rx_crc == ((head.r3 << 8) | head.r4));
+}
+
+void reply_char(unsigned char ch)		// sendchar(), through the COBS encoder when answering a COBS frame;
+{
+	if(cobs)
+		CobsTxByte(ch);
+	else
+		sendchar(ch);
+}
+
+void send_payload(void)				// Read data, then its stamp and CRC if the request had them;
+{
+	unsigned short crc = CRC16_INIT;
+	unsigned long t;
+	unsigned char ch;
+	unsigned int i;
+
+	PROF_BEGIN(t);
+	for(i=0; i<head.length; i++)
+	{
+		reply_char(*(pdata + i));
+		crc = CRC16_UPDATE(crc, *(pdata + i));
+	}
+	if(head.mode & MODE_TS)
+		for(i=0; i<4; i++)
+		{
+			ch = stamp >> (8 * i);
+			reply_char(ch);
+			crc = CRC16_UPDATE(crc, ch);
+		}
+	if(head.mode & MODE_CRC)
+	{
+		reply_char(crc >> 8);
+		reply_char(crc & 0xFF);
+	}
+	PROF_END(PROF_TX, t);
+}
+
+void legacy_frame(void)			// Header->ACK, then payload+stop->ACK (write) or payload, stop->ACK (read);
+{
+	unsigned char op = head.mode & MODE_OP;
+	unsigned char *reply = NULL;
+	unsigned long t;
+	unsigned int i;
+
+	if(((head.identifier & 0xFC) != BID) || (head.mode & ~(MODE_OP | MODE_CRC | MODE_EXT | MODE_TS)) ||
+		(head.length > POOL_SIZE) ||
+		!(IS_READ(op) || (op == MODE_WRITE) || (op == MODE_STREAM) || (op == MODE_COMPOUND) ||
+		(op == MODE_BAUD)) ||
+		((op == MODE_READ10) && (head.length % 5)) ||
+		((op == MODE_SCAN) && ((head.r2 == 0) || (head.mode & MODE_EXT))) ||
+		(IS_READ(op) && !crc_ok()))
+	{
+		sendchar(NACK);			// BID, mode or CRC error (reads: header only), control goes back to start;
+		return;
+	}
+	cobs_session = 0;			// The host runs stop-and-wait, a 0x00 is line noise again;
+
+	PROF_BEGIN(t);
+	pdata = PoolAlloc();			// Payload buffer from the fixed pool;
+	PROF_END(PROF_ALLOC, t);
+	if(pdata == NULL)
+	{
+		sendchar(NACK);			// Pool exhausted (counted in PoolExhausted), send NACK;
+		return;
+	}
+
+	sendchar(ACK);				// Send ACK after receiving the header correctly;
+
+	if(!IS_READ(op))			// Write mode (stream start and compound frames carry a payload too);
+	{
+		PROF_BEGIN(t);
+		for(i=0;i<head.length;i++)	// Storing the data bytes in allocated memory;
+			*(pdata + i) = getkey_crc();
+
+		head.stop_bits = getkey();
+		PROF_END(PROF_RX, t);
+		if((head.stop_bits != STOP) || !crc_ok() || ((op == MODE_STREAM) && (stream_params() == 0)) ||
+			((op == MODE_WRITE) && ((head.identifier & 0x03) == 2) && (led_step_param() == 0)) ||
+			((op == MODE_COMPOUND) && ((compound_check() < 0) || ((reply = PoolAlloc()) == NULL))) ||
+			((op == MODE_BAUD) && (baud_param() == 0)))
+		{
+			sendchar(NACK);		// If any error in Stop bits, CRC, stream, LED, sub-operations or rate, send NACK;
+			PoolFree(pdata);
+			return;
+		}
+		sendchar(ACK);			// Send ACK if everything is Perfect(including Stop bits);
+		if(op == MODE_STREAM)
+			stream_frame();
+		else if(op == MODE_COMPOUND)
+			compound_frame(reply);
+		else if(op == MODE_BAUD)
+			baud_frame();
+		else
+			device_write();
+	}
+	else					// Read mode;
+	{
+		device_read();
+		send_payload();				//Write the read data to UART from allocated memory;
+
+		head.stop_bits = getkey();		// Waiting for Stop bits from other end;
+		if(head.stop_bits != STOP)
+			sendchar(NACK);			// If any error in Stop bits send NACK;
+		else
+			sendchar(ACK);			// If everything is correct send ACK(including Stop bits);
+	}
+	PoolFree(pdata);			// Return the buffer after the transaction;
+}
+
+unsigned long stream_params(void)		// Stream rate from the start frame, 0 if the parameters are invalid;
+{
+	unsigned long rate;
+
+	if(head.length != 5)
+		return 0;
+	rate = pdata[0] | (pdata[1] << 8) | ((unsigned long)pdata[2] << 16) | ((unsigned long)pdata[3] << 24);
+	if((rate == 0) || (rate > STREAM_MAX_RATE) || (pdata[4] == 0))
+		return 0;
+	return rate;
+}
+
+void stream_frame(void)				// Streams ADC packets until the host sends the stop frame;
+{
+	unsigned long t;
+
+	PROF_BEGIN(t);
+	stream_run(stream_params(), pdata[4], head.mode & (MODE_CRC | MODE_TS));
+	PROF_END(PROF_STREAM, t);
+
+	do
+		receive_header();		// Stop frame: mode 04, no payload;
+	while(head.start_bits != 0xFE);
+	head.stop_bits = getkey();
+	if(((head.mode & MODE_OP) == MODE_STREAM) && (head.length == 0) && (head.stop_bits == STOP) &&
+		crc_ok())
+		sendchar(ACK);
+	else
+		sendchar(NACK);
+}
+
+/*
+* Windowed mode: the host sends whole frames (header, payload, stop) back to back
+* with the sequence number in r1, and up to WINDOW of them may be in flight.
+* Every frame executed in order is answered with ACK + seq (followed by the data
+* for reads); an ACK also covers every earlier sequence number. A corrupt frame
+* or a gap is answered with NACK + the expected seq, and frames after the gap are
+* held in window[] so that only the missing one has to be retransmitted.
+*/
+void windowed_frame(void)
+{
+	unsigned char op = head.mode & MODE_OP;
+	unsigned char ch;
+	unsigned long t;
+	unsigned int i;
+
+	pdata = NULL;
+	if(!window_header_ok())
+	{
+		window_reply(NACK, expected_seq);	// Corrupt header, ask again for the frame we wait for;
+		return;
+	}
+
+	PROF_BEGIN(t);
+	if((op == MODE_WRITE) || (op == MODE_COMPOUND))
+	{
+		pdata = head.length <= POOL_SIZE ? PoolAlloc() : NULL;
+		for(i=0;i<head.length;i++)	// Payload is consumed even if it cannot be stored;
+		{
+			ch = getkey_crc();
+			if(pdata != NULL)
+				*(pdata + i) = ch;
+		}
+	}
+
+	head.stop_bits = getkey();
+	PROF_END(PROF_RX, t);
+	if(head.stop_bits != STOP)
+	{
+		PoolFree(pdata);
+		window_reply(NACK, expected_seq);
+		return;
+	}
+	window_frame();
+}
+
+int window_header_ok(void)			// Identifier, operation and length are those of a windowed frame;
+{
+	unsigned char op = head.mode & MODE_OP;
+
+	return ((head.identifier & 0xFC) == BID) && (op >= MODE_READ) &&
+		((op <= MODE_SYNC) || IS_READ(op) || (op == MODE_COMPOUND)) &&
+		!((op == MODE_READ10) && (head.length % 5)) &&
+		!((op == MODE_SCAN) && ((head.r2 == 0) || (head.mode & MODE_EXT)));
+}
+
+void window_frame(void)				// A received windowed frame in head/pdata: run, held or acknowledged again by its seq;
+{
+	unsigned char op = head.mode & MODE_OP;
+	unsigned char diff;
+	struct Slot *s;
+
+	if(!window_header_ok() || !crc_ok() || (head.length > POOL_SIZE) ||
+		(((op == MODE_WRITE) || (op == MODE_COMPOUND)) && (pdata == NULL)) ||
+		((op == MODE_WRITE) && ((head.identifier & 0x03) == 2) && (led_step_param() == 0)) ||
+		((op == MODE_COMPOUND) && (compound_check() < 0)))
+	{
+		PoolFree(pdata);
+		window_reply(NACK, expected_seq);
+		return;
+	}
+
+	if(op == MODE_SYNC)				// Start of a windowed session;
+	{
+		cobs_session = cobs || (head.r2 & SYNC_COBS);
+		window_reset(head.r1);
+		window_reply(ACK, head.r1);
+		return;
+	}
+
+	diff = head.r1 - expected_seq;
+	if(diff == 0)					// In order, execute it and whatever was held behind it;
+	{
+		while(window_execute(1) == 0)
+		{
+			expected_seq++;
+			gap_nacked = 0;
+			s = &window[expected_seq % WINDOW];
+			if(!s->used)
+				break;
+			head = s->head;
+			pdata = s->pdata;
+			s->used = 0;
+		}
+	}
+	else if(diff < WINDOW)				// Ahead of a lost frame, hold it;
+	{
+		s = &window[head.r1 % WINDOW];
+		if(s->used)
+			PoolFree(pdata);			// Already held (retransmitted twice);
+		else
+		{
+			s->head = head;
+			s->pdata = pdata;
+			s->used = 1;
+		}
+		if(!gap_nacked)
+		{
+			window_reply(NACK, expected_seq);	// One NACK per gap;
+			gap_nacked = 1;
+		}
+	}
+	else if((unsigned char)(expected_seq - head.r1) <= WINDOW)	// Already executed, its reply was lost;
+		window_execute(0);			// Reads are repeated, writes (also in compound frames) only acknowledged again;
+	else
+	{
+		PoolFree(pdata);
+		window_reply(NACK, expected_seq);
+	}
+}
+
+int window_execute(unsigned char writes)	// Runs the frame in head/pdata (writes 0: a duplicate, skip them), returns -1 if it has to be retransmitted;
+{
+	unsigned char *reply;
+	unsigned int n;
+	unsigned long t;
+
+	if(IS_READ(head.mode & MODE_OP))
+	{
+		PROF_BEGIN(t);
+		pdata = PoolAlloc();
+		PROF_END(PROF_ALLOC, t);
+		if(pdata == NULL)
+		{
+			window_reply(NACK, head.r1);
+			return -1;
+		}
+		device_read();
+		window_reply(ACK, head.r1);
+		send_payload();
+	}
+	else if((head.mode & MODE_OP) == MODE_COMPOUND)
+	{
+		if((reply = PoolAlloc()) == NULL)
+		{
+			PoolFree(pdata);
+			window_reply(NACK, head.r1);
+			return -1;
+		}
+		n = compound_run(reply, writes);
+		window_reply(ACK, head.r1);
+		compound_send(reply, n);
+		PoolFree(reply);
+	}
+	else
+	{
+		window_reply(ACK, head.r1);	// ACK first so the host can keep the line busy;
+		if(writes)
+			device_write();
+	}
+	PoolFree(pdata);
+	return 0;
+}
+
+void window_reply(unsigned char status, unsigned char seq)	// Starts a COBS frame of its own when answering one;
+{
+	if(cobs)
+		CobsTxStart();
+	reply_char(status);
+	reply_char(seq);
+}
+
+/*
+* COBS framed windowed frame (cobs.c), after its leading 0x00: the header bytes
+* are decoded into head and the payload straight into a pool buffer as they
+* arrive, up to the 0x00 that ends the frame. A frame that lost bytes or whose
+* length does not match its header is answered like a corrupt windowed frame;
+* the decoder is in step again with the next delimiter. Empty frames (two
+* delimiters in a row) are skipped. A frame that starts with fe and does not
+* decode is a stop-and-wait header: the COBS session is over and it gets a plain
+* NACK, so that the host's retry is found by the fe hunt.
+*/
+void cobs_frame(void)
+{
+	unsigned char op, first;
+	unsigned int n;
+	unsigned long t;
+	CobsRx rx;
+	int c;
+
+	PROF_BEGIN(t);
+	pdata = PoolAlloc();
+	rx_crc = CRC16_INIT;
+	CobsRxStart(&rx);
+	do
+	{
+		first = getkey();
+		for(n=0, c = CobsRxByte(&rx, first); (c != COBS_END) && (c != COBS_ERROR); c = CobsRxByte(&rx, getkey()))
+			if(c != COBS_NONE)
+				cobs_store(n++, c);
+	}
+	while((n == 0) && (c == COBS_END));
+	PROF_END(PROF_RX, t);
+
+	if((c == COBS_ERROR) && (first == 0xFE))
+	{
+		cobs_session = 0;
+		PoolFree(pdata);
+		sendchar(NACK);
+		return;
+	}
+	cobs = 1;
+	header_length();
+	op = head.mode & MODE_OP;
+	if((c == COBS_ERROR) || (n < 7) ||
+		(n - 7 != (((op == MODE_WRITE) || (op == MODE_COMPOUND)) ? head.length : 0)))
+	{
+		PoolFree(pdata);
+		window_reply(NACK, expected_seq);
+	}
+	else
+	{
+		if((op != MODE_WRITE) && (op != MODE_COMPOUND))
+		{
+			PoolFree(pdata);		// Reads get their buffer in window_execute();
+			pdata = NULL;
+		}
+		window_frame();
+	}
+	CobsTxEnd();
+	cobs = 0;
+}
+
+void cobs_store(unsigned int n, unsigned char ch)	// Decoded byte n of a COBS frame to the header or payload;
+{
+	switch(n)
+	{
+		case 0: head.identifier = ch; break;
+		case 1: head.length_payload = ch; break;
+		case 2: head.mode = ch; break;
+		case 3: head.r1 = ch; break;
+		case 4: head.r2 = ch; break;
+		case 5: head.r3 = ch; return;		// CRC, not part of itself;
+		case 6: head.r4 = ch; return;
+		default:
+			if((pdata != NULL) && (n - 7 < POOL_SIZE))
+				pdata[n - 7] = ch;
+	}
+	rx_crc = CRC16_UPDATE(rx_crc, ch);
+}
+
+void window_reset(unsigned char seq)		// Drops held frames and restarts numbering at seq;
+{
+	int i;
+
+	for(i=0; i<WINDOW; i++)
+	{
+		if(window[i].used)
+			PoolFree(window[i].pdata);
+		window[i].used = 0;
+	}
+	expected_seq = seq;
+	gap_nacked = 0;
+}
+
+/*
+* Compound frames: the payload in pdata is a list of sub-operations, each
+* peripheral, mode, length and, for writes, length bytes of data. They run
+* in order through device_write()/device_read() as if each was a frame of its
+* own, and the data of the reads is answered in one block.
+*/
+int compound_check(void)			// Read data length of the sub-operations, -1 if the list is invalid;
+{
+	unsigned int i = 0, n = 0, len;
+	unsigned char periph, op;
+
+	while(i < head.length)
+	{
+		if(head.length - i < 3)
+			return -1;
+		periph = pdata[i];
+		op = pdata[i + 1];
+		len = pdata[i + 2];
+		i += 3;
+		if(periph > 0x03)
+			return -1;
+		if(op == MODE_WRITE)
+		{
+			if((head.length - i < len) ||
+				((periph == 2) && ((len != 2) || ((pdata[i] | (pdata[i + 1] << 8)) == 0))))
+				return -1;		// Payload short, or an invalid LED step;
+			i += len;
+		}
+		else if((op == MODE_READ) || (op == MODE_STATS) || ((op == MODE_READ10) && (len % 5 == 0)))
+			n += len;
+		else
+			return -1;
+	}
+	return n <= POOL_SIZE ? (int)n : -1;
+}
+
+unsigned int compound_run(unsigned char *reply, unsigned char writes)	// Runs the checked sub-operations (writes 0: reads only), read data to reply;
+{
+	struct Header frame = head;
+	unsigned char *list = pdata;
+	unsigned long first = T0TC;
+	unsigned int i = 0, n = 0, reads = 0;
+
+	while(i < frame.length)
+	{
+		head.identifier = (frame.identifier & 0xFC) | list[i];
+		head.mode = list[i + 1];
+		head.length = list[i + 2];
+		i += 3;
+		if(IS_READ(head.mode))
+		{
+			pdata = reply + n;
+			device_read();
+			if(reads++ == 0)
+				first = stamp;
+			n += head.length;
+		}
+		else
+		{
+			pdata = list + i;
+			if(writes)
+				device_write();
+			i += head.length;
+		}
+	}
+	head = frame;
+	pdata = list;
+	stamp = first;				// The stamp of the reply is the first read's;
+	return n;
+}
+
+void compound_send(unsigned char *reply, unsigned int n)	// The reply as read data, stamp and CRC;
+{
+	unsigned char *list = pdata;
+	unsigned int length = head.length;
+
+	pdata = reply;
+	head.length = n;
+	send_payload();
+	pdata = list;
+	head.length = length;
+}
+
+void compound_frame(unsigned char *reply)	// Stop-and-wait: after the ACK, data then stop->ACK as for a read;
+{
+	compound_send(reply, compound_run(reply, 1));
+	PoolFree(reply);
+	head.stop_bits = getkey();
+	if(head.stop_bits != STOP)
+		sendchar(NACK);
+	else
+		sendchar(ACK);
+}
+
+void device_write(void)				// Checking Peripheral ID;
+{
+	unsigned long t;
+
+	PROF_BEGIN(t);
+	switch(head.identifier & 0x03)
+	{
+		case 0:
+			device0_write();		// Write the data to the LED;
+			PROF_END(PROF_LED, t);
+			break;
+
+		case 2:
+			LedStep(led_step_param());	// LED step interval, checked before the ACK;
+			break;
+
+		default:
+			device1_write();		// Write the data to the LCD;
+			PROF_END(PROF_LCD, t);
+			break;
+	}
+}
+
+void device_read(void)				// Checking Peripheral ID;
+{
+	unsigned long t;
+
+	stamp = T0TC;
+	if((head.mode & MODE_OP) == MODE_STATS)		// Profile, not a peripheral;
+	{
+		ProfRead(pdata, head.length);
+		if((head.identifier & 0x03) == 1)
+			ProfReset();
+		return;
+	}
+	if((head.mode & MODE_OP) == MODE_HELLO)		// Capabilities, not a peripheral either;
+	{
+		hello_read();
+		return;
+	}
+	PROF_BEGIN(t);
+	switch(head.identifier & 0x03)
+	{
+		default:
+			if((head.mode & MODE_OP) == MODE_READ10)
+				device0_read10();	// Packed 10 bit samples;
+			else if((head.mode & MODE_OP) == MODE_SCAN)
+				device0_scan();		// Several channels, interleaved;
+			else
+				device0_read();		// Read the data from the ADC;
+	}
+	PROF_END(PROF_ADC, t);
+}
+
+unsigned int led_step_param(void)		// LED step interval in ms from the frame, 0 if it is invalid;
+{
+	if(head.length != 2)
+		return 0;
+	return pdata[0] | (pdata[1] << 8);
+}
+
+/*
+* Capabilities, little endian: version--1B, WINDOW--1B, maximum payload--2B,
+* operations (bit n = mode n)--2B, mode flags--1B, features (bit 0 COBS,
+* bit 1 profile)--1B, current rate--4B, number of rates--1B, 0--3B, rates
+* (slowest first)--4B each; zeros up to HELLO_LEN, test pattern after it.
+*/
+void hello_read(void)
+{
+	unsigned char table[HELLO_LEN];
+	unsigned long baud;
+	unsigned int i, n, ops;
+
+	ops = (1 << MODE_READ) | (1 << MODE_WRITE) | (1 << MODE_SYNC) | (1 << MODE_STREAM) | (1 << MODE_READ10) |
+		(1 << MODE_SCAN) | (1 << MODE_STATS) | (1 << MODE_COMPOUND) | (1 << MODE_HELLO) | (1 << MODE_BAUD);
+	for(i = 0; i < HELLO_LEN; i++)
+		table[i] = 0;
+	table[0] = PROTO_VERSION;
+	table[1] = WINDOW;
+	table[2] = POOL_SIZE & 0xFF;
+	table[3] = POOL_SIZE >> 8;
+	table[4] = ops & 0xFF;
+	table[5] = ops >> 8;
+	table[6] = MODE_TS | MODE_SEQ | MODE_CRC | MODE_EXT;
+	table[7] = 0x01 | (PROFILE ? 0x02 : 0);
+	baud = SerialBaud();
+	for(i = 0; i < 4; i++)
+		table[8 + i] = baud >> (8 * i);
+	for(n = 0; (16 + 4 * n < HELLO_LEN) && ((baud = SerialRate(n)) != 0); n++)
+		for(i = 0; i < 4; i++)
+			table[16 + 4 * n + i] = baud >> (8 * i);
+	table[12] = n;
+
+	for(i = 0; i < head.length; i++)
+		pdata[i] = i < HELLO_LEN ? table[i] : PROBE_BYTE(i);
+}
+
+unsigned long baud_param(void)			// Rate from a baud frame, 0 if it is not supported or the pattern is wrong;
+{
+	unsigned long baud;
+	unsigned int i;
+
+	if(head.length < 4)
+		return 0;
+	baud = pdata[0] | (pdata[1] << 8) | ((unsigned long)pdata[2] << 16) | ((unsigned long)pdata[3] << 24);
+	for(i = 4; i < head.length; i++)
+		if(pdata[i] != PROBE_BYTE(i))
+			return 0;
+	for(i = 0; (SerialRate(i) != 0) && (SerialRate(i) != baud); i++)
+		;
+	return SerialRate(i);
+}
+
+void baud_frame(void)				// Confirms the current rate, or switches to another after the ACK went out;
+{
+	unsigned long baud = baud_param();
+
+	if(baud == SerialBaud())
+		SerialConfirm(BAUD_IDLE_MS);
+	else
+		SerialSwitch(baud, BAUD_CONFIRM_MS);
+}
+ 
+void device0_write(void)			// Queue the data for the LED, Timer2 shows it (led.c);
+{
+	LedQueue(pdata, head.length);
+}
+
+void device1_write(void)			// Writting the data to LCD, 8 bytes in hex per line (lcdfb.c);
+{
+	static const unsigned char hex[] = "0123456789ABCDEF";
+	unsigned char i, line, column;
+
+	for(i=0; i<2*8; i++)
+	{
+		line = i / 8;
+		column = (i % 8) * 2;
+		if(i < head.length)
+		{
+			LcdFbPut(line, column, hex[pdata[i] >> 4]);
+			LcdFbPut(line, column + 1, hex[pdata[i] & 0x0F]);
+		}
+		else
+		{
+			LcdFbPut(line, column, ' ');
+			LcdFbPut(line, column + 1, ' ');
+		}
+	}
+}
+
+unsigned int adc_sample(void)			// One conversion on AD0.0, 10 bit result;
+{
+	unsigned long dr;
+
+	AD0CR |= 0x01000000;
+	while(((dr = AD0DR0) & (1UL << 31)) == 0);	// Reading DR clears DONE, so read it once;
+	return (dr >> 6) & 0x3FF;
+}
+
+void device0_read(void)				// Read the data from ADC in Read mode;
+{
+	unsigned int j;						// Payloads up to POOL_SIZE bytes;
+	for(j=0;j<head.length;j++)
+	{
+		*(pdata + j) = adc_sample() >> 2;	// 8 most significant bits;
+		//	printf("adc value1: %x ",*(pdata+j));	
+	}
+}
+
+void device0_read10(void)			// Full 10 bit samples, 4 samples in 5 bytes;
+{
+	unsigned int j, s0, s1, s2, s3;
+	unsigned char *p = pdata;
+
+	for(j=0; j<head.length; j+=5, p+=5)	// Bits of s0 | s1 << 10 | s2 << 20 | s3 << 30, LSB first;
+	{
+		s0 = adc_sample();
+		s1 = adc_sample();
+		s2 = adc_sample();
+		s3 = adc_sample();
+		p[0] = s0;
+		p[1] = (s0 >> 8) | (s1 << 2);
+		p[2] = (s1 >> 6) | (s2 << 4);
+		p[3] = (s2 >> 4) | (s3 << 6);
+		p[4] = s3 >> 2;
+	}
+}
+
+unsigned char channels(unsigned char mask)	// Number of channels selected in mask;
+{
+	unsigned char n = 0;
+
+	for(; mask; mask &= mask - 1)
+		n++;
+	return n;
+}
+
+unsigned long adc_dr(unsigned char ch)		// AD0DRn by channel number;
+{
+	switch(ch)
+	{
+		case 0: return AD0DR0;
+		case 1: return AD0DR1;
+		case 2: return AD0DR2;
+		case 3: return AD0DR3;
+		case 4: return AD0DR4;
+		case 5: return AD0DR5;
+		case 6: return AD0DR6;
+		default: return AD0DR7;
+	}
+}
+
+void adc_pins(unsigned char mask)		// Pin function AD0.n for the channels in mask;
+{
+	unsigned char ch;
+
+	for(ch=0; ch<4; ch++)				// AD0.0-AD0.3 on P0.23-P0.26;
+		if(mask & (1 << ch))
+			PINSEL1 = (PINSEL1 & ~(3UL << (14 + 2 * ch))) | (1UL << (14 + 2 * ch));
+	if(mask & 0x10)					// AD0.4, AD0.5 on P1.30, P1.31;
+		PINSEL3 |= 3UL << 28;
+	if(mask & 0x20)
+		PINSEL3 |= 3UL << 30;
+	if(mask & 0x40)					// AD0.6, AD0.7 on P0.12, P0.13;
+		PINSEL0 |= 3UL << 24;
+	if(mask & 0x80)
+		PINSEL0 |= 3UL << 26;
+}
+
+/*
+* Scan read: the ADC runs in BURST mode over the channels selected in r2 and
+* every round stores one sample (8 MSBs) per channel, lowest channel first, so
+* the data is length rounds of interleaved samples.
+*/
+void device0_scan(void)
+{
+	unsigned char ch, mask = head.r2;
+	unsigned long dr;
+	unsigned int j = 0;
+
+	adc_pins(mask);
+	AD0CR = (AD0CR & ~0x070000FFUL) | mask | 0x00010000;	// SEL = mask, BURST;
+	while(j < head.length)
+		for(ch=0; ch<8; ch++)
+		{
+			if(!(mask & (1 << ch)))
+				continue;
+			while(((dr = adc_dr(ch)) & (1UL << 31)) == 0);	// Next conversion of this channel;
+			pdata[j++] = (dr >> 8) & 0xFF;
+		}
+	AD0CR = (AD0CR & ~0x000100FFUL) | 0x01;		// Back to AD0.0, software start;
+}
@@ -0,0 +1,164 @@
+/****************************************************************************/
+/* COBS.C: Consistent Overhead Byte Stuffing of windowed frames             */
+/****************************************************************************/
+/**
+* @file cobs.c
+*
+* In COBS framing a frame is sent without its start and stop bytes, encoded
+* so that it contains no 0x00, and ends with a 0x00 delimiter. The encoding
+* splits the frame at its zeros into blocks of at most 254 bytes, each sent
+* as a code byte (the block length + 1) followed by the block; a zero after
+* a block is implied by a code byte below 0xFF.
+*
+* @note
+*
+* The receiver needs no start byte and no length to find frame boundaries:
+* whatever it has decoded is dropped at the next 0x00, so after a lost or
+* corrupt byte it is back in step with the frame after the damaged one. The
+* decoder works one byte at a time and hands every data byte back to the
+* caller, who stores it straight into the header or the payload buffer.
+* The overhead is one code byte per 254 bytes plus the delimiter.
+*
+*****************************************************************************/
+
+/***************************** Include Files ********************************/
+
+#include "library.h"
+
+/************************** Variable Definitions ****************************/
+
+static unsigned char CobsBlock[254];     /* Encoder: the open block         */
+static unsigned char CobsLen;            /* Bytes in it                     */
+static unsigned char CobsOpen;           /* A frame is being encoded        */
+
+/****************************************************************************/
+/**
+* Prepares a decoder for the first byte after a delimiter.
+*
+* @param	s is the decoder.
+*
+* @return	None.
+*
+* @note		CobsRxByte() does this itself at every delimiter.
+*
+*****************************************************************************/
+
+void CobsRxStart (CobsRx *s)  {
+  s->code = 0;
+  s->left = 0;
+}
+
+
+/****************************************************************************/
+/**
+* Decodes one received byte.
+*
+* @param	s is the decoder.
+*
+* @param	ch is the byte.
+*
+* @return	The decoded data byte (0..255), COBS_NONE if ch yields none,
+*		COBS_END at the delimiter of a complete frame, COBS_ERROR at a
+*		delimiter inside a block (the frame lost bytes).
+*
+* @note		The zero implied by a code byte is only returned once the next
+*		code byte shows that the frame goes on, so the last block adds
+*		none.
+*
+*****************************************************************************/
+
+int CobsRxByte (CobsRx *s, unsigned char ch)  {
+  int ret = COBS_NONE;
+
+  if (ch == 0x00)  {
+    ret = s->left ? COBS_ERROR : COBS_END;
+    CobsRxStart(s);
+    return (ret);
+  }
+  if (s->left)  {
+    s->left--;
+    return (ch);
+  }
+  if (s->code && (s->code < 0xFF))
+    ret = 0x00;                          /* Zero after the previous block   */
+  s->code = ch;
+  s->left = ch - 1;
+  return (ret);
+}
+
+
+static void CobsFlush (void)  {          /* Code byte and the open block    */
+  unsigned int i;
+
+  sendchar(CobsLen + 1);
+  for (i = 0; i < CobsLen; i++)
+    sendchar(CobsBlock[i]);
+  CobsLen = 0;
+}
+
+
+/****************************************************************************/
+/**
+* Starts an encoded frame on the UART, ending the one still open.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		The leading delimiter ends whatever garbage the receiver may
+*		have decoded before the frame.
+*
+*****************************************************************************/
+
+void CobsTxStart (void)  {
+  CobsTxEnd();
+  sendchar(0x00);
+  CobsLen = 0;
+  CobsOpen = 1;
+}
+
+
+/****************************************************************************/
+/**
+* Adds one byte to the open frame.
+*
+* @param	ch is the byte.
+*
+* @return	None.
+*
+* @note		Bytes go out a block at a time, at a zero or once 254 bytes
+*		are buffered.
+*
+*****************************************************************************/
+
+void CobsTxByte (unsigned char ch)  {
+  if (ch == 0x00)  {
+    CobsFlush();
+    return;
+  }
+  CobsBlock[CobsLen++] = ch;
+  if (CobsLen == 254)
+    CobsFlush();                         /* Code 0xFF, no zero implied      */
+}
+
+
+/****************************************************************************/
+/**
+* Sends the last block and the delimiter of the open frame.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		Does nothing if no frame is open.
+*
+*****************************************************************************/
+
+void CobsTxEnd (void)  {
+  if (!CobsOpen)
+    return;
+  CobsFlush();
+  sendchar(0x00);
+  CobsOpen = 0;
+}
+
@@ -0,0 +1,116 @@
+/****************************************************************************/
+/* LCDFB.C: Shadow framebuffer of the 16x2 text LCD                         */
+/****************************************************************************/
+/**
+* @file lcdfb.c
+*
+* Writes to the LCD go into a 16x2 framebuffer in RAM. A cell whose new
+* character differs from the one the controller shows is marked dirty, and
+* LcdFbFlush() later writes the dirty cells to the controller, one per call,
+* so the main loop can spread an update over the time the line is idle.
+*
+* @note
+*
+* The controller's address counter advances with every data write, so a run
+* of dirty cells costs one cursor command and one write per cell; a cell
+* that has not changed costs nothing. Every bus operation waits for the busy
+* flag in lcd.c (some 40 us), a display clear takes 1.5 ms.
+*
+*****************************************************************************/
+
+/***************************** Include Files ********************************/
+
+#include "library.h"
+
+/************************** Constant Definitions ****************************/
+
+#define LCD_LINE_STEP    40              /* LcdSetCursor address per line   */
+
+/************************** Variable Definitions ****************************/
+
+static unsigned char LcdFb[LCD_LINES][LCD_COLUMNS];      /* Wanted          */
+static unsigned char LcdShown[LCD_LINES][LCD_COLUMNS];   /* On the glass    */
+static unsigned short LcdDirty[LCD_LINES];   /* Bit n = column n differs    */
+static unsigned char LcdAddr;                /* Cursor, in LcdSetCursor units */
+
+/****************************************************************************/
+/**
+* Clears the display once and the framebuffer with it.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		Called after LcdInit().
+*
+*****************************************************************************/
+
+void LcdFbInit (void)  {
+  unsigned int l, c;
+
+  LcdClear();
+  for (l = 0; l < LCD_LINES; l++)  {
+    for (c = 0; c < LCD_COLUMNS; c++)
+      LcdFb[l][c] = LcdShown[l][c] = ' ';
+    LcdDirty[l] = 0;
+  }
+  LcdAddr = 0;
+}
+
+
+/****************************************************************************/
+/**
+* Sets one cell of the framebuffer.
+*
+* @param	line is the line, 0 or 1.
+*
+* @param	column is the column, 0..15.
+*
+* @param	ch is the character.
+*
+* @return	None.
+*
+* @note		Does not touch the controller.
+*
+*****************************************************************************/
+
+void LcdFbPut (unsigned char line, unsigned char column, unsigned char ch)  {
+  LcdFb[line][column] = ch;
+  if (ch != LcdShown[line][column])
+    LcdDirty[line] |= 1 << column;
+  else
+    LcdDirty[line] &= ~(1 << column);    /* Changed back before the flush   */
+}
+
+
+/****************************************************************************/
+/**
+* Writes the first dirty cell to the controller.
+*
+* @param	None.
+*
+* @return	Non-zero if it wrote one, 0 if the display is up to date.
+*
+* @note		Moves the cursor only if the cell is not the one the address
+*		counter points at.
+*
+*****************************************************************************/
+
+int LcdFbFlush (void)  {
+  unsigned char line, column;
+
+  for (line = 0; (line < LCD_LINES) && !LcdDirty[line]; line++);
+  if (line == LCD_LINES)
+    return (0);
+  for (column = 0; !(LcdDirty[line] & (1 << column)); column++);
+
+  if (LcdAddr != line * LCD_LINE_STEP + column)  {
+    LcdSetCursor(column, line);
+    LcdAddr = line * LCD_LINE_STEP + column;
+  }
+  LcdWriteData(LcdFb[line][column]);
+  LcdAddr++;
+  LcdShown[line][column] = LcdFb[line][column];
+  LcdDirty[line] &= ~(1 << column);
+  return (1);
+}
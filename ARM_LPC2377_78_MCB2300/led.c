@@ -0,0 +1,151 @@
+/****************************************************************************/
+/* LED.C: LED patterns played out by Timer2                                 */
+/****************************************************************************/
+/**
+* @file led.c
+*
+* LED writes are queued here and shown one payload byte per step by the
+* Timer2 match interrupt, so a write returns as soon as its bytes are
+* queued and the protocol loop keeps serving frames while a pattern plays.
+* The step interval is LED_STEP_MS until the host sets another one.
+*
+* @note
+*
+* The first byte of a write to idle LEDs is shown at once, like the delay()
+* loop did; every byte stays for one step, the last one until the next
+* write. A write only waits when the queue has no room for it, i.e. more
+* than LED_QUEUE bytes are still to be shown.
+*
+*****************************************************************************/
+
+/***************************** Include Files ********************************/
+
+#include "library.h"
+
+/************************** Constant Definitions ****************************/
+
+#define T2_VIC           (1 << 26)       /* Timer2 is VIC channel 26        */
+#define LED_TICK_HZ      1000            /* Timer2 count rate, 1 ms         */
+
+/************************** Variable Definitions ****************************/
+
+static unsigned char LedBuf[LED_QUEUE];
+static volatile unsigned int LedHead;    /* Written by LedQueue only        */
+static volatile unsigned int LedTail;    /* Written by the ISR only         */
+static volatile unsigned char LedBusy;   /* Timer2 is stepping the pattern  */
+
+/************************** Function Prototypes *****************************/
+
+void Timer2_IRQHandler (void) __irq;
+
+/****************************************************************************/
+/**
+* Timer2 match interrupt: shows the next queued byte, or stops the timer
+* once the last one has been shown for a step.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		None.
+*
+*****************************************************************************/
+
+void Timer2_IRQHandler (void) __irq
+{
+  T2IR = 0x01;                           /* Clear MR0 interrupt             */
+
+  if (LedTail != LedHead)  {
+    FIO2PIN = LedBuf[LedTail & (LED_QUEUE - 1)];
+    LedTail++;
+  }
+  else  {
+    T2TCR = 0;
+    LedBusy = 0;
+  }
+
+  VICVectAddr = 0;                       /* Acknowledge interrupt           */
+}
+
+
+/****************************************************************************/
+/**
+* Powers Timer2 at LED_TICK_HZ and installs its interrupt; the timer runs
+* only while a pattern plays.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		None.
+*
+*****************************************************************************/
+
+void LedInit (void)  {
+  PCONP |= 1 << 22;                      /* Power Timer2                    */
+  T2TCR = 0x02;                          /* Reset                           */
+  T2PR  = TIMER_PCLK / LED_TICK_HZ - 1;
+  T2MR0 = LED_STEP_MS - 1;
+  T2MCR = 0x03;                          /* Interrupt and reset on MR0      */
+  T2IR  = 0x3F;
+  VICVectAddr26 = (unsigned long)Timer2_IRQHandler;
+  VICVectPriority26 = 3;
+  VICIntEnable = T2_VIC;
+}
+
+
+/****************************************************************************/
+/**
+* Sets the step interval.
+*
+* @param	ms is the time each byte is shown, 1..65535 ms.
+*
+* @return	None.
+*
+* @note		Takes effect with the next step.
+*
+*****************************************************************************/
+
+void LedStep (unsigned int ms)  {
+  VICIntEnClr = T2_VIC;
+  T2MR0 = ms - 1;
+  if (LedBusy)  {
+    T2TCR = 0x02;                        /* TC may be past the new MR0      */
+    T2TCR = 0x01;
+  }
+  VICIntEnable = T2_VIC;
+}
+
+
+/****************************************************************************/
+/**
+* Queues an LED write.
+*
+* @param	buf is the pattern, one LED state per byte.
+*
+* @param	len is its length, at most LED_QUEUE.
+*
+* @return	None.
+*
+* @note		Starts the timer if the LEDs are idle.
+*
+*****************************************************************************/
+
+void LedQueue (const unsigned char *buf, unsigned int len)  {
+  unsigned int i;
+
+  while (LedHead - LedTail > LED_QUEUE - len)
+    CPU_IDLE();
+
+  VICIntEnClr = T2_VIC;                  /* LedBusy may change in the ISR   */
+  i = 0;
+  if (!LedBusy && len)  {
+    FIO2PIN = buf[i++];                  /* Show the first byte now         */
+    LedBusy = 1;
+    T2TCR = 0x02;
+    T2TCR = 0x01;
+  }
+  for (; i < len; i++)
+    LedBuf[LedHead++ & (LED_QUEUE - 1)] = buf[i];
+  VICIntEnable = T2_VIC;
+}
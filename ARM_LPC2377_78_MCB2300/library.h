@@ -1,48 +1,182 @@
-#include <LPC23xx.H>
-#include <stdio.h>
-#include <stdlib.h>
-
-
-#define BID 0x00
-#define ACK 0x0F
-#define NACK 0xF0
-
-
-
-void SerialInit(void);
-void Init_GPIO(void);
-void Init_ADC(void);
-void LcdInit (void);
-void LcdClear (void);
-void LcdWriteData (unsigned char);
-void LcdSetCursor (unsigned char column, unsigned char line);
-void LCD_display(unsigned char data);
-void device0_read(void);
-void device0_write(void);
-void device1_write(void);
-int sendchar (int);
-int getkey (void);
-
-
-
-
-void Init_GPIO(void)
-{
-	PINSEL4 = 0x00000000;
-	PINMODE4 = 0x00000000;
-	FIO2DIR = 0x000000FF;
-	FIO2PIN = 0x00000000;
-}
-
-void Init_ADC(void)
-{
-	PCONP|=(1<<12);
-	PINSEL1|=0x00004000;
-	AD0CR = 0x00240301;
-}
-
-
-
-		
-	
-
+#include <lpc23xx.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+#define BID 0x00
+#define ACK 0x0F
+#define NACK 0xF0
+
+#define STOP 0x01
+
+#define MODE_READ 0x01
+#define MODE_WRITE 0x02
+#define MODE_SYNC 0x03			// Windowed mode: restart sequence numbering at r1;
+#define MODE_STREAM 0x04		// Continuous ADC acquisition, payload = rate (4B LE) + block size;
+#define MODE_READ10 0x05		// Read, 10 bit samples packed 4 into 5 bytes (length multiple of 5);
+#define MODE_SCAN 0x06			// Read, channels in r2 scanned length times, 1 byte per sample;
+#define MODE_STATS 0x07			// Read the profile (prof.c), peripheral 1 = read and clear it;
+#define MODE_COMPOUND 0x08		// Payload = sub-operations (peripheral, mode, length, write data), run in order;
+#define MODE_HELLO 0x09			// Read the capabilities (hello_read), then PROBE_BYTE()s up to the length;
+#define MODE_BAUD 0x0A			// Stop-and-wait write: switch to the rate (4B LE), then PROBE_BYTE()s, see baud_frame();
+#define MODE_OP 0x0F			// Operation bits of the mode byte;
+#define MODE_TS 0x10			// Read data / stream blocks followed by their Timer0 stamp (4B LE);
+#define MODE_SEQ 0x20			// Windowed frame, r1 = sequence number;
+#define MODE_CRC 0x40			// r3:r4 = CRC-16/CCITT of identifier..r2 and payload;
+#define MODE_EXT 0x80			// Extended frame, payload length = length | r2 << 8;
+
+#define CRC16_INIT 0xFFFF
+#define CRC16_UPDATE(crc, b) ((unsigned short)(((crc) << 8) ^ CrcTable[(((crc) >> 8) ^ (b)) & 0xFF]))
+
+#define IS_READ(op) (((op) == MODE_READ) || ((op) == MODE_READ10) || ((op) == MODE_SCAN) || ((op) == MODE_STATS) || \
+	((op) == MODE_HELLO))
+
+#define PROTO_VERSION 1			// MODE_HELLO: protocol version, raised with every new mode or feature;
+#define HELLO_LEN 48			// MODE_HELLO: capability block, see hello_read();
+#define PROBE_BYTE(i) ((unsigned char)(((i) * 0x1D) ^ 0xA5))	// Test pattern at payload offset i;
+#define BAUD_CONFIRM_MS 500		// A new rate not confirmed within this time falls back to the old one;
+#define BAUD_IDLE_MS 5000		// A confirmed rate goes back to UART_BAUD after the line is idle this long;
+
+#define WINDOW 8			// Frames held out of order in windowed mode (power of 2);
+#define SYNC_COBS 0x01			// SYNC frame, r2: the session goes on COBS framed (cobs.c);
+
+#define POOL_SIZE 1024			// Payload buffer size, the largest (extended) payload length;
+#define POOL_BUFS (WINDOW + 2)		// Held window frames, the frame in progress and a spare;
+
+#define PCLKSEL0_VAL 0x00000140	// Startup (LPC2300.s Clock Setup) before the PLL connect: PCLK_UART0/1 = CCLK, read back by SerialInit;
+#define PCLKSEL1_VAL 0x00004000	// Startup before the PLL connect: PCLK_TIMER3 = CCLK (prof.c, read back), the rest CCLK/4;
+#define TIMER_PCLK 12000000		// PCLK_TIMERn = CCLK/4 (default);
+#define TICK_HZ 1000000			// Timer0 count rate, the unit of sample stamps;
+
+#define STREAM_BLOCK 255		// Largest block of samples per stream packet;
+#define STREAM_MAX_RATE 100000		// Highest stream sample rate (Hz);
+
+#ifndef PROFILE
+#define PROFILE 1			// Cycle counts of the firmware phases on Timer3 (prof.c);
+#endif
+#define CCLK_HZ 48000000		// CPU clock, PLL 288 MHz / 6 (MCB2300 startup); Timer3 rate, see ProfInit();
+
+#define PROF_FRAME 0			// Profiling points: start byte to frame handled;
+#define PROF_IDLE 1			// Waiting for the start byte;
+#define PROF_HEADER 2			// Rest of the header;
+#define PROF_ALLOC 3			// PoolAlloc();
+#define PROF_RX 4			// Write payload and stop byte;
+#define PROF_ADC 5			// device_read();
+#define PROF_TX 6			// send_payload();
+#define PROF_LED 7			// device0_write();
+#define PROF_LCD 8			// device1_write();
+#define PROF_STREAM 9			// stream_run();
+#define PROF_RX_WAIT 10			// getkey() with the RX ring empty;
+#define PROF_TX_WAIT 11			// sendchar() with the TX ring full;
+#define PROF_POINTS 12
+#define PROF_STATS_LEN (8 + 20 * PROF_POINTS + 16)	// MODE_STATS data, see ProfRead();
+
+#if PROFILE
+#define PROF_BEGIN(t) ((t) = T3TC)
+#define PROF_END(point, t) ProfAdd((point), T3TC - (t))
+#else
+#define PROF_BEGIN(t) ((t) = 0)
+#define PROF_END(point, t) ((void)(t))
+#endif
+
+#ifndef CPU_IDLE
+#define CPU_IDLE()			// Nothing to do while waiting on the target; the simulator's shim runs its models here;
+#endif
+
+#define LED_QUEUE 2048			// LED pattern bytes waiting to be shown (power of 2, >= POOL_SIZE);
+#define LED_STEP_MS 250			// Default time each LED pattern byte is shown;
+
+#define LCD_LINES 2			// Text LCD size, the shadow framebuffer (lcdfb.c);
+#define LCD_COLUMNS 16
+
+#define COBS_NONE (-1)			// CobsRxByte(): code byte without data,
+#define COBS_END (-2)			// delimiter after a complete frame,
+#define COBS_ERROR (-3)			// delimiter inside a block, the frame lost bytes;
+
+typedef struct				// COBS decoder (cobs.c);
+{
+	unsigned char code, left;
+} CobsRx;
+
+#ifndef UART_BAUD
+#define UART_BAUD 115200		// Line rate, must match the host (-b option);
+#endif
+
+
+
+int SerialInit(unsigned long baud);
+unsigned long SerialBaud(void);
+unsigned long SerialRate(unsigned int i);
+int SerialSwitch(unsigned long baud, unsigned int confirm_ms);
+void SerialConfirm(unsigned int idle_ms);
+void Init_GPIO(void);
+void Init_ADC(void);
+void Init_Timer0(void);
+void LcdInit (void);
+void LcdClear (void);
+void LcdWriteData (unsigned char);
+void LcdSetCursor (unsigned char column, unsigned char line);
+void LcdFbInit (void);
+void LcdFbPut (unsigned char line, unsigned char column, unsigned char ch);
+int LcdFbFlush (void);
+void receive_header(void);
+void header_length(void);
+void legacy_frame(void);
+void windowed_frame(void);
+int window_header_ok(void);
+void window_frame(void);
+int window_execute(unsigned char writes);
+void window_reply(unsigned char status, unsigned char seq);
+void window_reset(unsigned char seq);
+void cobs_frame(void);
+void cobs_store(unsigned int n, unsigned char ch);
+void reply_char(unsigned char ch);
+unsigned long stream_params(void);
+void stream_frame(void);
+int compound_check(void);
+unsigned int compound_run(unsigned char *reply, unsigned char writes);
+void compound_send(unsigned char *reply, unsigned int n);
+void compound_frame(unsigned char *reply);
+void device_write(void);
+void device_read(void);
+void device0_read(void);
+void device0_read10(void);
+unsigned int adc_sample(void);
+void device0_scan(void);
+unsigned long adc_dr(unsigned char ch);
+void adc_pins(unsigned char mask);
+unsigned char channels(unsigned char mask);
+void device0_write(void);
+void device1_write(void);
+unsigned int led_step_param(void);
+void hello_read(void);
+unsigned long baud_param(void);
+void baud_frame(void);
+void LedInit (void);
+void LedStep (unsigned int ms);
+void LedQueue (const unsigned char *buf, unsigned int len);
+int sendchar (int);
+int getkey (void);
+int SerialAvailable (void);
+void stream_run (unsigned long rate, unsigned int block, unsigned char flags);
+void PoolInit (void);
+unsigned char *PoolAlloc (void);
+void PoolFree (unsigned char *buf);
+void CobsRxStart (CobsRx *s);
+int CobsRxByte (CobsRx *s, unsigned char ch);
+void CobsTxStart (void);
+void CobsTxByte (unsigned char ch);
+void CobsTxEnd (void);
+unsigned short Crc16Block (unsigned short crc, const unsigned char *p, unsigned int n);
+unsigned char getkey_crc(void);
+int crc_ok(void);
+void send_payload(void);
+void ProfInit (void);
+void ProfReset (void);
+void ProfAdd (unsigned int point, unsigned long cycles);
+void ProfRead (unsigned char *buf, unsigned int len);
+
+extern const unsigned short CrcTable[256];
+extern volatile unsigned long UartOverruns, UartRxDropped;
+extern volatile unsigned int PoolHighWater;
+extern volatile unsigned long PoolExhausted;
@@ -0,0 +1,107 @@
+/****************************************************************************/
+/* POOL.C: Fixed pool of frame payload buffers                              */
+/****************************************************************************/
+/**
+* @file pool.c
+*
+* Preallocated payload buffers that replace malloc/free per frame. Every
+* buffer holds the largest payload, so an allocation never depends on the
+* frame length and takes the same time for every frame.
+*
+* @note
+*
+* The free buffers are kept in a ring of pointers: PoolAlloc takes from the
+* head and PoolFree returns at the tail. As with the UART rings, no lock is
+* needed as long as each end is used from one context only (e.g. buffers
+* allocated in an interrupt handler and freed by the main loop).
+* POOL_BUFS covers a full window of held frames plus the frame being
+* received, so the protocol itself cannot exhaust the pool.
+*
+*****************************************************************************/
+
+/***************************** Include Files ********************************/
+
+#include "library.h"
+
+/************************** Constant Definitions ****************************/
+
+#define POOL_RING        16              /* Power of 2, >= POOL_BUFS        */
+
+/************************** Variable Definitions ****************************/
+
+static unsigned char PoolMem[POOL_BUFS][POOL_SIZE];
+static unsigned char *PoolRing[POOL_RING];
+static volatile unsigned int PoolHead, PoolTail;  /* Free buffers between */
+
+volatile unsigned int PoolHighWater;     /* Most buffers ever allocated     */
+volatile unsigned long PoolExhausted;    /* PoolAlloc calls that failed     */
+
+/****************************************************************************/
+/**
+* Puts every buffer on the free ring.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		Must run before the first PoolAlloc. The counters are kept.
+*
+*****************************************************************************/
+
+void PoolInit (void)  {
+  unsigned int i;
+
+  for (i = 0; i < POOL_BUFS; i++)
+    PoolRing[i] = PoolMem[i];
+  PoolHead = 0;
+  PoolTail = POOL_BUFS;
+}
+
+
+/****************************************************************************/
+/**
+* Takes a payload buffer of POOL_SIZE bytes.
+*
+* @param	None.
+*
+* @return	The buffer, or NULL if all POOL_BUFS buffers are in use.
+*
+* @note		None.
+*
+*****************************************************************************/
+
+unsigned char *PoolAlloc (void)  {
+  unsigned char *buf;
+  unsigned int used;
+
+  if (PoolHead == PoolTail)  {
+    PoolExhausted++;
+    return (NULL);
+  }
+  buf = PoolRing[PoolHead & (POOL_RING - 1)];
+  PoolHead++;
+  used = POOL_BUFS - (PoolTail - PoolHead);  /* Only PoolAlloc writes    */
+  if (used > PoolHighWater)                   /* the high-water mark     */
+    PoolHighWater = used;
+  return (buf);
+}
+
+
+/****************************************************************************/
+/**
+* Returns a buffer taken with PoolAlloc.
+*
+* @param	buf is the buffer, NULL is ignored (as with free()).
+*
+* @return	None.
+*
+* @note		None.
+*
+*****************************************************************************/
+
+void PoolFree (unsigned char *buf)  {
+  if (buf == NULL)
+    return;
+  PoolRing[PoolTail & (POOL_RING - 1)] = buf;
+  PoolTail++;
+}
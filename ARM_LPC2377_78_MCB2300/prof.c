@@ -0,0 +1,156 @@
+/****************************************************************************/
+/* PROF.C: Cycle counts of the firmware phases                              */
+/****************************************************************************/
+/**
+* @file prof.c
+*
+* Profiling points around the phases of the main loop and the device
+* handlers. Timer3 runs from PCLK_TIMER3 with no prescaler, so with CCLK it
+* counts CPU cycles; PROF_BEGIN() takes T3TC and PROF_END() adds the cycles since to
+* the point's count, minimum, maximum and sum. The host reads the table
+* with a MODE_STATS frame (see ProfRead for the layout).
+*
+* @note
+*
+* Points nest: the RX and TX waits inside getkey()/sendchar() are also part
+* of the phase that called them, and every phase is part of its frame. The
+* UART and stream interrupts are counted in whatever they interrupted.
+* PCLK_TIMER3 is selected by the startup code before the PLL is connected:
+* CCLK with PCLKSEL1_VAL, CCLK/4 with the stock startup. ProfInit() reads it
+* back and the table reports the rate the counts are in.
+* T3TC wraps after 89 s at 48 MHz, longer than any phase. Built with
+* PROFILE 0 the points cost nothing and the table stays empty.
+*
+*****************************************************************************/
+
+/***************************** Include Files ********************************/
+
+#include "library.h"
+
+/************************** Constant Definitions ****************************/
+
+#define PCONP_TIM3       (1UL << 23)
+#define PCLKSEL_TIM3     14              /* PCLK_TIMER3 = PCLKSEL1[15:14]   */
+
+/**************************** Type Definitions ******************************/
+
+typedef struct {
+  unsigned long count, min, max;
+  unsigned long long sum;
+} ProfPoint;
+
+/************************** Variable Definitions ****************************/
+
+static ProfPoint Prof[PROF_POINTS];
+static unsigned long ProfHz;             /* Timer3 count rate               */
+static const unsigned char PclkDiv[4] = { 4, 1, 2, 8 };  /* By PCLKSEL value */
+
+/****************************************************************************/
+/**
+* Starts Timer3 and clears the table.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		PCLKSEL1 is only read: written after the PLL is connected,
+*		it would not take effect reliably.
+*
+*****************************************************************************/
+
+void ProfInit (void)  {
+  PCONP |= PCONP_TIM3;
+  ProfHz = CCLK_HZ / PclkDiv[(PCLKSEL1 >> PCLKSEL_TIM3) & 3];
+  T3TCR = 0x02;                          /* Reset                           */
+  T3PR  = 0;
+  T3MCR = 0;
+  T3TCR = 0x01;                          /* Free running                    */
+  ProfReset();
+}
+
+
+void ProfReset (void)  {
+  unsigned int i;
+
+  for (i = 0; i < PROF_POINTS; i++)  {
+    Prof[i].count = 0;
+    Prof[i].min = 0xFFFFFFFFUL;
+    Prof[i].max = 0;
+    Prof[i].sum = 0;
+  }
+}
+
+
+/****************************************************************************/
+/**
+* Adds one pass through a profiling point.
+*
+* @param	point is the PROF_ index.
+*
+* @param	cycles is the time it took.
+*
+* @return	None.
+*
+* @note		Called from the main loop only.
+*
+*****************************************************************************/
+
+void ProfAdd (unsigned int point, unsigned long cycles)  {
+  ProfPoint *p = &Prof[point];
+
+  p->count++;
+  p->sum += cycles;
+  if (cycles < p->min)
+    p->min = cycles;
+  if (cycles > p->max)
+    p->max = cycles;
+}
+
+
+static unsigned char *Put32 (unsigned char *p, unsigned long v)  {  /* LE  */
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+  return (p + 4);
+}
+
+/****************************************************************************/
+/**
+* Writes the table for the host, all fields 4 bytes little endian: the
+* cycle counter rate in Hz, the number of points, then per point count,
+* min, max and the sum (low word, high word), then UartOverruns,
+* UartRxDropped, PoolHighWater and PoolExhausted. PROF_STATS_LEN bytes.
+*
+* @param	buf receives the data.
+*
+* @param	len is the payload length asked for; the table is cut or padded
+*		with zeros to it.
+*
+* @return	None.
+*
+* @note		A point never passed reports min 0.
+*
+*****************************************************************************/
+
+void ProfRead (unsigned char *buf, unsigned int len)  {
+  unsigned char table[PROF_STATS_LEN], *p = table;
+  unsigned int i;
+
+  p = Put32(p, ProfHz);
+  p = Put32(p, PROF_POINTS);
+  for (i = 0; i < PROF_POINTS; i++)  {
+    p = Put32(p, Prof[i].count);
+    p = Put32(p, Prof[i].count ? Prof[i].min : 0);
+    p = Put32(p, Prof[i].max);
+    p = Put32(p, (unsigned long)Prof[i].sum);
+    p = Put32(p, (unsigned long)(Prof[i].sum >> 32));
+  }
+  p = Put32(p, UartOverruns);
+  p = Put32(p, UartRxDropped);
+  p = Put32(p, PoolHighWater);
+  p = Put32(p, PoolExhausted);
+
+  for (i = 0; i < len; i++)
+    buf[i] = i < PROF_STATS_LEN ? table[i] : 0;
+}
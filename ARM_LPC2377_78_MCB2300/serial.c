@@ -1,129 +1,556 @@
-/****************************************************************************/
-/* SERIAL.C: Low Level Serial Routines                                      */
-/****************************************************************************/
-/* This file is part of the uVision/ARM development tools.                  */
-/* Copyright (c) 2005-2006 Keil Software. All rights reserved.              */
-/* This software may only be used under the terms of a valid, current,      */
-/* end user licence from KEIL for a compatible version of KEIL software     */
-/* development tools. Nothing else gives you the right to use this software.*/
-/****************************************************************************/
-/**
-* @file serial.c
-*
-* Low Level Serial Routines
-*
-* @note
-*
-* None
-*
-* <pre>
-* MODIFICATION HISTORY:
-*
-* Ver	Who  Date     Changes
-* ----- ---- -------- -----------------------------------------------
-* 1.00  keil
-* </pre>
-*
-*****************************************************************************/
-
-/***************************** Include Files ********************************/
-
-#include <lpc23xx.h>                     /* LPC23xx definitions             */
-
-/************************** Constant Definitions ****************************/
-
-#define UART1                            /* Use UART 0 for printf           */
-
-/* If UART 0 is used for printf                                             */
-#ifdef UART0
-  #define UxFDR  U0FDR
-  #define UxLCR  U0LCR
-  #define UxDLL  U0DLL
-  #define UxDLM  U0DLM
-  #define UxLSR  U0LSR
-  #define UxTHR  U0THR
-  #define UxRBR  U0RBR
-/* If UART 1 is used for printf                                             */
-#elif defined(UART1)
-  #define UxFDR  U1FDR
-  #define UxLCR  U1LCR
-  #define UxDLL  U1DLL
-  #define UxDLM  U1DLM
-  #define UxLSR  U1LSR
-  #define UxTHR  U1THR
-  #define UxRBR  U1RBR
-#endif
-
-/**************************** Type Definitions ******************************/
-
-/***************** Macros (Inline Functions) Definitions ********************/
-
-/************************** Variable Definitions ****************************/
-
-/************************** Function Prototypes *****************************/
-
-/****************************************************************************/
-/**
-* Initialize Serial Interface.
-*
-* @param	None.
-*
-* @return	None.
-*
-* @note		None.
-*
-*****************************************************************************/
-
-void SerialInit (void)  {                /* Initialize Serial Interface     */
-  #ifdef UART0
-    PINSEL0 |= 0x00000050;               /* Enable TxD0 and RxD0            */
-  #elif defined (UART1)
-    PINSEL0 |= 0x40000000;               /* Enable TxD1                     */
-    PINSEL1 |= 0x00000001;               /* Enable RxD1                     */
-  #endif
-  UxFDR    = 0;                          /* Fractional divider not used     */
-  UxLCR    = 0x83;                       /* 8 bits, no Parity, 1 Stop bit   */
-  UxDLL    = 78;                         /* 9600 Baud Rate @ 12.0 MHZ PCLK  */
-  UxDLM    = 0;                          /* High divisor latch = 0          */
-  UxLCR    = 0x03;                       /* DLAB = 0                        */
-}
-
-
-/****************************************************************************/
-/**
-* Implementation of putchar (also used by printf function to output data)
-*
-* @param	ch is the Write character to Serial Port.
-*
-* @return	None.
-*
-* @note		None.
-*
-*****************************************************************************/
-
-int sendchar (int ch)  {                 /* Write character to Serial Port  */
-
-  while (!(UxLSR & 0x20));
-
-  return (UxTHR = ch);
-}
-
-
-/****************************************************************************/
- /**
-* Read character from Serial Port.
-*
-* @param	None.
-*
-* @return	Returns the character input from Serial Port.
-*
-* @note		None.
-*
-*****************************************************************************/
-
-int getkey (void)  {                     /* Read character from Serial Port */
-
-  while (!(UxLSR & 0x01));
-
-  return (UxRBR);
-}
+/****************************************************************************/
+/* SERIAL.C: Low Level Serial Routines                                      */
+/****************************************************************************/
+/* This file is part of the uVision/ARM development tools.                  */
+/* Copyright (c) 2005-2006 Keil Software. All rights reserved.              */
+/* This software may only be used under the terms of a valid, current,      */
+/* end user licence from KEIL for a compatible version of KEIL software     */
+/* development tools. Nothing else gives you the right to use this software.*/
+/****************************************************************************/
+/**
+* @file serial.c
+*
+* Low Level Serial Routines
+*
+* @note
+*
+* None
+*
+* <pre>
+* MODIFICATION HISTORY:
+*
+* Ver	Who  Date     Changes
+* ----- ---- -------- -----------------------------------------------
+* 1.00  keil
+* </pre>
+*
+*****************************************************************************/
+
+/***************************** Include Files ********************************/
+
+#include <lpc23xx.h>                     /* LPC23xx definitions             */
+#include "library.h"                     /* Profiling points                */
+
+/************************** Constant Definitions ****************************/
+
+#define UART1                            /* Use UART 0 for printf           */
+
+/* If UART 0 is used for printf                                             */
+#ifdef UART0
+  #define UxFDR  U0FDR
+  #define UxLCR  U0LCR
+  #define UxDLL  U0DLL
+  #define UxDLM  U0DLM
+  #define UxLSR  U0LSR
+  #define UxTHR  U0THR
+  #define UxRBR  U0RBR
+  #define UxFCR  U0FCR
+  #define UxIER  U0IER
+  #define UxIIR  U0IIR
+  #define UxVectAddr      VICVectAddr6
+  #define UxVectPriority  VICVectPriority6
+  #define UxVIC  (1 << 6)                /* VIC channel 6                   */
+/* If UART 1 is used for printf                                             */
+#elif defined(UART1)
+  #define UxFDR  U1FDR
+  #define UxLCR  U1LCR
+  #define UxDLL  U1DLL
+  #define UxDLM  U1DLM
+  #define UxLSR  U1LSR
+  #define UxTHR  U1THR
+  #define UxRBR  U1RBR
+  #define UxFCR  U1FCR
+  #define UxIER  U1IER
+  #define UxIIR  U1IIR
+  #define UxVectAddr      VICVectAddr7
+  #define UxVectPriority  VICVectPriority7
+  #define UxVIC  (1 << 7)                /* VIC channel 7                   */
+#endif
+
+/* Ring buffers between the UART interrupt and getkey/sendchar. Sizes must
+   be powers of 2; head and tail run freely and are masked on access.      */
+#define RX_SIZE          1024
+#define TX_SIZE          512
+#define FIFO_DEPTH       16              /* Hardware TX/RX FIFO depth       */
+
+#define LSR_RDR          0x01            /* Receiver data ready             */
+#define LSR_ERRORS       0x8E            /* OE, PE, FE, RXFE                */
+#define LSR_OE           0x02            /* Overrun error                   */
+#define LSR_TEMT         0x40            /* Transmitter empty               */
+
+#define IIR_PEND         0x01            /* 1 = no interrupt pending        */
+#define IIR_ID           0x0E
+#define IIR_RLS          0x06            /* Receive line status             */
+#define IIR_RDA          0x04            /* Receive data available          */
+#define IIR_CTI          0x0C            /* Character time-out              */
+#define IIR_THRE         0x02            /* THR empty                       */
+
+/* UART peripheral clock. The LPC23xx only takes a new PCLKSEL0 before the
+   PLL is connected, so the selection is left to the startup code and read
+   back here: PCLKSEL0_VAL selects CCLK (48 MHz with the default MCB2300
+   startup, PLL 288 MHz / 6), which reaches 921600 Baud; the stock startup
+   leaves the reset default CCLK/4 (12 MHz), which reaches 230400 Baud.     */
+#ifdef UART0
+  #define PCLKSEL_SHIFT  6               /* PCLK_UART0 = PCLKSEL0[7:6]      */
+#elif defined(UART1)
+  #define PCLKSEL_SHIFT  8               /* PCLK_UART1 = PCLKSEL0[9:8]      */
+#endif
+#define PCLKSEL_CCLK     1               /* Any other value is taken as /4  */
+
+/**************************** Type Definitions ******************************/
+
+typedef struct {
+  unsigned long  baud;                   /* Baud rate                       */
+  unsigned short dl;                     /* Divisor latch (DLM:DLL)         */
+  unsigned char  divaddval;              /* Fractional divider DIVADDVAL    */
+  unsigned char  mulval;                 /* Fractional divider MULVAL       */
+} BaudEntry;
+
+/***************** Macros (Inline Functions) Definitions ********************/
+
+/************************** Variable Definitions ****************************/
+
+/* Divisors for PCLK = 48 MHz, Baud = PCLK / (16 * DL * (1 + DIVADD/MUL)).
+   DL is kept >= 3 whenever the fractional divider is active (UM10211).
+   Worst case error is 0.16 %.                                              */
+static const BaudEntry BaudTable48[] = {
+  {   9600, 250,  1,  4 },               /*   9600.0 Baud, 0.00 %           */
+  {  19200, 125,  1,  4 },               /*  19200.0 Baud, 0.00 %           */
+  {  38400,  71,  1, 10 },               /*  38412.5 Baud, 0.03 %           */
+  {  57600,  27, 13, 14 },               /*  57613.2 Baud, 0.02 %           */
+  { 115200,  17,  8, 15 },               /* 115089.9 Baud, 0.10 %           */
+  { 230400,  13,  0,  1 },               /* 230769.2 Baud, 0.16 %           */
+  { 460800,   6,  1, 12 },               /* 461538.5 Baud, 0.16 %           */
+  { 921600,   3,  1, 12 },               /* 923076.9 Baud, 0.16 %           */
+};
+
+/* Divisors for PCLK = 12 MHz (CCLK/4). 460800 Baud would need DL < 3.      */
+static const BaudEntry BaudTable12[] = {
+  {   9600,  71,  1, 10 },               /*   9603.1 Baud, 0.03 %           */
+  {  19200,  23,  7, 10 },               /*  19181.6 Baud, 0.10 %           */
+  {  38400,  16,  2,  9 },               /*  38352.3 Baud, 0.12 %           */
+  {  57600,  13,  0,  1 },               /*  57692.3 Baud, 0.16 %           */
+  { 115200,   4,  5,  8 },               /* 115384.6 Baud, 0.16 %           */
+  { 230400,   3,  1, 12 },               /* 230769.2 Baud, 0.16 %           */
+};
+
+#define ENTRIES(t)  (sizeof(t) / sizeof((t)[0]))
+
+static const BaudEntry *BaudTable = BaudTable48;  /* Table for PCLK_UART    */
+static unsigned int BaudEntries = ENTRIES(BaudTable48);
+
+static unsigned char RxBuf[RX_SIZE];
+static unsigned char TxBuf[TX_SIZE];
+static volatile unsigned int RxHead, RxTail;  /* Head written by the ISR  */
+static volatile unsigned int TxHead, TxTail;  /* Tail written by the ISR  */
+static volatile unsigned char TxBusy;    /* THRE interrupt still to come    */
+
+static unsigned long Baud;               /* Rate programmed                 */
+static unsigned long FallbackBaud;       /* Rate before an unconfirmed switch */
+static unsigned long FallbackAt;         /* T0TC deadline of the confirmation */
+static unsigned char Pending;            /* Switch awaiting SerialConfirm() */
+static unsigned long IdleTime;           /* Ticks idle before UART_BAUD, 0 = off */
+static unsigned long IdleAt;             /* T0TC deadline of the idle wait  */
+
+volatile unsigned long UartOverruns;     /* Bytes lost in the hardware FIFO */
+volatile unsigned long UartRxDropped;    /* Bytes lost, RX ring full        */
+
+/************************** Function Prototypes *****************************/
+
+static void TxFill (void);
+static void SerialClock (void);
+static void SerialFallback (void);
+static void SerialIdle (void);
+void UART_IRQHandler (void) __irq;
+
+/****************************************************************************/
+/**
+* Initialize Serial Interface.
+*
+* @param	baud is the requested Baud rate, one of the BaudTable entries.
+*
+* @return	0 on success, -1 if the rate is not in the table (the port is
+*		then set up at 9600 Baud).
+*
+* @note		The table follows the PCLK_UART the startup code selected,
+*		see SerialClock.
+*
+*****************************************************************************/
+
+int SerialInit (unsigned long baud)  {   /* Initialize Serial Interface     */
+  const BaudEntry *b;
+  unsigned int i;
+  int ret = -1;
+
+  SerialClock();
+  b = &BaudTable[0];
+  for (i = 0; i < BaudEntries; i++)  {
+    if (BaudTable[i].baud == baud)  {
+      b = &BaudTable[i];
+      ret = 0;
+      break;
+    }
+  }
+
+  #ifdef UART0
+    PINSEL0 |= 0x00000050;               /* Enable TxD0 and RxD0            */
+  #elif defined (UART1)
+    PINSEL0 |= 0x40000000;               /* Enable TxD1                     */
+    PINSEL1 |= 0x00000001;               /* Enable RxD1                     */
+  #endif
+  UxLCR    = 0x83;                       /* 8 bits, no Parity, 1 Stop bit   */
+  UxDLL    = b->dl & 0xFF;               /* Low divisor latch               */
+  UxDLM    = b->dl >> 8;                 /* High divisor latch              */
+  UxFDR    = (b->mulval << 4) | b->divaddval;  /* Fractional divider        */
+  UxLCR    = 0x03;                       /* DLAB = 0                        */
+  UxFCR    = 0x87;                       /* FIFOs on and reset, RX trig = 8 */
+  Baud     = b->baud;
+
+  RxHead = RxTail = 0;
+  TxHead = TxTail = 0;
+  TxBusy = 0;
+
+  UxVectAddr     = (unsigned long)UART_IRQHandler;
+  UxVectPriority = 1;                    /* Just below the highest          */
+  UxIER    = 0x07;                       /* RBR, THRE and RX line status    */
+  VICIntEnable = UxVIC;
+
+  return (ret);
+}
+
+
+/****************************************************************************/
+/**
+* Chooses the divisor table for the PCLK_UART the startup code selected.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		PCLKSEL0 is only read: written after the PLL is connected,
+*		it would not take effect reliably.
+*
+*****************************************************************************/
+
+static void SerialClock (void)  {
+
+  if (((PCLKSEL0 >> PCLKSEL_SHIFT) & 3) == PCLKSEL_CCLK)  {
+    BaudTable   = BaudTable48;
+    BaudEntries = ENTRIES(BaudTable48);
+  } else  {
+    BaudTable   = BaudTable12;
+    BaudEntries = ENTRIES(BaudTable12);
+  }
+}
+
+
+/****************************************************************************/
+/**
+* UART interrupt handler. Moves received bytes from the RX FIFO into the RX
+* ring and refills the TX FIFO from the TX ring.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		A character time-out interrupt drains what is left below the
+*		RX trigger level.
+*
+*****************************************************************************/
+
+void UART_IRQHandler (void) __irq  {
+  unsigned long iir;
+
+  while (!((iir = UxIIR) & IIR_PEND))  {
+    switch (iir & IIR_ID)  {
+      case IIR_RLS:                      /* Reading LSR clears the error    */
+        if (UxLSR & LSR_OE)
+          UartOverruns++;
+        /* The byte in error is still in the FIFO, fall through            */
+      case IIR_RDA:
+      case IIR_CTI:
+        while (UxLSR & LSR_RDR)  {
+          if (RxHead - RxTail < RX_SIZE)  {
+            RxBuf[RxHead & (RX_SIZE - 1)] = UxRBR;
+            RxHead++;
+          }
+          else  {
+            (void)UxRBR;
+            UartRxDropped++;
+          }
+        }
+        break;
+
+      case IIR_THRE:
+        TxFill();
+        break;
+    }
+  }
+
+  VICVectAddr = 0;                       /* Acknowledge interrupt           */
+}
+
+
+/****************************************************************************/
+/**
+* Copy up to one FIFO worth of bytes from the TX ring into THR.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		Called with the UART interrupt disabled or from the ISR. TxBusy
+*		stays set while a THRE interrupt is still to come.
+*
+*****************************************************************************/
+
+static void TxFill (void)  {
+  int n;
+
+  for (n = 0; (n < FIFO_DEPTH) && (TxTail != TxHead); n++)  {
+    UxTHR = TxBuf[TxTail & (TX_SIZE - 1)];
+    TxTail++;
+  }
+  TxBusy = (n != 0);
+}
+
+
+/****************************************************************************/
+/**
+* Implementation of putchar (also used by printf function to output data)
+*
+* @param	ch is the Write character to Serial Port.
+*
+* @return	The character written.
+*
+* @note		Queues the character in the TX ring; only waits while the
+*		ring is full. An idle transmitter is started here, later
+*		bursts are sent from the THRE interrupt.
+*
+*****************************************************************************/
+
+int sendchar (int ch)  {                 /* Write character to Serial Port  */
+  unsigned long t;
+
+  if (TxHead - TxTail >= TX_SIZE)  {     /* Time spent waiting, PROF_TX_WAIT */
+    PROF_BEGIN(t);
+    while (TxHead - TxTail >= TX_SIZE)
+      CPU_IDLE();
+    PROF_END(PROF_TX_WAIT, t);
+  }
+
+  TxBuf[TxHead & (TX_SIZE - 1)] = ch;
+  TxHead++;
+
+  if (!TxBusy)  {
+    VICIntEnClr = UxVIC;                 /* TxBusy may change in the ISR    */
+    if (!TxBusy)
+      TxFill();
+    VICIntEnable = UxVIC;
+  }
+
+  return (ch);
+}
+
+
+/****************************************************************************/
+ /**
+* Read character from Serial Port.
+*
+* @param	None.
+*
+* @return	Returns the character input from Serial Port.
+*
+* @note		Takes the next character from the RX ring, waiting while it
+*		is empty. An unconfirmed rate switch falls back while waiting,
+*		a confirmed one goes back to UART_BAUD after a long wait.
+*
+*****************************************************************************/
+
+int getkey (void)  {                     /* Read character from Serial Port */
+  unsigned long t;
+  int ch;
+
+  if (Pending)                           /* Garbage keeps coming at a bad rate */
+    SerialFallback();
+  if (RxHead == RxTail)  {               /* Time spent waiting, PROF_RX_WAIT */
+    PROF_BEGIN(t);
+    IdleAt = T0TC + IdleTime;
+    while (RxHead == RxTail)  {
+      if (Pending)
+        SerialFallback();
+      else if (IdleTime)
+        SerialIdle();
+      CPU_IDLE();
+    }
+    PROF_END(PROF_RX_WAIT, t);
+  }
+
+  ch = RxBuf[RxTail & (RX_SIZE - 1)];
+  RxTail++;
+
+  return (ch);
+}
+
+
+/****************************************************************************/
+/**
+* Number of received characters waiting to be read.
+*
+* @param	None.
+*
+* @return	Characters in the RX ring.
+*
+* @note		Lets long running loops check for host input without waiting.
+*
+*****************************************************************************/
+
+int SerialAvailable (void)  {
+
+  return (RxHead - RxTail);
+}
+
+
+/****************************************************************************/
+/**
+* Baud rate the port runs at.
+*
+* @param	None.
+*
+* @return	The BaudTable rate programmed by SerialInit.
+*
+* @note		None.
+*
+*****************************************************************************/
+
+unsigned long SerialBaud (void)  {
+
+  return (Baud);
+}
+
+
+/****************************************************************************/
+/**
+* Supported Baud rates, slowest first.
+*
+* @param	i is the index.
+*
+* @return	The i-th BaudTable rate, 0 past the end.
+*
+* @note		None.
+*
+*****************************************************************************/
+
+unsigned long SerialRate (unsigned int i)  {
+
+  return (i < BaudEntries ? BaudTable[i].baud : 0);
+}
+
+
+/****************************************************************************/
+/**
+* Switches to another Baud rate, falling back to the current one unless
+* SerialConfirm is called within confirm_ms.
+*
+* @param	baud is the new rate, one of the BaudTable entries.
+*
+* @param	confirm_ms is the time the host has to confirm the rate.
+*
+* @return	0 on success, -1 if the rate is not in the table (nothing is
+*		changed then).
+*
+* @note		Waits until the last bit of what was queued (the ACK of the
+*		switch) has left the transmitter. Bytes received meanwhile are
+*		dropped with the rings: the host is not to send until it has
+*		switched itself. A second switch before the confirmation keeps
+*		the rate of the first as the fallback.
+*
+*****************************************************************************/
+
+int SerialSwitch (unsigned long baud, unsigned int confirm_ms)  {
+  unsigned int i;
+
+  for (i = 0; (i < BaudEntries) && (BaudTable[i].baud != baud); i++)
+    ;
+  if (i == BaudEntries)
+    return (-1);
+
+  while ((TxHead != TxTail) || TxBusy || !(UxLSR & LSR_TEMT))
+    CPU_IDLE();
+  if (!Pending)
+    FallbackBaud = Baud;
+  VICIntEnClr = UxVIC;
+  SerialInit(baud);
+  FallbackAt = T0TC + confirm_ms * (TICK_HZ / 1000);
+  Pending = 1;
+  return (0);
+}
+
+
+/****************************************************************************/
+/**
+* Keeps the rate of the last SerialSwitch while the host uses it.
+*
+* @param	idle_ms is the time getkey may wait for the next character
+*		before the port goes back to UART_BAUD.
+*
+* @return	None.
+*
+* @note		Only the pending switch is confirmed if there is one. The
+*		idle limit brings a board the host left at a negotiated rate
+*		back to the rate a new session starts at.
+*
+*****************************************************************************/
+
+void SerialConfirm (unsigned int idle_ms)  {
+
+  Pending = 0;
+  IdleTime = (Baud != UART_BAUD) ? idle_ms * (TICK_HZ / 1000) : 0;
+}
+
+
+/****************************************************************************/
+/**
+* Returns to the rate before an unconfirmed switch once its time is up.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		Called while getkey waits, so the board is back at the old
+*		rate even if the host lost every byte at the new one.
+*
+*****************************************************************************/
+
+static void SerialFallback (void)  {
+
+  if ((long)(T0TC - FallbackAt) < 0)
+    return;
+  Pending = 0;
+  VICIntEnClr = UxVIC;
+  SerialInit(FallbackBaud);
+  IdleAt = T0TC + IdleTime;              /* A confirmed rate waits again    */
+}
+
+
+/****************************************************************************/
+/**
+* Returns to UART_BAUD once getkey has waited IdleTime at a confirmed rate.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		The host is gone or left the line idle longer than the
+*		SerialConfirm limit; either way it starts again at UART_BAUD.
+*
+*****************************************************************************/
+
+static void SerialIdle (void)  {
+
+  if ((long)(T0TC - IdleAt) < 0)
+    return;
+  IdleTime = 0;
+  VICIntEnClr = UxVIC;
+  SerialInit(UART_BAUD);
+}
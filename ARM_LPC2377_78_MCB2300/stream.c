@@ -0,0 +1,189 @@
+/****************************************************************************/
+/* STREAM.C: Continuous ADC acquisition for the streaming mode              */
+/****************************************************************************/
+/**
+* @file stream.c
+*
+* Continuous ADC acquisition. The ADC runs in BURST mode on AD0.0 and Timer1
+* interrupts at the requested sample rate to take the latest result into
+* one of two sample blocks. Full blocks are sent to the host as packets
+* while the interrupt fills the other one, until the host sends a stop frame.
+*
+* @note
+*
+* Packet: fe|BID+0|block length|04|packet seq|lost samples|00|00|samples|01
+* Samples taken while both blocks wait to be sent are counted as lost and
+* reported in r2 of the next packet (saturating at 255). If the start frame
+* carried a CRC, packets have MODE_CRC set and their CRC in r3:r4. If it had
+* MODE_TS, packets have it too and the samples are followed by the Timer0
+* count (4 bytes LE) at which the first of them was taken.
+*
+*****************************************************************************/
+
+/***************************** Include Files ********************************/
+
+#include "library.h"
+
+/************************** Constant Definitions ****************************/
+
+#define AD0CR_START      0x07000000
+#define AD0CR_BURST      0x00010000
+#define T1_VIC           (1 << 5)        /* Timer1 is VIC channel 5         */
+
+/************************** Variable Definitions ****************************/
+
+static unsigned char StreamBuf[2][STREAM_BLOCK];
+static volatile unsigned char StreamFull[2];  /* Set by the ISR only      */
+static volatile unsigned char StreamCur;      /* Block the ISR fills      */
+static volatile unsigned int StreamFill;      /* Samples in that block    */
+static volatile unsigned long StreamStamp[2]; /* T0TC of their 1st sample */
+static volatile unsigned long StreamLost;
+static unsigned int StreamBlock;
+
+/************************** Function Prototypes *****************************/
+
+void Timer1_IRQHandler (void) __irq;
+
+/****************************************************************************/
+/**
+* Timer1 match interrupt: takes one sample at the stream rate.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		None.
+*
+*****************************************************************************/
+
+void Timer1_IRQHandler (void) __irq
+{
+  unsigned long dr;
+
+  T1IR = 0x01;                           /* Clear MR0 interrupt             */
+  dr = AD0DR0;                           /* Latest BURST conversion         */
+
+  if (StreamFull[StreamCur])
+    StreamLost++;                        /* Both blocks wait for the UART   */
+  else  {
+    if (StreamFill == 0)
+      StreamStamp[StreamCur] = T0TC;
+    StreamBuf[StreamCur][StreamFill++] = (dr >> 8) & 0xFF;  /* 8 MSBs     */
+    if (StreamFill == StreamBlock)  {
+      StreamFull[StreamCur] = 1;
+      StreamCur ^= 1;
+      StreamFill = 0;
+    }
+  }
+
+  VICVectAddr = 0;                       /* Acknowledge interrupt           */
+}
+
+
+/****************************************************************************/
+/**
+* Start BURST conversions and the sample clock.
+*
+* @param	rate is the sample rate in Hz.
+*
+* @return	None.
+*
+* @note		None.
+*
+*****************************************************************************/
+
+static void StreamStart (unsigned long rate)
+{
+  StreamFull[0] = StreamFull[1] = 0;
+  StreamCur = 0;
+  StreamFill = 0;
+  StreamLost = 0;
+
+  AD0CR = (AD0CR & ~AD0CR_START) | AD0CR_BURST;
+
+  PCONP |= 1 << 2;                       /* Power Timer1                    */
+  T1TCR = 0x02;                          /* Reset                           */
+  T1PR  = 0;
+  T1MR0 = TIMER_PCLK / rate - 1;
+  T1MCR = 0x03;                          /* Interrupt and reset on MR0      */
+  T1IR  = 0x3F;
+  VICVectAddr5 = (unsigned long)Timer1_IRQHandler;
+  VICVectPriority5 = 2;
+  VICIntEnable = T1_VIC;
+  T1TCR = 0x01;                          /* Start                           */
+}
+
+static void StreamStop (void)
+{
+  T1TCR = 0;
+  VICIntEnClr = T1_VIC;
+  AD0CR &= ~AD0CR_BURST;
+}
+
+
+/****************************************************************************/
+/**
+* Streaming mode. Called after the start frame (rate and block size) has
+* been acknowledged.
+*
+* @param	rate is the sample rate in Hz.
+*
+* @param	block is the number of samples per packet.
+*
+* @param	flags are MODE_CRC and MODE_TS of the start frame.
+*
+* @return	None.
+*
+* @note		Returns as soon as the host sends anything; the packet being
+*		sent is always completed first. The caller reads the stop frame.
+*
+*****************************************************************************/
+
+void stream_run (unsigned long rate, unsigned int block, unsigned char flags)
+{
+  unsigned long reported = 0, lost;
+  unsigned char send = 0, seq = 0, hdr[5], ts[4];
+  unsigned short sum = 0;
+  unsigned int i;
+
+  StreamBlock = block;
+  StreamStart(rate);
+
+  while (!SerialAvailable())  {
+    if (!StreamFull[send])  {
+      CPU_IDLE();
+      continue;
+    }
+    lost = StreamLost - reported;
+    reported += lost;
+
+    hdr[0] = BID | 0;                    /* Packet header                   */
+    hdr[1] = block;
+    hdr[2] = MODE_STREAM | flags;
+    hdr[3] = seq++;
+    hdr[4] = lost > 255 ? 255 : lost;
+    for (i = 0; i < 4; i++)
+      ts[i] = StreamStamp[send] >> (8 * i);
+    if (flags & MODE_CRC)  {
+      sum = Crc16Block(Crc16Block(CRC16_INIT, hdr, 5), StreamBuf[send], block);
+      if (flags & MODE_TS)
+        sum = Crc16Block(sum, ts, 4);
+    }
+    sendchar(0xFE);
+    for (i = 0; i < 5; i++)
+      sendchar(hdr[i]);
+    sendchar(sum >> 8);
+    sendchar(sum & 0xFF);
+    for (i = 0; i < block; i++)
+      sendchar(StreamBuf[send][i]);
+    if (flags & MODE_TS)
+      for (i = 0; i < 4; i++)
+        sendchar(ts[i]);
+    sendchar(STOP);
+
+    StreamFull[send] = 0;
+    send ^= 1;
+  }
+
+  StreamStop();
+}
@@ -0,0 +1,121 @@
+/*
+* Capture store throughput: appends stream-sized records (255 samples) from 8
+* boards interleaved, as a multi-port stream run would, and reports records/s,
+* MB/s and the msync() calls made. Then queries a 1 % time window and the whole
+* range, checking that the indexed query finds every record in the window, and
+* reports the index blocks read and skipped.
+*
+* $ gcc -O2 bench_capture.c capture.c -lpthread -o bench_capture
+* $ ./bench_capture <empty dir> [records]
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<time.h>
+
+#include "capture.h"
+
+#define BOARDS 8
+#define SAMPLES 255
+#define PERIOD_NS 2550000					//255 samples at 100 kHz, per board;
+
+static double now_s(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/*
+* Runs a query over [t0, t1]. Returns the records found, -1 on error; *sec
+* receives the time it took.
+*/
+static long query(const char *dir, int64_t t0, int64_t t1, double *sec, struct cap_query *q)
+{
+	const struct cap_record *r;
+	double s = now_s();
+	long n = 0;
+
+	cap_query_open(q, dir, t0, t1);
+	while((r = cap_query_next(q)) != NULL)
+		n++;
+	cap_query_close(q);
+	*sec = now_s() - s;
+	return errno ? -1 : n;
+}
+
+int main(int argc, char *argv[])
+{
+	static unsigned char samples[SAMPLES];
+	struct cap *c;
+	struct cap_query q;
+	long records, i, n, expect;
+	int64_t t, span, t0, t1;
+	double s, sec;
+
+	if(argc < 2)
+	{
+		printf("ERROR Usage: %s <empty dir> [records]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	records = argc > 2 ? atol(argv[2]) : 1000000;
+	for(i = 0; i < SAMPLES; i++)
+		samples[i] = i;
+	if((c = cap_open(argv[1], 0, 0)) == NULL)
+	{
+		perror("ERROR cap_open()");
+		exit(EXIT_FAILURE);
+	}
+	if(c->hdr->records || c->hdr->seg)
+	{
+		printf("ERROR %s already holds records\n", argv[1]);
+		exit(EXIT_FAILURE);
+	}
+
+	s = now_s();
+	for(i = 0; i < records; i++)				//Board i % 8, a little late now and then;
+	{
+		t = (i / BOARDS) * PERIOD_NS + (i % BOARDS) * 1000 + (i % 7 == 0 ? 3 * PERIOD_NS : 0);
+		if(cap_append(c, i % BOARDS, 0, 1, samples, SAMPLES, t, 50000, CAP_STAMPED) == -1)
+		{
+			perror("ERROR cap_append()");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if(cap_sync(c) == -1)
+	{
+		perror("ERROR cap_sync()");
+		exit(EXIT_FAILURE);
+	}
+	sec = now_s() - s;
+	printf("append: %ld records in %.3f s, %.0f records/s, %.1f MB/s, %lu segments, %lu msync calls\n",
+		records, sec, records / sec, c->bytes / sec / 1e6, c->segments, c->syncs);
+	cap_close(c);
+
+	span = (records / BOARDS) * PERIOD_NS;
+	t0 = span / 2;
+	t1 = t0 + span / 100;
+	expect = 0;
+	for(i = 0; i < records; i++)
+	{
+		t = (i / BOARDS) * PERIOD_NS + (i % BOARDS) * 1000 + (i % 7 == 0 ? 3 * PERIOD_NS : 0);
+		expect += (t >= t0) && (t <= t1);
+	}
+	if((n = query(argv[1], t0, t1, &sec, &q)) != expect)
+	{
+		printf("ERROR query found %ld records, %ld expected\n", n, expect);
+		exit(EXIT_FAILURE);
+	}
+	printf("query 1%%: %ld records in %.3f ms, %lu blocks read, %lu skipped\n", n, sec * 1e3, q.blocks_read,
+		q.blocks_skipped);
+	if((n = query(argv[1], INT64_MIN, INT64_MAX, &sec, &q)) != records)
+	{
+		printf("ERROR full scan found %ld records, %ld expected\n", n, records);
+		exit(EXIT_FAILURE);
+	}
+	printf("query all: %ld records in %.3f ms, %lu blocks read\n", n, sec * 1e3, q.blocks_read);
+	return 0;
+}
@@ -0,0 +1,122 @@
+/*
+* Per-operation overhead of libdaq: runs the first frame of a frame file ops
+* times, stop-and-wait and windowed, handing the ops to daq_submit_batch() and
+* collecting them from daq_poll_completions() in batches of 1, 16 and 256. The
+* host CPU time per op (user + system, from getrusage) is the cost of the
+* library and its system calls; the wall time also contains the line and the
+* device. Run it against the simulator without -p to keep the line out of it.
+*
+* $ gcc -O2 bench_daq.c libdaq.c hist.c crc16.c clock.c -lm -o bench_daq
+* $ ./bench_daq [-b baud] [-C] <tty> <frame file> [ops]
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<unistd.h>
+#include<fcntl.h>
+#include<time.h>
+#include<sys/resource.h>
+
+#include "libdaq.h"
+
+static double cpu_s(void)						//User + system time of this process;
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static double now_s(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/*
+* Runs ops operations on frame through dq, batch at a time. Returns the failed
+* ones, -1 on I/O error; *cpu and *wall receive the seconds per op.
+*/
+static int run(struct daq *dq, unsigned char *frame, int ops, int batch, double *cpu, double *wall)
+{
+	static struct daq_op op[DAQ_QUEUE];
+	struct daq_op *q[DAQ_QUEUE], *done[DAQ_QUEUE];
+	double c0 = cpu_s(), t0 = now_s();
+	int sent = 0, completed = 0, failed = 0, k, n;
+
+	while(completed < ops)
+	{
+		for(k = 0; (k < batch) && (sent < ops) && (sent - completed < DAQ_QUEUE); k++, sent++)
+		{
+			q[k] = &op[sent % DAQ_QUEUE];
+			q[k]->frame = frame;
+			q[k]->due = 0;
+		}
+		daq_submit_batch(dq, q, k);
+		if((n = daq_poll_completions(dq, done, batch)) == -1)
+			return -1;
+		for(k = 0; k < n; k++)
+			failed += done[k]->status != DAQ_DONE;
+		completed += n;
+	}
+	*cpu = (cpu_s() - c0) / ops;
+	*wall = (now_s() - t0) / ops;
+	return failed;
+}
+
+int main(int argc, char *argv[])
+{
+	static const int window[] = {0, 8}, batch[] = {1, 16, 256};
+	static unsigned char frame[8 + FRAME_MAX + 1];
+	struct daq_config cfg = DAQ_CONFIG_DEFAULT;
+	struct daq *dq;
+	double cpu, wall;
+	int fd, opt, ops, w, b, failed;
+
+	while((opt = getopt(argc, argv, "b:C")) != -1)
+	{
+		if(opt == 'b')
+			cfg.baud = strtol(optarg, NULL, 10);
+		else if(opt == 'C')
+			cfg.crc = 1;
+		else
+			optind = argc;
+	}
+	if(argc - optind < 2)
+	{
+		printf("ERROR Usage: %s [-b baud] [-C] <tty> <frame file> [ops]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	ops = argc - optind > 2 ? atoi(argv[optind + 2]) : 2000;
+	if(((fd = open(argv[optind + 1], O_RDONLY)) == -1) || (read(fd, frame, sizeof(frame)) < 9) ||
+		(frame[0] != 0xFE) || (PAYLOAD_LEN(frame) > FRAME_MAX))
+	{
+		printf("ERROR frame file\n");
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+
+	printf("%-8s%-8s%14s%14s%12s\n", "window", "batch", "cpu us/op", "wall us/op", "failed");
+	for(w = 0; w < 2; w++)
+	{
+		cfg.window = window[w];
+		if((dq = daq_open(argv[optind], &cfg)) == NULL)
+		{
+			perror("ERROR daq_open()");
+			exit(EXIT_FAILURE);
+		}
+		for(b = 0; b < 3; b++)
+		{
+			if((failed = run(dq, frame, ops, batch[b], &cpu, &wall)) == -1)
+			{
+				perror("ERROR daq_poll_completions()");
+				exit(EXIT_FAILURE);
+			}
+			printf("%-8d%-8d%14.1f%14.1f%12d\n", window[w], batch[b], cpu * 1e6, wall * 1e6, failed);
+		}
+		daq_close(dq);
+	}
+	return 0;
+}
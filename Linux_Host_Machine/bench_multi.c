@@ -0,0 +1,154 @@
+/*
+* Scaling of the multi-port runner: starts N simulated boards (mcb2300_sim, each
+* on its own pty, line paced to the baud rate) and replays the first frame of a
+* frame file ops times on every port, for 1, 2, 4 and 8 ports and 1, 2 and 4
+* worker threads. Reports the aggregate frames/s, the worker CPU time per frame
+* and the epoll wakeups per frame. With the line paced, frames/s should grow
+* with the ports until the host runs out of CPU; the CPU per frame shows what a
+* worker costs. The simulators need CPU too: on a small machine they compete with
+* the workers.
+*
+* $ gcc -O2 bench_multi.c multiport.c libdaq.c hist.c crc16.c clock.c -lpthread -lm -o bench_multi
+* $ ./bench_multi [-w window] [-A] <mcb2300_sim> <frame file> [ops per port]
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<unistd.h>
+#include<string.h>
+#include<fcntl.h>
+#include<signal.h>
+#include<sys/wait.h>
+
+#include "multiport.h"
+
+#define PORTS_MAX 8
+
+static pid_t sim[PORTS_MAX];
+static char tty[PORTS_MAX][64];
+
+static int start_sims(const char *bin, int n)			//Returns 0 once every pty exists;
+{
+	int i, t;
+
+	fflush(stdout);						//Not to be written again by the children;
+	for(i = 0; i < n; i++)
+	{
+		snprintf(tty[i], sizeof(tty[i]), "/tmp/bench_multi.%d.%d", (int)getpid(), i);
+		if((sim[i] = fork()) == 0)
+		{
+			freopen("/dev/null", "w", stdout);
+			freopen("/dev/null", "w", stderr);
+			execl(bin, bin, "-p", "-L", tty[i], (char *)NULL);
+			_exit(127);
+		}
+	}
+	for(i = 0; i < n; i++)
+		for(t = 0; access(tty[i], F_OK) == -1; t++)
+		{
+			if(t == 100)
+				return -1;
+			usleep(10000);
+		}
+	return 0;
+}
+
+static void stop_sims(int n)
+{
+	int i;
+
+	for(i = 0; i < n; i++)
+	{
+		kill(sim[i], SIGTERM);
+		waitpid(sim[i], NULL, 0);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	static const int ports[] = {1, 2, 4, 8}, workers[] = {1, 2, 4};
+	static unsigned char frame[8 + FRAME_MAX + 1];
+	static struct mp_port port[PORTS_MAX];
+	struct mp_worker w[4];
+	struct daq_config cfg = DAQ_CONFIG_DEFAULT;
+	unsigned char *fp = frame;
+	double cpu;
+	unsigned long frames, wakeups;
+	long long t0, ms;
+	int fd, opt, ops, p, k, i, pin = 0;
+
+	while((opt = getopt(argc, argv, "w:A")) != -1)
+	{
+		if(opt == 'w')
+			cfg.window = atoi(optarg);
+		else if(opt == 'A')
+			pin = 1;
+		else
+			optind = argc;
+	}
+	if(argc - optind < 2)
+	{
+		printf("ERROR Usage: %s [-w window] [-A] <mcb2300_sim> <frame file> [ops per port]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	ops = argc - optind > 2 ? atoi(argv[optind + 2]) : 500;
+	if(((fd = open(argv[optind + 1], O_RDONLY)) == -1) || (read(fd, frame, sizeof(frame)) < 9) ||
+		(frame[0] != 0xFE) || (PAYLOAD_LEN(frame) > FRAME_MAX))
+	{
+		printf("ERROR frame file\n");
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+
+	printf("%-8s%-10s%14s%14s%16s%10s\n", "ports", "workers", "frames/s", "cpu us/frame", "wakeups/frame", "failed");
+	for(p = 0; p < 4; p++)
+	{
+		if(start_sims(argv[optind], ports[p]) == -1)
+		{
+			printf("ERROR simulator did not start\n");
+			stop_sims(ports[p]);
+			exit(EXIT_FAILURE);
+		}
+		for(k = 0; (k < 3) && (workers[k] <= ports[p]); k++)
+		{
+			for(i = 0; i < ports[p]; i++)
+			{
+				port[i].tty = tty[i];
+				port[i].frame = &fp;
+				port[i].count = 1;
+				port[i].total = ops;
+				if((port[i].dq = daq_open(tty[i], &cfg)) == NULL)
+				{
+					perror("ERROR daq_open()");
+					stop_sims(ports[p]);
+					exit(EXIT_FAILURE);
+				}
+			}
+			t0 = daq_now_ms();
+			if(mp_run(port, ports[p], w, workers[k], 0, pin, NULL, NULL, 0) == -1)
+			{
+				perror("ERROR mp_run()");
+				stop_sims(ports[p]);
+				exit(EXIT_FAILURE);
+			}
+			ms = daq_now_ms() - t0;
+			cpu = 0;
+			frames = wakeups = 0;
+			for(i = 0; i < workers[k]; i++)
+			{
+				cpu += w[i].cpu_s;
+				frames += w[i].frames;
+				wakeups += w[i].wakeups;
+			}
+			for(i = 0; i < ports[p]; i++)
+			{
+				frames -= port[i].failed;
+				daq_close(port[i].dq);
+			}
+			printf("%-8d%-10d%14.1f%14.1f%16.2f%10lu\n", ports[p], workers[k], frames * 1000.0 / ms,
+				cpu * 1e6 / (ops * ports[p]), (double)wakeups / (ops * ports[p]), ops * ports[p] - frames);
+		}
+		stop_sims(ports[p]);
+	}
+	return 0;
+}
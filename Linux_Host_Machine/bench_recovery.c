@@ -0,0 +1,252 @@
+/*
+* Recovery from line errors, plain windowed frames against COBS framed ones (-F
+* in the tool): runs the same windowed reads from the ADC and writes to the LCD,
+* with CRCs, against the paced simulator for every error rate and every seed,
+* each on a freshly started simulator, and reports per framing and error rate
+* the bytes the simulator corrupted (from its log), the retries, timeouts, COBS
+* replies dropped and ops failed, frames/s, the op latency p99 and the recovery
+* time: the time the runs took beyond the error-free run, divided by the bytes
+* corrupted, i.e. what one bit error on the line costs.
+*
+* $ gcc -O2 bench_recovery.c libdaq.c hist.c crc16.c clock.c -lm -o bench_recovery
+* $ ./bench_recovery [-n ops] [-w window] [-r retries] [-t timeout_ms] [-e error rates] [-s seeds] <mcb2300_sim>
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<unistd.h>
+#include<string.h>
+#include<signal.h>
+#include<sys/wait.h>
+
+#include "libdaq.h"
+
+#define LIST_MAX 16
+#define READ_LEN 64
+#define WRITE_LEN 16
+
+struct result
+{
+	double sec;
+	unsigned long corrupted, retries, timeouts, dropped;
+	int failed;
+	double p99;						//us, the worst of the seeds;
+};
+
+static pid_t sim;
+static char tty[64], log_path[64];
+
+static int start_sim(const char *bin, double error, int seed)	//Returns 0 once the pty exists;
+{
+	char rate[32], s[16];
+	int t;
+
+	snprintf(tty, sizeof(tty), "/tmp/bench_recovery.%d", (int)getpid());
+	snprintf(log_path, sizeof(log_path), "/tmp/bench_recovery.%d.log", (int)getpid());
+	snprintf(rate, sizeof(rate), "%g", error);
+	snprintf(s, sizeof(s), "%d", seed);
+	unlink(log_path);
+	fflush(stdout);						//Not to be written again by the child;
+	if((sim = fork()) == 0)
+	{
+		freopen("/dev/null", "w", stdout);
+		freopen("/dev/null", "w", stderr);
+		execl(bin, bin, "-p", "-e", rate, "-s", s, "-L", tty, "-l", log_path, (char *)NULL);
+		_exit(127);
+	}
+	for(t = 0; access(tty, F_OK) == -1; t++)
+	{
+		if(t == 100)
+			return -1;
+		usleep(10000);
+	}
+	return 0;
+}
+
+static unsigned long stop_sim(void)				//Returns the bytes it corrupted;
+{
+	unsigned long rx, tx, bad = 0;
+	char line[256], *p;
+	FILE *f;
+
+	kill(sim, SIGTERM);
+	waitpid(sim, NULL, 0);
+	unlink(tty);
+	if((f = fopen(log_path, "r")) != NULL)
+	{
+		while(fgets(line, sizeof(line), f) != NULL)
+			if(((p = strstr(line, "exit: ")) != NULL) &&
+				(sscanf(p, "exit: %lu bytes received, %lu sent, %lu corrupted", &rx, &tx, &bad) == 3))
+				break;
+		fclose(f);
+	}
+	unlink(log_path);
+	return bad;
+}
+
+static int parse_list(const char *s, double *v)			//Comma separated, returns the count;
+{
+	char *end;
+	int n = 0;
+
+	while((n < LIST_MAX) && (*s != '\0'))
+	{
+		v[n++] = strtod(s, &end);
+		if((end == s) || ((*end != ',') && (*end != '\0')))
+			return -1;
+		s = *end == ',' ? end + 1 : end;
+	}
+	return n;
+}
+
+static void make_frame(unsigned char *f, int write, int len)	//ADC read or LCD write of len bytes;
+{
+	int i;
+
+	memset(f, 0, 8);
+	f[0] = 0xFE;
+	f[1] = write ? 0x01 : 0x00;
+	f[2] = len;
+	f[3] = write ? MODE_WRITE : MODE_READ;
+	for(i = 0; i < len; i++)
+		f[8 + i] = write ? 'A' + i % 26 : 0;
+	f[8 + len] = STOP;
+}
+
+/*
+* Runs ops ops, reads and writes in turn, through a fresh handle on the
+* simulator's pty and adds to r. Returns 0, -1 on error.
+*/
+static int run(const struct daq_config *cfg, int ops, struct result *r)
+{
+	static unsigned char frame[2][8 + READ_LEN + 1];
+	static struct daq_op op[DAQ_QUEUE];
+	struct daq_op *q[DAQ_QUEUE], *done[DAQ_QUEUE];
+	const struct daq_stats *st;
+	struct daq *dq;
+	long long t0;
+	double p99;
+	int sent = 0, completed = 0, k, n;
+
+	make_frame(frame[0], 0, READ_LEN);
+	make_frame(frame[1], 1, WRITE_LEN);
+	if((dq = daq_open(tty, cfg)) == NULL)
+		return -1;
+	t0 = daq_now_ms();
+	while(completed < ops)
+	{
+		for(k = 0; (sent < ops) && (sent - completed < DAQ_QUEUE); k++, sent++)
+		{
+			q[k] = &op[sent % DAQ_QUEUE];
+			q[k]->frame = frame[sent & 1];
+			q[k]->due = 0;
+		}
+		daq_submit_batch(dq, q, k);
+		if((n = daq_poll_completions(dq, done, DAQ_QUEUE)) == -1)
+		{
+			daq_close(dq);
+			return -1;
+		}
+		for(k = 0; k < n; k++)
+			r->failed += done[k]->status != DAQ_DONE;
+		completed += n;
+	}
+	r->sec += (daq_now_ms() - t0) / 1e3;
+
+	st = daq_stats(dq);
+	r->retries += st->retries;
+	r->dropped += st->dropped;
+	for(k = 0; k < PHASES; k++)
+		r->timeouts += st->timeouts[k];
+	p99 = hist_quantile(&st->latency[LAT_OP], 0.99) / 1e3;
+	r->p99 = p99 > r->p99 ? p99 : r->p99;
+	daq_close(dq);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	double error[LIST_MAX] = {1e-4, 1e-3, 3e-3, 1e-2}, seed[LIST_MAX] = {1, 2, 3, 4, 5};
+	int nerror = 4, nseed = 5, ops = 400, opt, c, e, k;
+	struct daq_config cfg = DAQ_CONFIG_DEFAULT;
+	struct result clean = {0}, r;
+	double lost;
+
+	cfg.timeout_ms = 50;					//Simulator on the same host;
+	cfg.retries = 8;					//Failures would shorten the runs;
+	cfg.window = 8;
+	cfg.crc = 1;
+	while((opt = getopt(argc, argv, "n:w:r:t:e:s:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'n':
+				ops = atoi(optarg);
+				break;
+			case 'w':
+				cfg.window = atoi(optarg);
+				break;
+			case 'r':
+				cfg.retries = atoi(optarg);
+				break;
+			case 't':
+				cfg.timeout_ms = atol(optarg);
+				break;
+			case 'e':
+				nerror = parse_list(optarg, error);
+				break;
+			case 's':
+				nseed = parse_list(optarg, seed);
+				break;
+			default:
+				optind = argc;
+				break;
+		}
+	}
+	if((argc - optind != 1) || (ops < 1) || (cfg.window < 1) || (cfg.window > WINDOW_MAX) || (cfg.retries < 0) ||
+		(cfg.retries > 255) || (cfg.timeout_ms < 1) || (nerror < 1) || (nseed < 1))
+	{
+		printf("ERROR Usage: %s [-n ops] [-w window(1-%d)] [-r retries] [-t timeout_ms] [-e error rates] [-s seeds] <mcb2300_sim>\n",
+			argv[0], WINDOW_MAX);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%d ops per run (%d B reads, %d B writes), -w %d, -t %ld ms, -r %d, CRC, %d seeds\n\n", ops, READ_LEN,
+		WRITE_LEN, cfg.window, cfg.timeout_ms, cfg.retries, nseed);
+	printf("%-6s%8s%10s%9s%10s%9s%8s%10s%9s%13s\n", "frame", "error", "corrupt", "retries", "timeouts", "dropped",
+		"failed", "frames/s", "p99 ms", "recovery ms");
+	for(c = 0; c < 2; c++)
+	{
+		cfg.cobs = c;
+		for(e = -1; e < nerror; e++)			//-1: the error-free run, once;
+		{
+			memset(&r, 0, sizeof(r));
+			for(k = 0; k < (e < 0 ? 1 : nseed); k++)
+			{
+				if(start_sim(argv[optind], e < 0 ? 0 : error[e], (int)seed[k]) == -1)
+				{
+					printf("ERROR %s did not start\n", argv[optind]);
+					stop_sim();
+					exit(EXIT_FAILURE);
+				}
+				if(run(&cfg, ops, &r) == -1)
+				{
+					perror("ERROR run");
+					stop_sim();
+					exit(EXIT_FAILURE);
+				}
+				r.corrupted += stop_sim();
+			}
+			if(e < 0)
+				clean = r;
+			lost = e < 0 ? 0 : r.sec - clean.sec * nseed;
+			printf("%-6s%8g%10lu%9lu%10lu%9lu%8d%10.1f%9.1f", c ? "cobs" : "plain", e < 0 ? 0 : error[e], r.corrupted,
+				r.retries, r.timeouts, r.dropped, r.failed, (e < 0 ? ops : ops * nseed) / r.sec, r.p99 / 1e3);
+			if(r.corrupted)
+				printf("%13.2f\n", 1e3 * lost / r.corrupted);
+			else
+				printf("%13s\n", "-");
+		}
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,412 @@
+/*
+* Throughput and latency suite for libdaq and the protocol core: for every
+* simulator given (one per line rate, built with -DUART_BAUD=<rate>) runs reads
+* from the ADC and writes to the LCD against the paced simulator for every
+* payload size, window and error rate, each on a freshly started simulator with
+* a fixed seed so that every run sees the same corrupted bytes. Every
+* configuration runs -r times and keeps its best frames/s and best latencies,
+* which takes out most of the noise of other load on the host. Reports per
+* configuration frames/s, payload bytes/s, wire efficiency (payload over all
+* bytes on the line), line use (payload against the line rate) and the op
+* latency percentiles, and writes them to a baseline file, one tab separated
+* line per configuration. With -c it compares against an earlier baseline and
+* exits non-zero if frames/s fell or the median latency rose by more than -T %,
+* or the p99 latency rose by more than -P % (tails are noisier, more so when the
+* simulator shares a CPU with the host).
+*
+* $ gcc -O2 bench_suite.c libdaq.c hist.c crc16.c clock.c -lm -o bench_suite
+* $ ./bench_suite [-o baseline] [-c old baseline] [-T tolerance %] [-P p99 tolerance %] [-B bytes] [-r runs]
+*	[-t timeout_ms] [-C] [-p payloads] [-w windows] [-e error rates] <baud>:<mcb2300_sim> [<baud>:<mcb2300_sim>...]
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<unistd.h>
+#include<string.h>
+#include<signal.h>
+#include<sys/wait.h>
+
+#include "libdaq.h"
+
+#define LIST_MAX 16
+#define SEED "1"						//Simulator error/noise seed;
+#define OPS_MIN 20						//Ops per configuration, at least;
+#define OPS_MAX 500
+#define BASELINE_VERSION 1
+
+struct result
+{
+	char op[8];
+	long baud;
+	int payload, window;
+	double error;
+	int ops, failed;
+	double fps, bps, efficiency, line, p50, p99, p999, max;	//Latencies in us;
+	unsigned long retries, timeouts;
+};
+
+static pid_t sim;
+static char tty[64];
+
+static int start_sim(const char *bin, double error)		//Returns 0 once the pty exists;
+{
+	char rate[32];
+	int t;
+
+	snprintf(tty, sizeof(tty), "/tmp/bench_suite.%d", (int)getpid());
+	snprintf(rate, sizeof(rate), "%g", error);
+	fflush(stdout);						//Not to be written again by the child;
+	if((sim = fork()) == 0)
+	{
+		freopen("/dev/null", "w", stdout);
+		freopen("/dev/null", "w", stderr);
+		execl(bin, bin, "-p", "-e", rate, "-s", SEED, "-L", tty, (char *)NULL);
+		_exit(127);
+	}
+	for(t = 0; access(tty, F_OK) == -1; t++)
+	{
+		if(t == 100)
+			return -1;
+		usleep(10000);
+	}
+	return 0;
+}
+
+static void stop_sim(void)
+{
+	kill(sim, SIGTERM);
+	waitpid(sim, NULL, 0);
+	unlink(tty);
+}
+
+static int parse_list(const char *s, double *v)			//Comma separated, returns the count;
+{
+	char *end;
+	int n = 0;
+
+	while((n < LIST_MAX) && (*s != '\0'))
+	{
+		v[n++] = strtod(s, &end);
+		if((end == s) || ((*end != ',') && (*end != '\0')))
+			return -1;
+		s = *end == ',' ? end + 1 : end;
+	}
+	return n;
+}
+
+/*
+* A read of len bytes from the ADC or a write of len bytes to the LCD, extended
+* above 255 bytes.
+*/
+static void make_frame(unsigned char *f, int write, int len)
+{
+	int i;
+
+	memset(f, 0, 8);
+	f[0] = 0xFE;
+	f[1] = write ? 0x01 : 0x00;
+	f[2] = len & 0xFF;
+	f[3] = (write ? MODE_WRITE : MODE_READ) | (len > 255 ? MODE_EXT : 0);
+	f[5] = len > 255 ? len >> 8 : 0;
+	for(i = 0; i < len; i++)
+		f[8 + i] = 'A' + i % 26;
+	f[8 + len] = STOP;
+}
+
+/*
+* Runs ops ops on frame through a fresh handle on the simulator's pty and fills
+* r. Returns 0, -1 on error.
+*/
+static int run(const struct daq_config *cfg, unsigned char *frame, int ops, struct result *r)
+{
+	static struct daq_op op[DAQ_QUEUE];
+	struct daq_op *q[DAQ_QUEUE], *done[DAQ_QUEUE];
+	const struct daq_stats *st;
+	struct daq *dq;
+	long long t0;
+	double sec;
+	int sent = 0, completed = 0, k, n;
+
+	if((dq = daq_open(tty, cfg)) == NULL)
+		return -1;
+	t0 = daq_now_ms();
+	r->failed = 0;
+	while(completed < ops)
+	{
+		for(k = 0; (sent < ops) && (sent - completed < DAQ_QUEUE); k++, sent++)
+		{
+			q[k] = &op[sent % DAQ_QUEUE];
+			q[k]->frame = frame;
+			q[k]->due = 0;
+		}
+		daq_submit_batch(dq, q, k);
+		if((n = daq_poll_completions(dq, done, DAQ_QUEUE)) == -1)
+		{
+			daq_close(dq);
+			return -1;
+		}
+		for(k = 0; k < n; k++)
+			r->failed += done[k]->status != DAQ_DONE;
+		completed += n;
+	}
+	sec = (daq_now_ms() - t0 + 1) / 1e3;
+
+	st = daq_stats(dq);
+	r->ops = ops;
+	r->fps = (ops - r->failed) / sec;
+	r->bps = st->payload / sec;
+	r->efficiency = st->wire ? (double)st->payload / st->wire : 0;
+	r->line = 100.0 * r->bps * 10 / cfg->baud;		//8N1;
+	r->p50 = hist_quantile(&st->latency[LAT_OP], 0.5) / 1e3;
+	r->p99 = hist_quantile(&st->latency[LAT_OP], 0.99) / 1e3;
+	r->p999 = hist_quantile(&st->latency[LAT_OP], 0.999) / 1e3;
+	r->max = st->latency[LAT_OP].max / 1e3;
+	r->retries = st->retries;
+	r->timeouts = 0;
+	for(k = 0; k < PHASES; k++)
+		r->timeouts += st->timeouts[k];
+	daq_close(dq);
+	return 0;
+}
+
+static void keep_best(struct result *best, const struct result *r, int first)
+{
+	if(first)
+	{
+		*best = *r;
+		return;
+	}
+	if(r->fps > best->fps)
+	{
+		best->fps = r->fps;
+		best->bps = r->bps;
+		best->line = r->line;
+		best->efficiency = r->efficiency;
+		best->failed = r->failed;
+		best->retries = r->retries;
+		best->timeouts = r->timeouts;
+	}
+	best->p50 = r->p50 < best->p50 ? r->p50 : best->p50;
+	best->p99 = r->p99 < best->p99 ? r->p99 : best->p99;
+	best->p999 = r->p999 < best->p999 ? r->p999 : best->p999;
+	best->max = r->max < best->max ? r->max : best->max;
+}
+
+static void print_result(FILE *f, const struct result *r)
+{
+	fprintf(f, "%s\t%ld\t%d\t%d\t%g\t%d\t%d\t%.1f\t%.0f\t%.3f\t%.1f\t%.0f\t%.0f\t%.0f\t%.0f\t%lu\t%lu\n", r->op,
+		r->baud, r->payload, r->window, r->error, r->ops, r->failed, r->fps, r->bps, r->efficiency, r->line, r->p50,
+		r->p99, r->p999, r->max, r->retries, r->timeouts);
+}
+
+/*
+* Reads a baseline written by an earlier run. Returns the number of results,
+* -1 on error.
+*/
+static int load_baseline(const char *path, struct result **res)
+{
+	struct result r, *more;
+	char line[512];
+	FILE *f;
+	int n = 0, max = 0;
+
+	if((f = fopen(path, "r")) == NULL)
+		return -1;
+	*res = NULL;
+	while(fgets(line, sizeof(line), f) != NULL)
+	{
+		if((line[0] == '#') || (sscanf(line, "%7s %ld %d %d %lf %d %d %lf %lf %lf %lf %lf %lf %lf %lf %lu %lu", r.op,
+			&r.baud, &r.payload, &r.window, &r.error, &r.ops, &r.failed, &r.fps, &r.bps, &r.efficiency, &r.line,
+			&r.p50, &r.p99, &r.p999, &r.max, &r.retries, &r.timeouts) != 17))
+			continue;
+		if(n == max)
+		{
+			max = max ? 2 * max : 64;
+			if((more = realloc(*res, max * sizeof(*more))) == NULL)
+			{
+				fclose(f);
+				return -1;
+			}
+			*res = more;
+		}
+		(*res)[n++] = r;
+	}
+	fclose(f);
+	return n;
+}
+
+/*
+* Compares r with the same configuration in the baseline. Returns 1 if it
+* regressed by more than tol (tail for the p99, fractions), and prints why.
+*/
+static int regressed(const struct result *r, const struct result *base, int nbase, double tol, double tail)
+{
+	int i, bad = 0;
+
+	for(i = 0; i < nbase; i++)
+		if(!strcmp(base[i].op, r->op) && (base[i].baud == r->baud) && (base[i].payload == r->payload) &&
+			(base[i].window == r->window) && (base[i].error == r->error))
+			break;
+	if(i == nbase)
+		return 0;
+	if(r->fps < base[i].fps * (1 - tol))
+	{
+		printf("REGRESSION %s %ld baud %d B -w %d -e %g: %.1f frames/s, baseline %.1f\n", r->op, r->baud, r->payload,
+			r->window, r->error, r->fps, base[i].fps);
+		bad = 1;
+	}
+	if(r->p50 > base[i].p50 * (1 + tol))
+	{
+		printf("REGRESSION %s %ld baud %d B -w %d -e %g: p50 %.0f us, baseline %.0f us\n", r->op, r->baud, r->payload,
+			r->window, r->error, r->p50, base[i].p50);
+		bad = 1;
+	}
+	if(r->p99 > base[i].p99 * (1 + tail))
+	{
+		printf("REGRESSION %s %ld baud %d B -w %d -e %g: p99 %.0f us, baseline %.0f us\n", r->op, r->baud, r->payload,
+			r->window, r->error, r->p99, base[i].p99);
+		bad = 1;
+	}
+	return bad;
+}
+
+int main(int argc, char *argv[])
+{
+	static unsigned char frame[8 + FRAME_MAX + 1];
+	double payload[LIST_MAX] = {16, 64, 255, 1024}, window[LIST_MAX] = {0, 2, 8}, error[LIST_MAX] = {0, 1e-4, 1e-3};
+	int npayload = 4, nwindow = 3, nerror = 3, nbase = 0, regressions = 0;
+	struct daq_config cfg = DAQ_CONFIG_DEFAULT;
+	struct result r, best, *base = NULL;
+	const char *out = "bench_suite.tsv", *compare = NULL, *bin;
+	double tol = 0.15, tail = 0.5;
+	long bytes = 8192;
+	FILE *f;
+	int opt, s, wr, p, w, e, k, runs = 3;
+
+	cfg.timeout_ms = 50;					//Simulator on the same host;
+	while((opt = getopt(argc, argv, "o:c:T:P:B:r:t:Cp:w:e:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'o':
+				out = optarg;
+				break;
+			case 'c':
+				compare = optarg;
+				break;
+			case 'T':
+				tol = atof(optarg) / 100;
+				break;
+			case 'P':
+				tail = atof(optarg) / 100;
+				break;
+			case 'B':				//Payload bytes per configuration;
+				bytes = atol(optarg);
+				break;
+			case 'r':				//Runs per configuration, the best is kept;
+				runs = atoi(optarg);
+				break;
+			case 't':
+				cfg.timeout_ms = atol(optarg);
+				break;
+			case 'C':
+				cfg.crc = 1;
+				break;
+			case 'p':
+				npayload = parse_list(optarg, payload);
+				break;
+			case 'w':
+				nwindow = parse_list(optarg, window);
+				break;
+			case 'e':
+				nerror = parse_list(optarg, error);
+				break;
+			default:
+				optind = argc;
+				break;
+		}
+	}
+	for(p = 0; p < npayload; p++)
+		if((payload[p] < 1) || (payload[p] > FRAME_MAX))
+			npayload = -1;
+	for(w = 0; w < nwindow; w++)
+		if((window[w] < 0) || (window[w] > WINDOW_MAX))
+			nwindow = -1;
+	if((argc - optind < 1) || (npayload < 1) || (nwindow < 1) || (nerror < 1) || (bytes < 1) || (runs < 1) || (tol <= 0) || (tail <= 0) ||
+		(cfg.timeout_ms < 1))
+	{
+		printf("ERROR Usage: %s [-o baseline] [-c old baseline] [-T tolerance %%] [-P p99 tolerance %%] [-B bytes] [-r runs]\n"
+			"       [-t timeout_ms] [-C] [-p payloads] [-w windows] [-e error rates] <baud>:<mcb2300_sim> [<baud>:<mcb2300_sim>...]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	if((compare != NULL) && ((nbase = load_baseline(compare, &base)) == -1))
+	{
+		perror("ERROR baseline");
+		exit(EXIT_FAILURE);
+	}
+	if((f = fopen(out, "w")) == NULL)
+	{
+		perror("ERROR baseline");
+		exit(EXIT_FAILURE);
+	}
+	fprintf(f, "# bench_suite %d: payload %ld B per configuration, best of %d, timeout %ld ms, crc %d, seed %s\n",
+		BASELINE_VERSION, bytes, runs, cfg.timeout_ms, cfg.crc, SEED);
+	fprintf(f, "#op\tbaud\tpayload\twindow\terror\tops\tfailed\tframes_s\tpayload_Bps\twire_eff\tline_pct\t"
+		"p50_us\tp99_us\tp999_us\tmax_us\tretries\ttimeouts\n");
+
+	printf("%-6s%8s%8s%4s%8s%10s%12s%8s%7s%9s%9s%9s%7s\n", "op", "baud", "payload", "w", "error", "frames/s",
+		"payload B/s", "eff", "line%", "p50 us", "p99 us", "max us", "failed");
+	for(s = optind; s < argc; s++)
+	{
+		if(((cfg.baud = strtol(argv[s], (char **)&bin, 10)) <= 0) || (*bin++ != ':'))
+		{
+			printf("ERROR %s: expected <baud>:<mcb2300_sim>\n", argv[s]);
+			exit(EXIT_FAILURE);
+		}
+		for(wr = 0; wr < 2; wr++)
+			for(p = 0; p < npayload; p++)
+				for(w = 0; w < nwindow; w++)
+					for(e = 0; e < nerror; e++)
+					{
+						memset(&r, 0, sizeof(r));
+						strcpy(r.op, wr ? "write" : "read");
+						r.baud = cfg.baud;
+						r.payload = payload[p];
+						r.window = cfg.window = window[w];
+						r.error = error[e];
+						make_frame(frame, wr, r.payload);
+						r.ops = bytes / r.payload;
+						r.ops = r.ops < OPS_MIN ? OPS_MIN : (r.ops > OPS_MAX ? OPS_MAX : r.ops);
+						for(k = 0; k < runs; k++)
+						{
+							if(start_sim(bin, r.error) == -1)
+							{
+								printf("ERROR %s did not start\n", bin);
+								stop_sim();
+								exit(EXIT_FAILURE);
+							}
+							if(run(&cfg, frame, r.ops, &r) == -1)
+							{
+								perror("ERROR run");
+								stop_sim();
+								exit(EXIT_FAILURE);
+							}
+							stop_sim();
+							keep_best(&best, &r, k == 0);
+						}
+						r = best;
+						printf("%-6s%8ld%8d%4d%8g%10.1f%12.0f%8.3f%7.1f%9.0f%9.0f%9.0f%7d\n", r.op, r.baud,
+							r.payload, r.window, r.error, r.fps, r.bps, r.efficiency, r.line, r.p50, r.p99,
+							r.max, r.failed);
+						print_result(f, &r);
+						fflush(f);
+						regressions += regressed(&r, base, nbase, tol, tail);
+					}
+	}
+	fclose(f);
+	free(base);
+	if(compare != NULL)
+		printf("\n%d regressions against %s (tolerance %.0f %%, p99 %.0f %%)\n", regressions, compare, tol * 100,
+			tail * 100);
+	return regressions ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+/*
+* Host cost of sending frames: runs ops ops of one frame, stop-and-wait, windowed
+* and windowed with COBS framing, once with the frame encoded for every op and
+* once kept encoded by daq_cache_frame(), and reports per frame the system calls
+* of the engine (read, writev, poll, and ioctl for VMIN changes), the headers
+* encoded in full and the host CPU time (user + system, from getrusage). The
+* frames are an 8 byte poll of the ADC, a 16 byte LCD write and a 1 KiB LCD
+* write. Run it against the simulator without -p to keep the line out of it.
+*
+* $ gcc -O2 bench_tx.c libdaq.c hist.c crc16.c clock.c -lm -o bench_tx
+* $ ./bench_tx [-b baud] [-C] [-n ops] <tty>
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<unistd.h>
+#include<string.h>
+#include<sys/resource.h>
+
+#include "libdaq.h"
+
+#define FRAMES 3
+
+static const struct
+{
+	const char *name;
+	unsigned char id, mode;
+	int len;
+} frames[FRAMES] = {{"poll 8", 0x00, MODE_READ, 8}, {"lcd 16", 0x01, MODE_WRITE, 16}, {"lcd 1K", 0x01, MODE_WRITE, 1024}};
+
+static double cpu_s(void)						//User + system time of this process;
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static void make_frame(unsigned char *f, int k)
+{
+	int i, len = frames[k].len;
+
+	memset(f, 0, 8);
+	f[0] = 0xFE;
+	f[1] = frames[k].id;
+	f[2] = len & 0xFF;
+	f[3] = frames[k].mode | (len > 255 ? MODE_EXT : 0);
+	f[5] = len >> 8;
+	for(i = 0; i < len; i++)
+		f[8 + i] = frames[k].mode == MODE_WRITE ? 'A' + i % 26 : 0;
+	f[8 + len] = STOP;
+}
+
+/*
+* Runs ops ops on frame through a fresh handle. Returns the failed ones, -1 on
+* error; *st receives the handle's counters and *cpu the seconds per op.
+*/
+static int run(const char *tty, const struct daq_config *cfg, unsigned char *frame, int cached, int ops,
+	struct daq_stats *st, double *cpu)
+{
+	static struct daq_op op[DAQ_QUEUE];
+	struct daq_op *q[DAQ_QUEUE], *done[DAQ_QUEUE];
+	struct daq *dq;
+	double c0;
+	int sent = 0, completed = 0, failed = 0, k, n;
+
+	if((dq = daq_open(tty, cfg)) == NULL)
+		return -1;
+	if(cached && (daq_cache_frame(dq, frame) == -1))
+	{
+		daq_close(dq);
+		return -1;
+	}
+	c0 = cpu_s();
+	while(completed < ops)
+	{
+		for(k = 0; (sent < ops) && (sent - completed < DAQ_QUEUE); k++, sent++)
+		{
+			q[k] = &op[sent % DAQ_QUEUE];
+			q[k]->frame = frame;
+			q[k]->due = 0;
+		}
+		daq_submit_batch(dq, q, k);
+		if((n = daq_poll_completions(dq, done, DAQ_QUEUE)) == -1)
+		{
+			daq_close(dq);
+			return -1;
+		}
+		for(k = 0; k < n; k++)
+			failed += done[k]->status != DAQ_DONE;
+		completed += n;
+	}
+	*cpu = (cpu_s() - c0) / ops;
+	*st = *daq_stats(dq);
+	daq_close(dq);
+	return failed;
+}
+
+int main(int argc, char *argv[])
+{
+	static unsigned char frame[8 + FRAME_MAX + 1];
+	static const char *const mode[3] = {"stop-and-wait", "windowed", "cobs"};
+	struct daq_config cfg = DAQ_CONFIG_DEFAULT;
+	struct daq_stats st;
+	double cpu;
+	int ops = 2000, opt, m, k, c, failed;
+
+	while((opt = getopt(argc, argv, "b:Cn:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'b':
+				cfg.baud = atol(optarg);
+				break;
+			case 'C':
+				cfg.crc = 1;
+				break;
+			case 'n':
+				ops = atoi(optarg);
+				break;
+			default:
+				optind = argc;
+				break;
+		}
+	}
+	if((argc - optind != 1) || (ops < 1))
+	{
+		printf("ERROR Usage: %s [-b baud] [-C] [-n ops] <tty>\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%d ops per run%s; per frame:\n\n", ops, cfg.crc ? ", CRC" : "");
+	printf("%-15s%-8s%-8s%8s%8s%8s%8s%9s%10s%8s\n", "mode", "frame", "cache", "read", "write", "poll", "ioctl",
+		"encoded", "cpu us", "failed");
+	for(m = 0; m < 3; m++)
+	{
+		cfg.window = m ? WINDOW_MAX : 0;
+		cfg.cobs = m == 2;
+		for(k = 0; k < FRAMES; k++)
+		{
+			make_frame(frame, k);
+			for(c = 0; c < 2; c++)
+			{
+				if((failed = run(argv[optind], &cfg, frame, c, ops, &st, &cpu)) == -1)
+				{
+					perror("ERROR run");
+					exit(EXIT_FAILURE);
+				}
+				printf("%-15s%-8s%-8s%8.2f%8.2f%8.2f%8.2f%9.2f%10.2f%8d\n", mode[m], frames[k].name, c ? "yes" : "no",
+					(double)st.reads / ops, (double)st.writes / ops, (double)st.polls / ops,
+					(double)st.ioctls / ops, (double)st.encoded / ops, cpu * 1e6, failed);
+			}
+		}
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,122 @@
+/*
+* Throughput of the 10 bit sample unpack kernels in pack10.c. Every kernel is
+* checked against the scalar one first (all group counts 0..64 and a large
+* buffer), then timed on one frame's worth (1020 bytes) and on 4 MB.
+*
+* $ gcc -O2 bench_unpack.c pack10.c -o bench_unpack
+* $ ./bench_unpack [megasamples]
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+
+#include "pack10.h"
+
+typedef void (*unpack_fn)(const uint8_t *, uint16_t *, size_t);
+
+static const struct
+{
+	const char *name;
+	unpack_fn fn;
+} kernel[] =
+{
+	{"scalar", unpack10_scalar},
+	{"ssse3", unpack10_ssse3},
+	{"avx2", unpack10_avx2}
+};
+
+#define KERNELS (sizeof(kernel) / sizeof(kernel[0]))
+#define BIG_GROUPS (1 << 20)					//4 Msamples, 5 MB packed;
+
+static double now_s(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void pack(const uint16_t *s, uint8_t *p, size_t groups)	//Same layout as the firmware;
+{
+	while(groups--)
+	{
+		p[0] = s[0];
+		p[1] = (s[0] >> 8) | (s[1] << 2);
+		p[2] = (s[1] >> 6) | (s[2] << 4);
+		p[3] = (s[2] >> 4) | (s[3] << 6);
+		p[4] = s[3] >> 2;
+		s += 4;
+		p += 5;
+	}
+}
+
+/*
+* Msamples/s of fn over total samples, unpacking groups at a time.
+*/
+static double run(unpack_fn fn, const uint8_t *in, uint16_t *out, size_t groups, size_t total)
+{
+	size_t done;
+	double t0 = now_s();
+
+	for(done = 0; done < total; done += groups * 4)
+		fn(in, out, groups);
+	return total / (now_s() - t0) / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+	static const size_t sizes[] = {204, BIG_GROUPS};	//1020 byte frame, 5 MB;
+	size_t total = (argc > 1 ? atol(argv[1]) : 512) * 1000000UL;
+	uint16_t *samples, *ref, *out;
+	uint8_t *packed;
+	unsigned k, i, g;
+
+	samples = malloc(BIG_GROUPS * 8);
+	ref = malloc(BIG_GROUPS * 8);
+	out = malloc(BIG_GROUPS * 8);
+	packed = malloc(BIG_GROUPS * 5);
+	if(!samples || !ref || !out || !packed)
+	{
+		perror("ERROR malloc()");
+		exit(EXIT_FAILURE);
+	}
+	srand(1);
+	for(i = 0; i < BIG_GROUPS * 4; i++)
+		samples[i] = rand() & 0x3FF;
+	pack(samples, packed, BIG_GROUPS);
+	unpack10_scalar(packed, ref, BIG_GROUPS);
+	if(memcmp(ref, samples, BIG_GROUPS * 8))
+	{
+		printf("ERROR scalar: wrong result\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for(k = 0; k < KERNELS; k++)
+	{
+		for(g = 0; g <= 64; g++)
+		{
+			memset(out, 0xFF, (g + 1) * 8);
+			kernel[k].fn(packed, out, g);
+			if(memcmp(out, ref, g * 8) || (out[g * 4] != 0xFFFF))
+				break;
+		}
+		kernel[k].fn(packed, out, BIG_GROUPS);
+		if((g <= 64) || memcmp(out, ref, BIG_GROUPS * 8))
+		{
+			printf("ERROR %s: wrong result\n", kernel[k].name);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	printf("unpack10() uses %s\n%-10s%16s%16s\n", unpack10_kernel(), "Msample/s", "1020 B frame", "5 MB");
+	for(k = 0; k < KERNELS; k++)
+	{
+		printf("%-10s", kernel[k].name);
+		for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+			printf("%16.0f", run(kernel[k].fn, packed, out, sizes[i], total));
+		printf("\n");
+	}
+	return 0;
+}
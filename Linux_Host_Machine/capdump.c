@@ -0,0 +1,96 @@
+/*
+* Prints the records of a capture store whose first sample lies between two
+* CLOCK_MONOTONIC times in seconds (the whole store without them): time, bound,
+* board, channel and the samples, then how many index blocks were read and
+* skipped. -s prints one line per record without the samples.
+*
+* -r checks a store captured from the simulator's ramp source (mcb2300_sim -a
+* ramp, single channel reads or a stream): per board and channel every sample is
+* the one before or one above it, wrapping at the sample width, also across
+* records, so a record stored twice or out of order shows up as a break. The
+* exit status is non-zero if there is any.
+*
+* $ gcc -O2 capdump.c capture.c -lpthread -o capdump
+* $ ./capdump [-s] [-r] <capture dir> [from_s to_s]
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<string.h>
+#include<errno.h>
+#include<unistd.h>
+
+#include "capture.h"
+
+int main(int argc, char *argv[])
+{
+	struct cap_query q;
+	const struct cap_record *r;
+	const uint16_t *s16;
+	int64_t t0 = INT64_MIN, t1 = INT64_MAX;
+	static long last[256][8];				//-r: last sample per board and channel, -1 = none;
+	unsigned long n = 0, breaks = 0;
+	uint32_t i;
+	long v, top;
+	int opt, summary = 0, ramp = 0;
+
+	while((opt = getopt(argc, argv, "sr")) != -1)
+	{
+		if(opt == 's')
+			summary = 1;
+		else if(opt == 'r')
+			ramp = 1;
+		else
+			optind = argc;
+	}
+	if((argc - optind != 1) && (argc - optind != 3))
+	{
+		printf("ERROR Usage: %s [-s] [-r] <capture dir> [from_s to_s]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	if(argc - optind == 3)
+	{
+		t0 = strtod(argv[optind + 1], NULL) * 1e9;
+		t1 = strtod(argv[optind + 2], NULL) * 1e9;
+	}
+
+	memset(last, 0xFF, sizeof(last));
+	cap_query_open(&q, argv[optind], t0, t1);
+	while((r = cap_query_next(&q)) != NULL)
+	{
+		n++;
+		s16 = (const uint16_t *)r->samples;
+		top = r->width == 2 ? 0x3FF : 0xFF;
+		for(i = 0; ramp && (i < r->n); i++)
+		{
+			v = r->width == 2 ? s16[i] : r->samples[i];
+			if((last[r->board][r->channel & 7] >= 0) && (v != last[r->board][r->channel & 7]) &&
+				(v != ((last[r->board][r->channel & 7] + 1) & top)))
+			{
+				printf("ramp break: record %lu sample %u is %lx after %lx\n", n, i, v, last[r->board][r->channel & 7]);
+				breaks++;
+			}
+			last[r->board][r->channel & 7] = v;
+		}
+		printf("%.6f s +-%u us board %u AD0.%u %u samples%s%s", r->time_ns / 1e9, r->bound_ns / 1000, r->board,
+			r->channel, r->n, r->flags & CAP_STAMPED ? "" : " (arrival)", r->flags & CAP_LOST ? " (lost before)" : "");
+		if(!summary)
+		{
+			printf(":");
+			for(i = 0; i < r->n; i++)
+				printf(" %x", r->width == 2 ? s16[i] : r->samples[i]);
+		}
+		printf("\n");
+	}
+	if(errno)
+	{
+		perror("ERROR capture store");
+		exit(EXIT_FAILURE);
+	}
+	cap_query_close(&q);
+	printf("%lu records, %lu index blocks read, %lu skipped\n", n, q.blocks_read, q.blocks_skipped);
+	if(ramp)
+		printf("ramp: %lu breaks\n", breaks);
+	return breaks ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,379 @@
+/*
+* Capture store. Segment files are created at their full size (sparse, only
+* written pages take space) and mapped shared; records are appended by copying
+* them into the map and then moving hdr->used past them. A record never spans
+* two segments: one that does not fit starts the next segment. On close the
+* file is truncated to its last record.
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<unistd.h>
+#include<string.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<sys/stat.h>
+#include<sys/mman.h>
+
+#include "capture.h"
+
+#define ALIGN(x, a) (((x) + (a) - 1) / (a) * (a))
+
+static long page;
+
+static int seg_path(char *buf, size_t n, const char *dir, uint32_t seg)
+{
+	return snprintf(buf, n, "%s/%08u.cap", dir, seg) >= (int)n ? -1 : 0;
+}
+
+/*
+* Hands the records written since the last call to the kernel (MS_ASYNC), with
+* the header and index pages. MS_SYNC waits until they are on disk.
+*/
+static int seg_sync(struct cap *c, int flags)
+{
+	uint64_t from = c->synced / page * page;
+
+	if(c->map == NULL)
+		return 0;
+	if((msync(c->map, c->hdr->data, flags) == -1) ||
+		((c->hdr->used > from) && (msync(c->map + from, c->hdr->used - from, flags) == -1)))
+		return -1;
+	c->synced = c->hdr->used;
+	c->syncs++;
+	return 0;
+}
+
+static int seg_close(struct cap *c)
+{
+	int r = 0;
+
+	if(c->map == NULL)
+		return 0;
+	if(seg_sync(c, MS_SYNC) == -1)
+		r = -1;
+	if((ftruncate(c->fd, c->hdr->used) == -1) && (r == 0))	//Give back the sparse tail;
+		r = -1;
+	munmap(c->map, c->seg_bytes);
+	close(c->fd);
+	c->map = NULL;
+	return r;
+}
+
+/*
+* Maps segment seg for appending, creating it if it does not exist. An existing
+* segment is continued after its last complete record.
+*/
+static int seg_open(struct cap *c, uint32_t seg)
+{
+	char path[4096];
+	struct cap_segment *h;
+	struct stat sb;
+	uint32_t entries = c->seg_bytes / CAP_BLOCK + 1;
+	int e;
+
+	if(seg_path(path, sizeof(path), c->dir, seg) == -1)
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if((c->fd = open(path, O_RDWR | O_CREAT, 0644)) == -1)
+		return -1;
+	if((fstat(c->fd, &sb) == -1) || (ftruncate(c->fd, c->seg_bytes) == -1))
+		goto fail;
+	if((c->map = mmap(NULL, c->seg_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, c->fd, 0)) == MAP_FAILED)
+		goto fail;
+	h = c->hdr = (struct cap_segment *)c->map;
+	if(sb.st_size == 0)					//New segment;
+	{
+		h->magic = CAP_MAGIC;
+		h->version = CAP_VERSION;
+		h->seg = seg;
+		h->index_max = entries;
+		h->size = c->seg_bytes;
+		h->data = ALIGN(sizeof(*h) + entries * sizeof(struct cap_index), page);
+		h->used = h->data;
+		h->t_min = INT64_MAX;
+		h->t_max = INT64_MIN;
+		c->segments++;
+	}
+	else if((h->magic != CAP_MAGIC) || (h->version != CAP_VERSION) || (h->seg != seg) ||
+		(h->size != (uint64_t)c->seg_bytes) || (h->used > h->size) || (h->nindex > h->index_max))
+	{
+		munmap(c->map, c->seg_bytes);
+		errno = EINVAL;					//Not a segment, or written with another size;
+		goto fail;
+	}
+	c->index = (struct cap_index *)(c->map + sizeof(*h));
+	c->synced = h->used;
+	return 0;
+
+fail:
+	e = errno;
+	close(c->fd);
+	c->map = NULL;
+	errno = e;
+	return -1;
+}
+
+/*
+* Opens the store in dir (created if needed) for appending, after the last
+* record of its last segment. seg_bytes and sync_bytes of 0 take CAP_SEGMENT
+* and CAP_SYNC.
+*/
+struct cap *cap_open(const char *dir, long seg_bytes, long sync_bytes)
+{
+	struct cap *c;
+	char path[4096];
+	uint32_t last = 0;
+	int e;
+
+	page = sysconf(_SC_PAGESIZE);
+	if((seg_bytes && (seg_bytes < 4 * CAP_BLOCK)) || (sync_bytes < 0))
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	if((mkdir(dir, 0755) == -1) && (errno != EEXIST))
+		return NULL;
+	if((c = calloc(1, sizeof(*c))) == NULL)
+		return NULL;
+	c->dir = strdup(dir);
+	c->seg_bytes = seg_bytes ? ALIGN(seg_bytes, page) : CAP_SEGMENT;
+	c->sync_bytes = sync_bytes ? sync_bytes : CAP_SYNC;
+	pthread_mutex_init(&c->lock, NULL);
+
+	while((seg_path(path, sizeof(path), dir, last + 1) == 0) && (access(path, F_OK) == 0))
+		last++;						//Continue the last segment;
+	if((c->dir == NULL) || (seg_open(c, last) == -1))
+	{
+		e = errno;
+		free(c->dir);
+		free(c);
+		errno = e;
+		return NULL;
+	}
+	return c;
+}
+
+/*
+* Appends a record of n samples of width bytes from board/channel, the first
+* sampled at time_ns +- bound_ns. Returns 0, -1 on error (errno set; EINVAL if
+* the record cannot fit in a segment).
+*/
+int cap_append(struct cap *c, unsigned char board, unsigned char channel, int width, const void *samples,
+	int n, double time_ns, double bound_ns, int flags)
+{
+	struct cap_segment *h;
+	struct cap_record *r;
+	struct cap_index *ix;
+	uint64_t len = ALIGN(sizeof(*r) + (uint64_t)n * width, 8);
+	int64_t t = time_ns;
+	uint32_t seg;
+	int ret = 0;
+
+	pthread_mutex_lock(&c->lock);
+	if((c->map == NULL) || (len > c->seg_bytes - c->hdr->data) || (n < 0) || ((width != 1) && (width != 2)))
+	{
+		errno = c->map == NULL ? EIO : EINVAL;
+		ret = -1;
+		goto out;
+	}
+	if(c->hdr->used + len > c->hdr->size)			//Next segment;
+	{
+		seg = c->hdr->seg + 1;
+		if((seg_close(c) == -1) || (seg_open(c, seg) == -1))
+		{
+			ret = -1;
+			goto out;
+		}
+	}
+	h = c->hdr;
+	ix = h->nindex ? &c->index[h->nindex - 1] : NULL;
+	if((ix == NULL) || (h->used >= ix->offset + CAP_BLOCK))	//New index entry;
+	{
+		ix = &c->index[h->nindex];
+		ix->offset = h->used;
+		ix->t_min = INT64_MAX;
+		ix->t_max = INT64_MIN;
+		h->nindex++;
+	}
+
+	r = (struct cap_record *)(c->map + h->used);
+	r->len = len;
+	r->board = board;
+	r->channel = channel;
+	r->width = width;
+	r->flags = flags;
+	r->n = n;
+	r->bound_ns = bound_ns > UINT32_MAX ? UINT32_MAX : bound_ns;
+	r->time_ns = t;
+	memcpy(r->samples, samples, (size_t)n * width);
+
+	if(t < ix->t_min)
+		ix->t_min = t;
+	if(t > ix->t_max)
+		ix->t_max = t;
+	if(t < h->t_min)
+		h->t_min = t;
+	if(t > h->t_max)
+		h->t_max = t;
+	h->records++;
+	h->used += len;						//Record complete;
+	c->records++;
+	c->bytes += len;
+	if(h->used - c->synced >= (uint64_t)c->sync_bytes)
+		ret = seg_sync(c, MS_ASYNC);
+
+out:
+	pthread_mutex_unlock(&c->lock);
+	return ret;
+}
+
+int cap_sync(struct cap *c)
+{
+	int r;
+
+	pthread_mutex_lock(&c->lock);
+	r = seg_sync(c, MS_SYNC);
+	pthread_mutex_unlock(&c->lock);
+	return r;
+}
+
+int cap_close(struct cap *c)
+{
+	int r;
+
+	if(c == NULL)
+		return 0;
+	r = seg_close(c);
+	pthread_mutex_destroy(&c->lock);
+	free(c->dir);
+	free(c);
+	return r;
+}
+
+/*
+* Query: the records whose first sample lies in [t0, t1], segment by segment in
+* the order they were appended (not sorted by time).
+*/
+static void query_unmap(struct cap_query *q)
+{
+	if(q->map == NULL)
+		return;
+	munmap(q->map, q->size);
+	close(q->fd);
+	q->map = NULL;
+}
+
+static int query_map(struct cap_query *q)			//Maps q->seg, 0 if it does not exist;
+{
+	char path[4096];
+	struct stat sb;
+
+	if(seg_path(path, sizeof(path), q->dir, q->seg) == -1)
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if((q->fd = open(path, O_RDONLY)) == -1)
+		return errno == ENOENT ? 0 : -1;
+	if((fstat(q->fd, &sb) == -1) || (sb.st_size < (off_t)sizeof(struct cap_segment)) ||
+		((q->map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, q->fd, 0)) == MAP_FAILED))
+	{
+		close(q->fd);
+		q->map = NULL;
+		errno = EINVAL;
+		return -1;
+	}
+	q->size = sb.st_size;
+	q->hdr = (const struct cap_segment *)q->map;
+	if((q->hdr->magic != CAP_MAGIC) || (q->hdr->version != CAP_VERSION) || (q->hdr->nindex > q->hdr->index_max) ||
+		(q->hdr->data > q->size))
+	{
+		query_unmap(q);
+		errno = EINVAL;
+		return -1;
+	}
+	q->entry = 0;
+	q->off = q->end = 0;
+	return 1;
+}
+
+int cap_query_open(struct cap_query *q, const char *dir, int64_t t0, int64_t t1)
+{
+	memset(q, 0, sizeof(*q));
+	q->dir = dir;
+	q->t0 = t0;
+	q->t1 = t1;
+	q->seg = 0;
+	return 0;
+}
+
+/*
+* Next record in range, NULL at the end (errno 0) or on error. The record is in
+* the map and valid until the next call.
+*/
+const struct cap_record *cap_query_next(struct cap_query *q)
+{
+	const struct cap_index *ix;
+	const struct cap_record *r;
+	uint64_t used;
+	int m;
+
+	while(1)
+	{
+		while(q->off < q->end)					//Records of the current block;
+		{
+			r = (const struct cap_record *)(q->map + q->off);
+			if((r->len < sizeof(*r)) || (q->off + r->len > q->end))
+			{
+				errno = EINVAL;
+				return NULL;
+			}
+			q->off += r->len;
+			if((r->time_ns >= q->t0) && (r->time_ns <= q->t1))
+				return r;
+		}
+		if(q->map != NULL)					//Next block of the segment;
+		{
+			used = q->hdr->used < q->size ? q->hdr->used : q->size;
+			ix = (const struct cap_index *)(q->map + sizeof(*q->hdr));
+			for(; q->entry < q->hdr->nindex; q->entry++)
+			{
+				if((ix[q->entry].t_max < q->t0) || (ix[q->entry].t_min > q->t1))
+				{
+					q->blocks_skipped++;
+					continue;
+				}
+				q->off = ix[q->entry].offset;
+				q->end = q->entry + 1 < q->hdr->nindex ? ix[q->entry + 1].offset : used;
+				if(q->end > used)
+					q->end = used;
+				q->entry++;
+				q->blocks_read++;
+				break;
+			}
+			if(q->off < q->end)
+				continue;
+			query_unmap(q);
+			q->seg++;
+		}
+		if((m = query_map(q)) <= 0)				//Next segment;
+		{
+			if(m == 0)
+				errno = 0;
+			return NULL;
+		}
+		if((q->hdr->t_max < q->t0) || (q->hdr->t_min > q->t1))
+		{
+			q->blocks_skipped += q->hdr->nindex;
+			q->entry = q->hdr->nindex;
+		}
+	}
+}
+
+void cap_query_close(struct cap_query *q)
+{
+	query_unmap(q);
+}
@@ -0,0 +1,96 @@
+/*
+* Capture store: an append-only log of acquired samples in a directory of
+* fixed size segment files (00000000.cap, 00000001.cap, ...). A segment is
+* mapped once and records are copied into the map, so appending costs no
+* system call; dirty pages are handed to the kernel with msync(MS_ASYNC) every
+* sync_bytes. Each segment starts with a header and a sparse time index, one
+* entry per CAP_BLOCK bytes of records with the time span of those records, so a
+* query reads the index and skips every block (and segment) outside its range.
+*
+* A record is complete once the header's used offset has moved past it; after a
+* crash the store reopens at the last complete record.
+*/
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include<stdint.h>
+#include<stddef.h>
+#include<pthread.h>
+
+#define CAP_MAGIC 0x50414344					//"DCAP";
+#define CAP_VERSION 1
+#define CAP_SEGMENT (64L << 20)					//Default segment size;
+#define CAP_BLOCK (64 << 10)					//Record bytes per index entry;
+#define CAP_SYNC (1L << 20)					//Default bytes between msync() calls;
+
+#define CAP_STAMPED 0x01					//time_ns from the device stamp, else arrival time;
+#define CAP_LOST 0x02						//Samples were lost before this record;
+
+struct cap_segment						//Start of every segment file;
+{
+	uint32_t magic, version;
+	uint32_t seg;						//Segment number;
+	uint32_t nindex, index_max;				//Index entries used and room for;
+	uint32_t reserved;
+	uint64_t size;						//File size while open for appending;
+	uint64_t data;						//Offset of the first record;
+	uint64_t used;						//End of the last complete record;
+	uint64_t records;
+	int64_t t_min, t_max;					//Time span of the records (ns);
+};
+
+struct cap_index						//CAP_BLOCK bytes of records;
+{
+	uint64_t offset;					//First record;
+	int64_t t_min, t_max;
+};
+
+struct cap_record
+{
+	uint32_t len;						//Record bytes with this header, multiple of 8;
+	uint8_t board, channel;					//Port the data came from (position of its tty), AD0.n;
+	uint8_t width;						//Bytes per sample, 1 (8 MSBs) or 2 (10 bits);
+	uint8_t flags;
+	uint32_t n;						//Samples;
+	uint32_t bound_ns;					//Error bound of time_ns;
+	int64_t time_ns;					//CLOCK_MONOTONIC of the first sample;
+	unsigned char samples[];
+};
+
+struct cap
+{
+	char *dir;
+	long seg_bytes, sync_bytes;
+	int fd;
+	unsigned char *map;
+	struct cap_segment *hdr;
+	struct cap_index *index;
+	uint64_t synced;					//Records up to here handed to msync();
+	unsigned long segments, records, bytes, syncs;		//Since cap_open();
+	pthread_mutex_t lock;					//Appends from several threads;
+};
+
+struct cap_query
+{
+	const char *dir;
+	int64_t t0, t1;
+	uint32_t seg, entry;
+	int fd;
+	unsigned char *map;
+	size_t size;
+	const struct cap_segment *hdr;
+	uint64_t off, end;					//Records left in the current block;
+	unsigned long blocks_read, blocks_skipped;
+};
+
+struct cap *cap_open(const char *dir, long seg_bytes, long sync_bytes);	//NULL on error, errno set;
+int cap_append(struct cap *c, unsigned char board, unsigned char channel, int width, const void *samples,
+	int n, double time_ns, double bound_ns, int flags);
+int cap_sync(struct cap *c);						//Records on disk;
+int cap_close(struct cap *c);
+
+int cap_query_open(struct cap_query *q, const char *dir, int64_t t0, int64_t t1);
+const struct cap_record *cap_query_next(struct cap_query *q);		//NULL at the end;
+void cap_query_close(struct cap_query *q);
+
+#endif
@@ -0,0 +1,117 @@
+/*
+* Device clock estimator. Exchanges whose interval is more than twice the
+* narrowest one kept (delayed by the scheduler or the USB adapter) are left out
+* of the fit. Until the exchanges used span CLOCK_MIN_SPAN the drift cannot be
+* told from the interval widths and the nominal rate is kept, with the crystal
+* tolerance as its error; after that the least squares slope is used.
+*/
+
+#include<math.h>
+#include<string.h>
+
+#include "clock.h"
+
+#define CLOCK_MIN_SPAN 1e9					//ns of exchanges before the slope is fitted;
+#define CLOCK_TOLERANCE 100e-6					//Crystal tolerance assumed before that;
+
+void clock_init(struct clock_est *c, double tick_hz)
+{
+	memset(c, 0, sizeof(*c));
+	c->tick_hz = tick_hz;
+	c->b = 1e9 / tick_hz;
+	c->slope_err = c->b * CLOCK_TOLERANCE;
+	c->err = INFINITY;
+}
+
+static int64_t unwrap(const struct clock_est *c, uint32_t count)	//Nearest to the last count seen;
+{
+	if(c->n == 0)
+		return count;
+	return c->last + (int32_t)(count - (uint32_t)c->last);
+}
+
+/*
+* Adds an exchange: the device read count at host time host_ns +- half_ns
+* (CLOCK_MONOTONIC), and fits the line again.
+*/
+void clock_add(struct clock_est *c, uint32_t count, double host_ns, double half_ns)
+{
+	double nominal = 1e9 / c->tick_hz, emin = INFINITY, cut, dx, dy, sx = 0, sy = 0, sxx = 0, sxy = 0, r;
+	int64_t x = unwrap(c, count);
+	int i, k = 0, fit;
+
+	if(c->n == 0)
+		c->x0 = x;
+	c->last = x;
+	c->x[c->head] = x;
+	c->y[c->head] = host_ns;
+	c->e[c->head] = half_ns;
+	c->head = (c->head + 1) % CLOCK_POINTS;
+	if(c->n < CLOCK_POINTS)
+		c->n++;
+
+	for(i = 0; i < c->n; i++)
+		if(c->e[i] < emin)
+			emin = c->e[i];
+	cut = 2 * emin + 1000;					//1 us of slack for very narrow intervals;
+	c->lo = INT64_MAX;
+	c->hi = INT64_MIN;
+	for(i = 0; i < c->n; i++)				//Means of the exchanges used;
+		if(c->e[i] <= cut)
+		{
+			sx += c->x[i] - c->x0;
+			sy += c->y[i];
+			if(c->x[i] < c->lo)
+				c->lo = c->x[i];
+			if(c->x[i] > c->hi)
+				c->hi = c->x[i];
+			k++;
+		}
+	sx /= k;
+	sy /= k;
+
+	if(!(fit = (c->hi - c->lo) * nominal >= CLOCK_MIN_SPAN))
+		c->b = nominal;
+	else
+	{
+		for(i = 0; i < c->n; i++)
+			if(c->e[i] <= cut)
+			{
+				dx = c->x[i] - c->x0 - sx;
+				dy = c->y[i] - sy;
+				sxx += dx * dx;
+				sxy += dx * dy;
+			}
+		c->b = sxy / sxx;
+	}
+	c->a = sy - c->b * sx;
+
+	c->err = 0;						//Worst exchange: its interval plus its distance to the line;
+	for(i = 0; i < c->n; i++)
+		if(c->e[i] <= cut)
+		{
+			r = fabs(c->y[i] - c->a - c->b * (c->x[i] - c->x0)) + c->e[i];
+			if(r > c->err)
+				c->err = r;
+		}
+	c->slope_err = fit ? 2 * c->err / (c->hi - c->lo) : nominal * CLOCK_TOLERANCE;
+}
+
+/*
+* Host time (CLOCK_MONOTONIC ns) of a device count. The bound grows with the
+* distance from the exchanges by the uncertainty of the slope.
+*/
+double clock_host(const struct clock_est *c, uint32_t count, double *bound_ns)
+{
+	int64_t x = unwrap(c, count);
+	double out = x < c->lo ? c->lo - x : (x > c->hi ? x - c->hi : 0);
+
+	if(bound_ns != NULL)
+		*bound_ns = c->err + out * c->slope_err;
+	return c->a + c->b * (x - c->x0);
+}
+
+double clock_drift_ppm(const struct clock_est *c)
+{
+	return (1e9 / c->tick_hz / c->b - 1) * 1e6;
+}
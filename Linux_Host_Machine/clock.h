@@ -0,0 +1,34 @@
+/*
+* Maps device Timer0 counts (TICK_HZ in the firmware library.h, 32 bits) to
+* CLOCK_MONOTONIC. Every clock exchange gives the host time interval in which
+* the device read its counter; a line fitted through the recent exchanges gives
+* the offset and the drift, and the width of the intervals plus the scatter
+* around the line gives the error bound.
+*/
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include<stdint.h>
+
+#define CLOCK_POINTS 64						//Exchanges kept for the fit;
+
+struct clock_est
+{
+	double tick_hz;						//Nominal device count rate;
+	int64_t x[CLOCK_POINTS];				//Unwrapped count of each exchange;
+	double y[CLOCK_POINTS], e[CLOCK_POINTS];		//Host time (ns) and half the interval;
+	int n, head;
+	int64_t last;						//Last count seen, for unwrapping;
+	double a, b;						//host ns = a + b * (count - x0);
+	int64_t x0;
+	int64_t lo, hi;						//Counts spanned by the exchanges used;
+	double err;						//Error bound at the exchanges (ns);
+	double slope_err;					//Bound of the error of b (ns per count);
+};
+
+void clock_init(struct clock_est *c, double tick_hz);
+void clock_add(struct clock_est *c, uint32_t count, double host_ns, double half_ns);
+double clock_host(const struct clock_est *c, uint32_t count, double *bound_ns);	//Host ns of a count;
+double clock_drift_ppm(const struct clock_est *c);			//Device clock fast by;
+
+#endif
@@ -0,0 +1,72 @@
+/*
+* CRC-16/CCITT kernels for the host. crc16() processes 8 bytes per step with
+* eight 256-entry tables (slice-by-8): T[k][x] is the CRC of byte x followed by
+* k zero bytes, so the CRC of an 8 byte block is the XOR of one lookup per byte
+* once the running CRC has been folded into the first two bytes.
+* crc16_bytewise() is the one-table loop the firmware uses and crc16_bitwise()
+* the reference; both are kept for the benchmark in bench_crc.c.
+*/
+
+#include<stdint.h>
+
+#include "crc16.h"
+
+#define POLY 0x1021
+
+static uint16_t T[8][256];
+
+void crc16_init(void)
+{
+	int i, k, b;
+	uint16_t c;
+
+	for(i = 0; i < 256; i++)
+	{
+		c = i << 8;
+		for(b = 0; b < 8; b++)
+			c = (c & 0x8000) ? (c << 1) ^ POLY : c << 1;
+		T[0][i] = c;
+	}
+	for(k = 1; k < 8; k++)					//Shift one more zero byte through;
+		for(i = 0; i < 256; i++)
+			T[k][i] = (T[k - 1][i] << 8) ^ T[0][T[k - 1][i] >> 8];
+}
+
+unsigned short crc16(unsigned short crc, const unsigned char *p, size_t n)
+{
+	uint16_t c = crc;
+
+	while(n >= 8)
+	{
+		c = T[7][p[0] ^ (c >> 8)] ^ T[6][p[1] ^ (c & 0xFF)] ^
+			T[5][p[2]] ^ T[4][p[3]] ^ T[3][p[4]] ^ T[2][p[5]] ^ T[1][p[6]] ^ T[0][p[7]];
+		p += 8;
+		n -= 8;
+	}
+	while(n--)
+		c = (c << 8) ^ T[0][(c >> 8) ^ *p++];
+	return c;
+}
+
+unsigned short crc16_bytewise(unsigned short crc, const unsigned char *p, size_t n)
+{
+	uint16_t c = crc;
+
+	while(n--)
+		c = (c << 8) ^ T[0][(c >> 8) ^ *p++];
+	return c;
+}
+
+unsigned short crc16_bitwise(unsigned short crc, const unsigned char *p, size_t n)
+{
+	uint16_t c = crc;
+	int b;
+
+	while(n--)
+	{
+		c ^= *p++ << 8;
+		for(b = 0; b < 8; b++)
+			c = (c & 0x8000) ? (c << 1) ^ POLY : c << 1;
+	}
+	return c;
+}
@@ -0,0 +1,18 @@
+/*
+* CRC-16/CCITT (polynomial 0x1021, initial value 0xFFFF, not reflected, no final
+* XOR), as used by frames with MODE_CRC set: r3 (high byte) and r4 carry the CRC
+* of the identifier, length, mode, r1 and r2 bytes and the payload.
+*/
+#ifndef CRC16_H
+#define CRC16_H
+
+#include<stddef.h>
+
+#define CRC16_INIT 0xFFFF
+
+void crc16_init(void);							//Builds the tables, call once;
+unsigned short crc16(unsigned short crc, const unsigned char *p, size_t n);	//Slice-by-8;
+unsigned short crc16_bytewise(unsigned short crc, const unsigned char *p, size_t n);
+unsigned short crc16_bitwise(unsigned short crc, const unsigned char *p, size_t n);
+
+#endif
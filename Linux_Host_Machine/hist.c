@@ -0,0 +1,83 @@
+/*
+* Bucket of a value v >= HIST_LINEAR with e = floor(log2 v): HIST_LINEAR +
+* (e - 5) * HIST_SUB + the 4 bits below the leading one.
+*/
+
+#include<string.h>
+
+#include "hist.h"
+
+void hist_init(struct hist *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min = UINT64_MAX;
+}
+
+static int bucket(uint64_t v)
+{
+	int e;
+
+	if(v < HIST_LINEAR)
+		return v;
+	e = 63 - __builtin_clzll(v);
+	if(e > HIST_MAX_LOG2)
+		return HIST_BUCKETS - 1;
+	return HIST_LINEAR + (e - 5) * HIST_SUB + (int)((v >> (e - 4)) - HIST_SUB);
+}
+
+static uint64_t bucket_top(int i)				//Largest value of bucket i;
+{
+	int e, sub;
+
+	if(i < HIST_LINEAR)
+		return i;
+	e = (i - HIST_LINEAR) / HIST_SUB + 5;
+	sub = (i - HIST_LINEAR) % HIST_SUB + HIST_SUB;
+	return ((uint64_t)(sub + 1) << (e - 4)) - 1;
+}
+
+void hist_add(struct hist *h, uint64_t v)
+{
+	h->count[bucket(v)]++;
+	h->n++;
+	h->sum += v;
+	if(v < h->min)
+		h->min = v;
+	if(v > h->max)
+		h->max = v;
+}
+
+void hist_merge(struct hist *to, const struct hist *from)
+{
+	int i;
+
+	for(i = 0; i < HIST_BUCKETS; i++)
+		to->count[i] += from->count[i];
+	to->n += from->n;
+	to->sum += from->sum;
+	if(from->min < to->min)
+		to->min = from->min;
+	if(from->max > to->max)
+		to->max = from->max;
+}
+
+/*
+* Value below which a fraction q of the values lie, as the top of its bucket
+* (never above the largest value seen).
+*/
+uint64_t hist_quantile(const struct hist *h, double q)
+{
+	uint64_t rank, seen = 0, top;
+	int i;
+
+	if(h->n == 0)
+		return 0;
+	rank = q * h->n;
+	if(rank >= h->n)
+		rank = h->n - 1;
+	for(i = 0; i < HIST_BUCKETS; i++)
+		if((seen += h->count[i]) > rank)
+			break;
+	top = bucket_top(i);
+	return top > h->max ? h->max : top;
+}
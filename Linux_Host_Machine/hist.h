@@ -0,0 +1,29 @@
+/*
+* Latency histograms in the style of HdrHistogram: the first HIST_LINEAR values
+* have a bucket each, above that every power of 2 is split into HIST_SUB
+* buckets, so a value is kept to within 1/HIST_SUB (6 %) at any magnitude with a
+* fixed array and no allocation. Values are nanoseconds; adding one is a few
+* shifts and an increment.
+*/
+#ifndef HIST_H
+#define HIST_H
+
+#include<stdint.h>
+
+#define HIST_SUB 16						//Buckets per power of 2;
+#define HIST_LINEAR (2 * HIST_SUB)				//Exact buckets for 0..31;
+#define HIST_MAX_LOG2 40					//Largest magnitude kept (~18 min in ns);
+#define HIST_BUCKETS (HIST_LINEAR + (HIST_MAX_LOG2 - 4) * HIST_SUB)
+
+struct hist
+{
+	uint32_t count[HIST_BUCKETS];
+	uint64_t n, sum, min, max;
+};
+
+void hist_init(struct hist *h);
+void hist_add(struct hist *h, uint64_t v);
+void hist_merge(struct hist *to, const struct hist *from);
+uint64_t hist_quantile(const struct hist *h, double q);		//Upper bound of the bucket, 0 if empty;
+
+#endif
@@ -0,0 +1,1949 @@
+/*
+* libdaq protocol engine. The engine is a state machine driven by
+* daq_process(): it reads what the tty has, advances the protocol phase by
+* phase and queues output, without ever blocking, so that one thread can run
+* many handles from a single poll() or epoll loop. Each protocol phase gets
+* cfg.timeout_ms plus the time its bytes need on the wire, and a timeout or NACK
+* restarts the transaction up to cfg.retries times. Only I/O errors other than
+* timeouts are returned to the caller as errors; a transaction that runs out of
+* retries completes its op with DAQ_FAILED. Clock exchanges and streaming stay
+* blocking calls.
+*
+* The queue is a ring of DAQ_QUEUE op pointers: ops in [head, base) are done and
+* wait for daq_reap(), ops in [base, next) have been sent (one at a time in
+* stop-and-wait mode), ops in [next, tail) wait. The op at index i goes out with
+* sequence number i & 0xFF in windowed mode.
+*
+* With cfg.cobs windowed frames and their replies are COBS framed; the session is
+* opened by a plain SYNC with SYNC_COBS in r2, as the firmware only looks for a
+* 0x00 delimiter once it has been asked to. A frame goes out without its start
+* and stop bytes, encoded so that it holds no 0x00, between
+* two 0x00 delimiters. Each run of up to 254 bytes without a zero is sent as its
+* length + 1 and the bytes; a length byte below 0xFF implies a zero after the run.
+* Replies are decoded byte by byte as they arrive, status and seq into d->rsp and
+* d->cobs_seq and the rest straight into d->data, and a reply that lost or gained
+* bytes is dropped at its delimiter instead of leaving the engine out of step
+* until a timeout.
+*
+* Output is gathered, not copied: a frame is queued as iovecs for its header (in
+* d->hdr, encoded once per op and reused by its resends), its payload (in place,
+* in the op's frame) and its stop byte, and everything queued goes out in one
+* writev(). Frames handed to daq_cache_frame() are kept encoded with r1 = 0 and
+* the CRC change each bit of r1 causes (the CRC has no final XOR, so it is linear
+* in the message), so such a frame costs 8 table lookups instead of a CRC over
+* its payload whatever sequence number it goes out with.
+*
+* The link calls (daq_hello(), daq_negotiate()) are blocking stop-and-wait
+* transactions outside the queue, like the clock exchanges. A rate switch is a
+* MODE_BAUD write at the old rate; once its ACK is in, both ends move, the host
+* probes the new rate with a long HELLO read and confirms it with a second
+* MODE_BAUD that carries the probe pattern the other way. The firmware falls back
+* by itself unless the confirmation arrives within BAUD_CONFIRM_MS, so after any
+* failure the host only has to wait that long and find the board at the old rate.
+* A confirmed rate lasts until the firmware has waited BAUD_IDLE_MS for a frame;
+* a session that starts before then finds the board with locate().
+*/
+
+#include<stdlib.h>
+#include<unistd.h>
+#include<string.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<termios.h>
+#include<time.h>
+#include<poll.h>
+#include<limits.h>
+#include<stdint.h>
+#include<sys/uio.h>
+
+#include "crc16.h"
+#include "libdaq.h"
+
+#define CLOCK_PERIOD 1000					//ms between clock exchanges during a run;
+
+#define F_UNSENT 0						//Op states;
+#define F_INFLIGHT 1
+#define F_RESENT 2
+#define F_DONE 3
+#define F_RESEND 4						//To be sent again;
+
+#define P_IDLE 0						//Engine phases;
+#define P_LSTART 1						//Stop-and-wait: send the header;
+#define P_HDR_ACK 2
+#define P_DATA 3
+#define P_STOP_ACK 4
+#define P_DRAIN 5						//Wait for a quiet line, then resume;
+#define P_SSTART 6						//Windowed: send SYNC;
+#define P_SYNC 7
+#define P_STATUS 8						//Windowed reply: ACK/NACK, seq, data;
+#define P_SEQ 9
+#define P_WDATA 10
+
+#define Q(d, i) ((d)->queue[(i) & (DAQ_QUEUE - 1)])
+#define WIRE_MAX (8 + FRAME_MAX + 1 + 8)			//Largest frame on the line, COBS overhead included;
+#define OUT_IOV 64						//Output pieces queued, up to 3 per frame;
+#define CACHE_SIZE 64						//Pre-encoded frames per handle, direct mapped;
+#define PROBE_LEN 256						//HELLO read that probes a new rate;
+#define BAUD_SETTLE_MS 5					//Both ends reprogrammed before the probe;
+
+struct cached							//A frame kept encoded by daq_cache_frame();
+{
+	const unsigned char *frame;				//NULL for a free entry;
+	unsigned char hdr[8];					//As sent, r1 = 0 in windowed mode;
+	int rlen;						//daq_reply_len();
+	unsigned short seq_crc[8];				//CRC change per bit of r1;
+};
+
+struct daq
+{
+	int fd;
+	struct daq_config cfg;
+	struct daq_stats st;
+	struct daq_op *queue[DAQ_QUEUE];
+	int rlen[DAQ_QUEUE];					//Read data per sequence slot, -1 for writes;
+	unsigned char hdr[DAQ_QUEUE][8];			//Header each op goes out with;
+	long head, base, next, tail;
+	int synced;						//Windowed session started with SYNC;
+	long open_baud;						//Rate of daq_open(), the firmware's start rate;
+	int phase, resume;
+	long long deadline;					//daq_now_ms() at which the phase times out;
+	long long wake;						//Due time of the next op not sent yet;
+	int attempt, bad, rsp, vmin;
+	int replied;						//Stop-and-wait compound frame: payload ACKed, reply next;
+	long ack;						//Op of the reply being received;
+	int need, got;						//Bytes expected in data[] and received;
+	double phase_ns;					//now_ns() when the phase started;
+	unsigned char rx[4096];
+	int rx_off, rx_len;
+	struct iovec iov[OUT_IOV];				//Output not written yet;
+	int iov_off, iov_len;
+	unsigned char out[2 * WIRE_MAX];			//Output bytes that are nowhere else: COBS frames;
+	int out_len;
+	unsigned char sync[9];
+	struct cached cache[CACHE_SIZE];
+	struct termios tio;					//As last set, for VMIN changes;
+	struct clock_est clk;
+	long long clock_next;					//daq_now_ms() of the next periodic exchange;
+	unsigned char data[FRAME_MAX + 4 + 2];			//Read data, stamp and CRC;
+	unsigned char cobs_code, cobs_left;			//COBS decoder: length byte of the run, bytes left in it;
+	unsigned char cobs_seq;
+	int cobs_n, cobs_bad;					//Bytes of the reply decoded so far, too many of them;
+	unsigned char pkt[8 + 255 + 4 + 1];			//Stream packet;
+	unsigned char stream_id;
+	long long period;					//ms to fill one stream block;
+};
+
+const char *const daq_phase_name[PHASES] = {"header ACK", "payload", "stop ACK", "reply"};
+const char *const daq_latency_name[LATENCIES] = {"header_ack", "payload", "stop_ack", "reply", "op"};
+
+static const struct
+{
+	long baud;
+	speed_t speed;
+} baud_table[] =						//Rates supported by the firmware BaudTable;
+{
+	{9600, B9600}, {19200, B19200}, {38400, B38400}, {57600, B57600},
+	{115200, B115200}, {230400, B230400}, {460800, B460800}, {921600, B921600}
+};
+
+static const unsigned char stop_byte = STOP;
+
+static int baud_index(long baud)				//Entry of baud in baud_table, -1 if none;
+{
+	unsigned int k;
+
+	for(k = 0; k < sizeof(baud_table) / sizeof(baud_table[0]); k++)
+		if(baud_table[k].baud == baud)
+			return k;
+	return -1;
+}
+
+/*
+* Puts the tty into raw mode: no canonical processing, no echo, no CR/LF
+* translation, 8N1 and no flow control. The fd is non-blocking and waits are
+* done in poll(); serial_set_block() raises VMIN for bulk reads. The settings
+* are left in *tio.
+* Returns 0 on success, -1 on error (errno set).
+*/
+static int serial_setup(int fd, long baud, struct termios *tio)
+{
+	int k;
+
+	if((k = baud_index(baud)) == -1)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if(tcgetattr(fd, tio) == -1)
+		return -1;
+
+	cfmakeraw(tio);
+	tio->c_cflag &= ~(CSTOPB | PARENB | CRTSCTS);
+	tio->c_cflag |= CLOCAL | CREAD | CS8;
+	tio->c_iflag &= ~(IXON | IXOFF | IXANY);
+	tio->c_cc[VMIN] = 1;
+	tio->c_cc[VTIME] = 0;
+	cfsetispeed(tio, baud_table[k].speed);
+	cfsetospeed(tio, baud_table[k].speed);
+
+	if(tcsetattr(fd, TCSANOW, tio) == -1)
+		return -1;
+	return tcflush(fd, TCIOFLUSH);
+}
+
+/*
+* Lets poll() report the tty readable only once n bytes (max 255) have arrived,
+* so a whole payload costs one wakeup instead of one per byte. VTIME stays 0;
+* the phase deadline bounds the wait. tio holds the settings in force, so that
+* a change is one ioctl.
+*/
+static int serial_set_block(int fd, struct termios *tio, int n)
+{
+	tio->c_cc[VMIN] = n > 255 ? 255 : (n < 1 ? 1 : n);
+	return tcsetattr(fd, TCSANOW, tio);
+}
+
+long long daq_now_ms(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (long long)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+static double now_ns(void)					//CLOCK_MONOTONIC in ns, for clock exchanges;
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+/*
+* Deadline of a protocol phase that moves n bytes: the configured timeout plus
+* the time the bytes take on the wire at the current line rate.
+*/
+static long long phase_deadline(const struct daq *d, int n)
+{
+	return daq_now_ms() + d->cfg.timeout_ms + (long long)n * 10000 / d->cfg.baud;
+}
+
+/*
+* Reads exactly n bytes from the non-blocking fd, sleeping in poll() until data
+* arrives. Returns n, or -1 with errno = ETIMEDOUT once the deadline passes.
+*/
+static int io_read(struct daq *d, unsigned char *buf, int n, long long deadline)
+{
+	struct pollfd pfd;
+	int r, got = 0;
+	long long left;
+
+	pfd.fd = d->fd;
+	pfd.events = POLLIN;
+	while(got < n)
+	{
+		d->st.reads++;
+		if((r = read(d->fd, buf + got, n - got)) > 0)
+		{
+			got += r;
+			continue;
+		}
+		if((r == -1) && (errno != EAGAIN) && (errno != EINTR))
+			return -1;
+		if((left = deadline - daq_now_ms()) <= 0)
+		{
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		d->st.polls++;
+		if((poll(&pfd, 1, left) == -1) && (errno != EINTR))
+			return -1;
+	}
+	d->st.wire += n;
+	return got;
+}
+
+static int io_write(struct daq *d, const unsigned char *buf, int n, long long deadline)	//Same for writes;
+{
+	struct pollfd pfd;
+	int r, put = 0;
+	long long left;
+
+	pfd.fd = d->fd;
+	pfd.events = POLLOUT;
+	while(put < n)
+	{
+		d->st.writes++;
+		if((r = write(d->fd, buf + put, n - put)) > 0)
+		{
+			put += r;
+			continue;
+		}
+		if((r == -1) && (errno != EAGAIN) && (errno != EINTR))
+			return -1;
+		if((left = deadline - daq_now_ms()) <= 0)
+		{
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		d->st.polls++;
+		if((poll(&pfd, 1, left) == -1) && (errno != EINTR))
+			return -1;
+	}
+	d->st.wire += n;
+	return put;
+}
+
+static void io_drain(struct daq *d)				//Discards input until the line is quiet for 20 ms;
+{
+	unsigned char buf[64];
+
+	while(io_read(d, buf, sizeof(buf), daq_now_ms() + 20) != -1);
+}
+
+/*
+* Counts a failed phase. Returns 0 for a timeout (the transaction is retried),
+* -1 for any other error, which ends the call.
+*/
+static int phase_failed(struct daq *d, int phase)
+{
+	if(errno != ETIMEDOUT)
+		return -1;
+	d->st.timeouts[phase]++;
+	return 0;
+}
+
+/*
+* With cfg.crc, sets MODE_CRC in the header h and stores the CRC of h[1..5] and the
+* n payload bytes in r3:r4. The header must be final (sequence number included).
+*/
+static void crc_header(const struct daq *d, unsigned char *h, const unsigned char *payload, int n)
+{
+	unsigned short c;
+
+	if(!d->cfg.crc)
+		return;
+	h[3] |= MODE_CRC;
+	c = crc16(crc16(CRC16_INIT, h + 1, 5), payload, n);
+	h[6] = c >> 8;
+	h[7] = c & 0xFF;
+}
+
+/*
+* Checks read data followed by its 2 byte CRC (high byte first). Without cfg.crc
+* there is no CRC and the data is always accepted.
+*/
+static int crc_check(struct daq *d, const unsigned char *data, int n)
+{
+	if(!d->cfg.crc)
+		return 0;
+	if(crc16(CRC16_INIT, data, n) == ((data[n] << 8) | data[n + 1]))
+		return 0;
+	d->st.crc_errors++;
+	return -1;
+}
+
+static uint32_t stamp_get(const unsigned char *p)		//Device stamp, 4 bytes LE;
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/*
+* One clock exchange: a read of 0 samples with MODE_TS, which the device answers
+* with its Timer0 count alone. The count is read after the header has arrived and
+* before it is sent back, so it belongs to the host time between the end of the
+* header on the wire and the start of the reply.
+* Returns 0, 1 if the exchange failed (it is then not used), -1 on I/O error.
+*/
+static int clock_exchange(struct daq *d)
+{
+	unsigned char h[8] = {0xFE, d->cfg.board, 0, MODE_READ | MODE_TS, 0, 0, 0, 0}, r[4 + 2], c;
+	double t0, t1, lo, hi, byte = 10e9 / d->cfg.baud;
+	int n = 4 + (d->cfg.crc ? 2 : 0), bad;
+
+	crc_header(d, h, NULL, 0);
+	t0 = now_ns();
+	if((io_write(d, h, 8, phase_deadline(d, 8)) == -1) || (io_read(d, &c, 1, phase_deadline(d, 9)) == -1) ||
+		(c != ACK) || (io_read(d, r, n, phase_deadline(d, n)) == -1))
+		goto fail;
+	t1 = now_ns();
+	bad = crc_check(d, r, 4);
+	if((io_write(d, &stop_byte, 1, phase_deadline(d, 1)) == -1) || (io_read(d, &c, 1, phase_deadline(d, 1)) == -1) ||
+		(c != ACK) || bad)
+		goto fail;
+	lo = t0 + 7 * byte;					//One byte of slack for FIFOs that pass a byte on early;
+	hi = t1 - (n - 1) * byte;
+	if(hi < lo)						//Line faster than its baud rate (simulator without -p);
+	{
+		lo = t0;
+		hi = t1;
+	}
+	clock_add(&d->clk, stamp_get(r), (lo + hi) / 2, (hi - lo) / 2);
+	d->clock_next = daq_now_ms() + CLOCK_PERIOD;
+	return 0;
+
+fail:
+	if(errno != ETIMEDOUT)
+		return -1;
+	io_drain(d);
+	return 1;
+}
+
+/*
+* With cfg.ts, runs n clock exchanges, or one if n is 0 and the periodic exchange
+* is due. Returns the exchanges that succeeded, -1 on I/O error.
+*/
+int daq_clock_sync(struct daq *d, int n)
+{
+	int i, r, ok = 0;
+
+	if(!d->cfg.ts || ((n == 0) && (daq_now_ms() < d->clock_next)))
+		return 0;
+	for(i = 0; i < (n ? n : 1); i++)
+	{
+		if((r = clock_exchange(d)) == -1)
+			return -1;
+		ok += r == 0;
+	}
+	return ok;
+}
+
+const struct clock_est *daq_clock(const struct daq *d)
+{
+	return &d->clk;
+}
+
+static void stamp_op(struct daq *d, struct daq_op *op, const unsigned char *p)
+{
+	op->time_ns = clock_host(&d->clk, stamp_get(p), &op->bound_ns);
+	op->stamped = 1;
+}
+
+/*
+* Latency histograms: header ACK is header sent -> ACK, payload is header ACK ->
+* last data byte of a read (a write's payload goes out with its stop byte and
+* counts in stop ACK), stop ACK is stop byte sent -> ACK, reply is windowed frame
+* sent -> its reply, op is first transmission -> completion, retries included.
+*/
+static void latency(struct daq *d, int which, double since)
+{
+	hist_add(&d->st.latency[which], now_ns() - since);
+}
+
+/*
+* Bytes of data the firmware answers a frame with, stamp and CRC not counted:
+* the payload length of a read, the total length of the read sub-operations of
+* a compound frame, -1 for a write or a compound frame whose list is malformed.
+* A compound payload is a list of peripheral, mode, length, and the data of
+* writes.
+*/
+int daq_reply_len(const unsigned char *frame)
+{
+	const unsigned char *p = frame + 8;
+	int i = 0, n = 0, len = PAYLOAD_LEN(frame), op;
+
+	if(IS_READ(frame))
+		return len;
+	if((frame[3] & MODE_OP) != MODE_COMPOUND)
+		return -1;
+	while(i < len)
+	{
+		if((len - i < 3) || (p[i] > 0x03))
+			return -1;
+		op = p[i + 1];
+		if(op == MODE_WRITE)
+			i += 3 + p[i + 2];
+		else if((op == MODE_READ) || (op == MODE_STATS) || ((op == MODE_READ10) && (p[i + 2] % 5 == 0)))
+		{
+			n += p[i + 2];
+			i += 3;
+		}
+		else
+			return -1;
+	}
+	return (i == len) && (n <= FRAME_MAX) ? n : -1;
+}
+
+static void store_reply(struct daq_op *op, const unsigned char *data, int len)	//Read data into the op;
+{
+	if(op->reply != NULL)
+		memcpy(op->reply, data, len);
+}
+
+static void op_done(struct daq *d, struct daq_op *op)
+{
+	op->status = DAQ_DONE;
+	op->state = F_DONE;
+	d->st.frames++;
+	d->st.payload += PAYLOAD_LEN(op->frame);
+	latency(d, LAT_OP, op->first_ns);
+}
+
+/*
+* Output is queued as iovecs pointing at the bytes where they are and written
+* without blocking, all of it in one writev(); what the tty does not take now
+* goes out when it reports POLLOUT. The bytes must stay put until written.
+* out_room() tells whether a frame that may put n bytes into d->out fits.
+*/
+static int out_room(const struct daq *d, int n)
+{
+	return (d->out_len + n <= (int)sizeof(d->out)) && (d->iov_len + 3 <= OUT_IOV);
+}
+
+static void emit(struct daq *d, const unsigned char *buf, int n)
+{
+	struct iovec *v = &d->iov[d->iov_len - 1];
+
+	if((d->iov_len > d->iov_off) && ((unsigned char *)v->iov_base + v->iov_len == buf))
+		v->iov_len += n;				//Goes on where the last piece ends;
+	else
+	{
+		d->iov[d->iov_len].iov_base = (void *)buf;
+		d->iov[d->iov_len++].iov_len = n;
+	}
+}
+
+static int flush(struct daq *d)
+{
+	struct iovec *v;
+	ssize_t r;
+
+	while(d->iov_off < d->iov_len)
+	{
+		d->st.writes++;
+		if((r = writev(d->fd, d->iov + d->iov_off, d->iov_len - d->iov_off)) > 0)
+		{
+			d->st.wire += r;
+			for(v = &d->iov[d->iov_off]; (d->iov_off < d->iov_len) && (r >= (ssize_t)v->iov_len); v++)
+			{
+				r -= v->iov_len;
+				d->iov_off++;
+			}
+			if(r > 0)					//Part of a piece written;
+			{
+				v->iov_base = (unsigned char *)v->iov_base + r;
+				v->iov_len -= r;
+			}
+			continue;
+		}
+		if((r == -1) && (errno != EAGAIN) && (errno != EINTR))
+			return -1;
+		return 0;
+	}
+	d->iov_off = d->iov_len = d->out_len = 0;
+	return 0;
+}
+
+/*
+* Reads what the tty has into d->rx. A read that returns less than it asked for
+* has taken everything, so there is no second one to fail with EAGAIN.
+*/
+static int input(struct daq *d)
+{
+	int r, room;
+
+	if(d->rx_off == d->rx_len)
+		d->rx_off = d->rx_len = 0;
+	while((room = sizeof(d->rx) - d->rx_len) > 0)
+	{
+		d->st.reads++;
+		if((r = read(d->fd, d->rx + d->rx_len, room)) > 0)
+		{
+			d->rx_len += r;
+			d->st.wire += r;
+			if(r < room)
+				break;
+			continue;
+		}
+		if((r == -1) && (errno != EAGAIN) && (errno != EINTR))
+			return -1;
+		break;
+	}
+	return 0;
+}
+
+static int take(struct daq *d)					//Next received byte, -1 if none;
+{
+	return d->rx_off < d->rx_len ? d->rx[d->rx_off++] : -1;
+}
+
+static int collect(struct daq *d)				//Moves received bytes to d->data, 1 once need are there;
+{
+	int n = d->rx_len - d->rx_off;
+
+	if(n > d->need - d->got)
+		n = d->need - d->got;
+	memcpy(d->data + d->got, d->rx + d->rx_off, n);
+	d->rx_off += n;
+	d->got += n;
+	return d->got == d->need;
+}
+
+static void expect(struct daq *d, int phase, int n, long long deadline)	//Wait for n bytes in phase;
+{
+	d->phase = phase;
+	d->phase_ns = now_ns();
+	d->need = n;
+	d->got = 0;
+	d->deadline = deadline;
+}
+
+/*
+* COBS encodes the n bytes at src, delimiters included, into dst, which needs room
+* for n + n / 254 + 3 bytes. Returns the encoded length.
+*/
+static int cobs_encode(unsigned char *dst, const unsigned char *src, int n)
+{
+	int i, code = 1, at = 1, len = 2;			//dst[at] = length byte of the run;
+
+	dst[0] = 0x00;
+	for(i = 0; i < n; i++)
+	{
+		if(src[i] != 0x00)
+		{
+			dst[len++] = src[i];
+			if(++code < 0xFF)
+				continue;
+		}
+		dst[at] = code;					//A zero, or a full run of 254 bytes;
+		at = len++;
+		code = 1;
+	}
+	dst[at] = code;
+	dst[len++] = 0x00;
+	return len;
+}
+
+static void drain(struct daq *d, int resume)			//Discards input until the line is quiet for 20 ms;
+{
+	d->phase = P_DRAIN;
+	d->resume = resume;
+	d->rx_off = d->rx_len;
+	d->cobs_bad = 1;					//COBS: the reply cut here is dropped at its delimiter;
+	d->deadline = daq_now_ms() + 20;
+}
+
+/*
+* Encodes the header frame goes out with into h: MODE_TS for frames answered with
+* data, in windowed mode MODE_SEQ and seq in r1, and the CRC (reads: over the
+* header only).
+*/
+static void encode(const struct daq *d, const unsigned char *frame, int seq, unsigned char *h)
+{
+	memcpy(h, frame, 8);
+	if(d->cfg.window > 0)
+	{
+		h[3] |= MODE_SEQ;
+		h[4] = seq;
+	}
+	if((daq_reply_len(frame) >= 0) && d->cfg.ts)
+		h[3] |= MODE_TS;
+	crc_header(d, h, frame + 8, IS_READ(frame) ? 0 : PAYLOAD_LEN(frame));
+}
+
+static struct cached *cache_entry(struct daq *d, const unsigned char *frame)	//Where frame would be;
+{
+	return &d->cache[(((uint64_t)(uintptr_t)frame * 0x9E3779B97F4A7C15ULL) >> 32) & (CACHE_SIZE - 1)];
+}
+
+/*
+* Encodes the header of the op at index i into d->hdr and its reply length into
+* d->rlen. A cached frame only gets its sequence number, and the CRC the change
+* of r1 from 0 to it causes.
+*/
+static void encode_header(struct daq *d, long i)
+{
+	const unsigned char *frame = Q(d, i)->frame;
+	const struct cached *c = cache_entry(d, frame);
+	unsigned char *h = d->hdr[i & (DAQ_QUEUE - 1)];
+	unsigned short crc;
+	int b;
+
+	if(c->frame != frame)
+	{
+		encode(d, frame, i & 0xFF, h);
+		d->rlen[i & (DAQ_QUEUE - 1)] = daq_reply_len(frame);
+		d->st.encoded++;
+		return;
+	}
+	memcpy(h, c->hdr, 8);
+	d->rlen[i & (DAQ_QUEUE - 1)] = c->rlen;
+	if(d->cfg.window == 0)
+		return;
+	h[4] = i & 0xFF;
+	if(!d->cfg.crc)
+		return;
+	crc = (h[6] << 8) | h[7];
+	for(b = 0; b < 8; b++)
+		if(h[4] & (1 << b))
+			crc ^= c->seq_crc[b];
+	h[6] = crc >> 8;
+	h[7] = crc & 0xFF;
+}
+
+/*
+* Stop-and-wait transaction for the op at d->next: header->ACK, then payload +
+* stop->ACK (write) or payload, stop->ACK (read). A timeout or NACK restarts the
+* transaction after the line has been drained. Read data is stored in the op's
+* payload.
+*/
+static void legacy_send(struct daq *d)				//Header of the current attempt;
+{
+	if(d->attempt == 0)					//Retries send it as encoded the first time;
+		encode_header(d, d->next);
+	emit(d, d->hdr[d->next & (DAQ_QUEUE - 1)], 8);
+	expect(d, P_HDR_ACK, 1, phase_deadline(d, 8 + 1));
+}
+
+static void legacy_retry(struct daq *d)
+{
+	struct daq_op *op = Q(d, d->next);
+
+	if(++d->attempt <= d->cfg.retries)
+	{
+		d->st.retries++;
+		drain(d, P_LSTART);
+		return;
+	}
+	if(op->err == 0)
+		op->err = ETIMEDOUT;
+	op->status = DAQ_FAILED;
+	op->state = F_DONE;
+	d->st.failures++;
+	d->base = ++d->next;
+	d->phase = P_IDLE;
+	d->deadline = LLONG_MAX;
+}
+
+static int legacy_byte(struct daq *d)				//Handles input in the legacy phases;
+{
+	struct daq_op *op = Q(d, d->next);
+	const unsigned char *hdr = op->frame;
+	int c, len = PAYLOAD_LEN(hdr), rlen = d->rlen[d->next & (DAQ_QUEUE - 1)], ts = (rlen >= 0) && d->cfg.ts ? 4 : 0;
+
+	if(d->phase == P_DATA)
+	{
+		if(!collect(d))
+			return 0;
+		latency(d, PH_PAYLOAD, d->phase_ns);
+		if((d->bad = crc_check(d, d->data, rlen + ts)) == 0)	//Finish the transaction, then retry a bad one;
+		{
+			store_reply(op, d->data, rlen);
+			if(ts)
+				stamp_op(d, op, d->data + rlen);
+		}
+		emit(d, &stop_byte, 1);
+		expect(d, P_STOP_ACK, 1, phase_deadline(d, 1 + 1));
+		return 1;
+	}
+	if((c = take(d)) == -1)
+		return 0;
+	if(c != ACK)
+	{
+		d->st.nacks++;
+		op->err = EPROTO;
+		legacy_retry(d);
+		return 1;
+	}
+	latency(d, d->phase == P_HDR_ACK ? PH_HDR_ACK : PH_STOP_ACK, d->phase_ns);
+	if(d->phase == P_HDR_ACK)
+	{
+		d->bad = 0;
+		d->replied = 0;
+		if(IS_READ(hdr))
+			expect(d, P_DATA, len + ts + (d->cfg.crc ? 2 : 0), phase_deadline(d, len + ts + 2));
+		else
+		{
+			emit(d, hdr + 8, len + 1);			//Payload + stop bits;
+			expect(d, P_STOP_ACK, 1, phase_deadline(d, len + 1 + 1));
+		}
+		return 1;
+	}
+	if(d->bad)							//P_STOP_ACK;
+	{
+		op->err = EBADMSG;
+		legacy_retry(d);
+		return 1;
+	}
+	if(((hdr[3] & MODE_OP) == MODE_COMPOUND) && !d->replied)	//Payload taken, the reply follows as for a read;
+	{
+		d->replied = 1;
+		expect(d, P_DATA, rlen + ts + (d->cfg.crc ? 2 : 0), phase_deadline(d, rlen + ts + 2));
+		return 1;
+	}
+	op->err = 0;
+	op_done(d, op);
+	d->base = ++d->next;
+	d->phase = P_IDLE;
+	d->deadline = LLONG_MAX;
+	return 1;
+}
+
+/*
+* Sends one windowed frame: the op's header with MODE_SEQ set and the sequence
+* number in r1, the payload for writes and the stop byte, back to back with the
+* frames before it. A resend goes out with the header encoded the first time.
+*/
+static void send_frame(struct daq *d, long i)
+{
+	const unsigned char *frame = Q(d, i)->frame;
+	unsigned char f[7 + FRAME_MAX], *h = d->hdr[i & (DAQ_QUEUE - 1)];
+	int n = IS_READ(frame) ? 0 : PAYLOAD_LEN(frame);	//Payload of writes and compound frames;
+
+	if(Q(d, i)->state != F_RESEND)
+		encode_header(d, i);
+	if(d->cfg.cobs)						//Without start and stop bytes;
+	{
+		memcpy(f, h + 1, 7);
+		memcpy(f + 7, frame + 8, n);
+		n = cobs_encode(d->out + d->out_len, f, 7 + n);
+		emit(d, d->out + d->out_len, n);
+		d->out_len += n;
+	}
+	else
+	{
+		emit(d, h, 8);
+		if(n > 0)
+			emit(d, frame + 8, n);
+		emit(d, &stop_byte, 1);
+	}
+	Q(d, i)->sent_ns = now_ns();
+}
+
+static void resend(struct daq *d, long i)			//Sent again once there is room;
+{
+	d->st.retries++;
+	Q(d, i)->state = F_RESEND;
+}
+
+/*
+* Deadline of the reply to the oldest frame in flight: everything in flight has
+* to cross the line first.
+*/
+static void window_wait(struct daq *d)
+{
+	int inflight = 0, ts = d->cfg.ts ? 4 : 0;
+	long j;
+
+	for(j = d->base; j < d->next; j++)
+		inflight += FRAME_LEN(Q(d, j)->frame) + 2 + (d->rlen[j & (DAQ_QUEUE - 1)] >= 0 ?
+			d->rlen[j & (DAQ_QUEUE - 1)] + ts + 2 : 0);
+	expect(d, P_STATUS, 1, d->base < d->next ? phase_deadline(d, inflight) : LLONG_MAX);
+}
+
+/*
+* The oldest op ran out of retries: it fails, the ops behind it are sent again
+* in a new session.
+*/
+static void window_fail(struct daq *d, int err)
+{
+	struct daq_op *op = Q(d, d->base);
+	long j;
+
+	op->status = DAQ_FAILED;
+	op->err = err;
+	op->state = F_DONE;
+	d->st.failures++;
+	for(j = ++d->base; j < d->next; j++)
+	{
+		Q(d, j)->state = F_UNSENT;
+		Q(d, j)->tries = 0;
+	}
+	d->next = d->base;
+	d->synced = 0;
+	drain(d, P_IDLE);
+}
+
+/*
+* Starts a windowed session with a SYNC frame that restarts numbering at the
+* sequence number of the oldest op. It always goes out plain and is answered
+* plainly; with cfg.cobs it asks for a COBS session, and the decoder starts afresh.
+*/
+static void sync_send(struct daq *d)
+{
+	unsigned char *sync = d->sync;
+
+	memcpy(sync, Q(d, d->base)->frame, 8);
+	sync[2] = 0;
+	sync[3] = MODE_SYNC | MODE_SEQ;
+	sync[4] = d->base & 0xFF;
+	sync[5] = d->cfg.cobs ? SYNC_COBS : 0;
+	sync[8] = STOP;
+	crc_header(d, sync, NULL, 0);
+	emit(d, sync, 9);
+	d->cobs_code = d->cobs_left = 0;
+	d->cobs_n = d->cobs_bad = 0;
+	expect(d, P_SYNC, 2, phase_deadline(d, 9 + 2));
+}
+
+static void sync_retry(struct daq *d)
+{
+	if(++d->attempt > d->cfg.retries)
+		window_fail(d, ETIMEDOUT);
+	else
+	{
+		d->st.retries++;
+		drain(d, P_SSTART);
+	}
+}
+
+/*
+* Sends the frames that are due while there is room in the window (and in the
+* output buffer): frames to resend first, then new ones. Returns 1 if any went out.
+*/
+static int window_fill(struct daq *d)
+{
+	long j;
+	int sent = 0;
+
+	for(j = d->base; j < d->next; j++)
+		if((Q(d, j)->state == F_RESEND) && out_room(d, WIRE_MAX))
+		{
+			send_frame(d, j);
+			Q(d, j)->state = F_RESENT;
+			sent = 1;
+		}
+	d->wake = LLONG_MAX;
+	while((d->next < d->tail) && (d->next - d->base < d->cfg.window) && out_room(d, WIRE_MAX))
+	{
+		if(Q(d, d->next)->due > daq_now_ms())
+		{
+			d->wake = Q(d, d->next)->due;		//Not due yet;
+			break;
+		}
+		send_frame(d, d->next);
+		Q(d, d->next)->first_ns = Q(d, d->next)->sent_ns;
+		Q(d, d->next++)->state = F_INFLIGHT;
+		sent = 1;
+	}
+	return sent;
+}
+
+/*
+* Handles a windowed reply. The firmware answers every frame it executes with
+* ACK + seq (followed by the data for reads) and a missing or corrupt frame with
+* NACK + the seq it expects; only that frame is sent again. An ACK also
+* acknowledges all earlier frames, so a write whose own ACK was lost completes; a
+* read in that situation is sent again since its data was lost with the ACK.
+*
+* window_status() takes the status in d->rsp and the sequence number c. Returns 1
+* if it is the ACK of the op at d->ack, whose data (for reads) comes next, 0 if the
+* reply has been dealt with.
+*/
+static int window_status(struct daq *d, int c)
+{
+	long i, off = (unsigned char)(c - d->base);
+
+	if(d->rsp == NACK)
+	{
+		d->st.nacks++;
+		if((off == 0) && (d->base < d->next) && (Q(d, d->base)->tries++ >= d->cfg.retries))
+		{
+			window_fail(d, EPROTO);			//Refused every time, e.g. invalid parameters;
+			return 0;
+		}
+		if((off < d->next - d->base) && (Q(d, d->base + off)->state != F_DONE))
+			resend(d, d->base + off);
+		window_wait(d);
+		return 0;
+	}
+	i = d->base + (signed char)(c - d->base);		//Frame acknowledged, earlier ones for duplicates;
+	if((i < 0) || (i >= d->next) || (i < d->next - DAQ_QUEUE))
+	{
+		if(d->cfg.cobs)
+			window_wait(d);				//The next reply is in step anyway;
+		else
+			drain(d, P_STATUS);			//Cannot tell its length, resync on the next timeout;
+		return 0;
+	}
+	d->ack = i;
+	return 1;
+}
+
+static void window_complete(struct daq *d)			//ACK of d->ack, its data in d->data;
+{
+	struct daq_op *op;
+	long i = d->ack, j;
+	int len = d->rlen[i & (DAQ_QUEUE - 1)], ts = d->cfg.ts ? 4 : 0;
+
+	if((len >= 0) && (crc_check(d, d->data, len + ts) == -1))	//Corrupt data, read it again;
+	{
+		if((i >= d->base) && (Q(d, i)->state != F_DONE))
+			resend(d, i);
+		window_wait(d);
+		return;
+	}
+	if(i < d->base)						//Reply to a duplicate;
+	{
+		window_wait(d);
+		return;
+	}
+	for(j = d->base; j < i; j++)				//Cumulative ACK;
+	{
+		op = Q(d, j);
+		if(op->state == F_DONE)
+			continue;
+		if(d->rlen[j & (DAQ_QUEUE - 1)] < 0)
+			op_done(d, op);
+		else if(op->state == F_INFLIGHT)
+			resend(d, j);
+	}
+	op = Q(d, i);
+	if(op->state != F_DONE)
+	{
+		latency(d, PH_REPLY, op->sent_ns);
+		op_done(d, op);
+		if(len >= 0)
+		{
+			store_reply(op, d->data, len);
+			if(ts)
+				stamp_op(d, op, d->data + len);
+		}
+	}
+	while((d->base < d->next) && (Q(d, d->base)->state == F_DONE))
+		d->base++;
+	window_wait(d);
+}
+
+static int window_byte(struct daq *d)
+{
+	int c, len, ts = d->cfg.ts ? 4 : 0;
+
+	if(d->phase == P_STATUS)
+	{
+		if((c = take(d)) == -1)
+			return 0;
+		if((c == ACK) || (c == NACK))			//Anything else is not a reply, skip it;
+		{
+			d->rsp = c;
+			expect(d, P_SEQ, 1, phase_deadline(d, 1));
+		}
+		return 1;
+	}
+	if(d->phase == P_SEQ)
+	{
+		if((c = take(d)) == -1)
+			return 0;
+		if(!window_status(d, c))
+			return 1;
+		if((len = d->rlen[d->ack & (DAQ_QUEUE - 1)]) >= 0)	//Data follows the ACK of a read;
+		{
+			expect(d, P_WDATA, len + ts + (d->cfg.crc ? 2 : 0), phase_deadline(d, len + ts + 2));
+			return 1;
+		}
+	}
+	else if(!collect(d))						//P_WDATA;
+		return 0;
+	window_complete(d);
+	return 1;
+}
+
+/*
+* A COBS framed reply has been decoded: a windowed reply whose length has to
+* match what the acknowledged op expects. Empty frames (the leading
+* delimiter of the next one) are skipped. A reply that lost bytes is known to be
+* lost as soon as its delimiter arrives, so instead of waiting for the timeout
+* the oldest frame in flight is sent again at once; should the reply have been
+* another frame's, the firmware answers the duplicate and it is ignored.
+*/
+static void cobs_reply(struct daq *d)
+{
+	int len, ts = d->cfg.ts ? 4 : 0, crc = d->cfg.crc ? 2 : 0;
+
+	if(d->cobs_n == 0)
+		return;
+	if(d->cobs_bad || (d->cobs_n < 2) || ((d->rsp != ACK) && (d->rsp != NACK)))
+	{
+		d->st.dropped++;
+		if((d->phase == P_STATUS) && (d->base < d->next) && (Q(d, d->base)->state != F_RESEND))
+		{
+			resend(d, d->base);
+			window_wait(d);
+		}
+		return;
+	}
+	if((d->phase != P_STATUS) || !window_status(d, d->cobs_seq))
+		return;
+	len = d->rlen[d->ack & (DAQ_QUEUE - 1)];
+	if(d->cobs_n - 2 != (len >= 0 ? len + ts + crc : 0))
+	{
+		d->st.dropped++;
+		if((d->ack >= d->base) && (Q(d, d->ack)->state != F_DONE))
+			resend(d, d->ack);
+		window_wait(d);
+		return;
+	}
+	window_complete(d);
+}
+
+/*
+* Decodes the received bytes in the windowed phases with cfg.cobs. Every 0x00 ends
+* a reply, whatever state the decoder is in. Returns 1 if any reply ended.
+*/
+static int cobs_byte(struct daq *d)
+{
+	int c, zero, r = 0;
+
+	while((c = take(d)) != -1)
+	{
+		if(c == 0x00)
+		{
+			d->cobs_bad |= d->cobs_left != 0;	//Delimiter inside a run, bytes were lost;
+			cobs_reply(d);
+			d->cobs_code = d->cobs_left = 0;
+			d->cobs_n = d->cobs_bad = 0;
+			r = 1;
+			continue;
+		}
+		if(d->cobs_left > 0)
+			d->cobs_left--;
+		else						//Length byte of the next run;
+		{
+			zero = (d->cobs_code != 0) && (d->cobs_code < 0xFF);	//Zero after the previous run;
+			d->cobs_code = c;
+			d->cobs_left = c - 1;
+			if(!zero)
+				continue;
+			c = 0x00;
+		}
+		if(d->cobs_n == 0)
+			d->rsp = c;
+		else if(d->cobs_n == 1)
+			d->cobs_seq = c;
+		else if(d->cobs_n - 2 < (int)sizeof(d->data))
+			d->data[d->cobs_n - 2] = c;
+		else
+			d->cobs_bad = 1;
+		d->cobs_n++;
+	}
+	return r;
+}
+
+/*
+* The phase ran past its deadline.
+*/
+static void timeout(struct daq *d)
+{
+	switch(d->phase)
+	{
+		case P_DRAIN:
+			d->phase = d->resume;
+			d->deadline = LLONG_MAX;
+			if(d->phase == P_STATUS)
+				window_wait(d);
+			break;
+		case P_HDR_ACK:
+		case P_DATA:
+		case P_STOP_ACK:
+			d->st.timeouts[d->phase == P_HDR_ACK ? PH_HDR_ACK : (d->phase == P_DATA ? PH_PAYLOAD : PH_STOP_ACK)]++;
+			legacy_retry(d);
+			break;
+		case P_SYNC:
+			d->st.timeouts[PH_HDR_ACK]++;
+			sync_retry(d);
+			break;
+		case P_STATUS:
+			d->st.timeouts[PH_REPLY]++;
+			if(Q(d, d->base)->tries++ >= d->cfg.retries)
+				window_fail(d, ETIMEDOUT);
+			else
+			{
+				resend(d, d->base);
+				window_wait(d);
+			}
+			break;
+		case P_SEQ:
+		case P_WDATA:
+			d->st.timeouts[d->phase == P_SEQ ? PH_REPLY : PH_PAYLOAD]++;
+			window_wait(d);
+			break;
+		default:
+			d->deadline = LLONG_MAX;
+			break;
+	}
+}
+
+/*
+* Sets VMIN to n (at most 255, the termios limit) if it is not already: a payload
+* phase raises it to the bytes still missing so that poll() reports the tty once
+* for the whole payload, every other phase and the blocking calls need it at 1.
+*/
+static void set_vmin(struct daq *d, int n)
+{
+	if(n > 255)
+		n = 255;
+	if(n < 1)
+		n = 1;
+	if(n != d->vmin)
+	{
+		serial_set_block(d->fd, &d->tio, n);
+		d->st.ioctls++;
+		d->vmin = n;
+	}
+}
+
+/*
+* Periodic clock exchange, only while nothing is in flight. It runs blocking (one
+* exchange is some 15 bytes) so that the reply is timed as it arrives.
+*/
+static int clock_idle(struct daq *d)
+{
+	if(!d->cfg.ts || (daq_now_ms() < d->clock_next) || (d->iov_len > d->iov_off))
+		return 0;
+	d->rx_off = d->rx_len;
+	set_vmin(d, 1);
+	return daq_clock_sync(d, 0) == -1 ? -1 : 0;
+}
+
+/*
+* One step of the state machine. Returns 1 if anything changed, 0 if it has to
+* wait for input, output room or time, -1 on I/O error.
+*/
+static int step(struct daq *d)
+{
+	struct daq_op *op;
+	int sent;
+
+	if(daq_now_ms() >= d->deadline)
+	{
+		if(d->rx_off < d->rx_len)			//Input that arrived in time comes first;
+			d->deadline = daq_now_ms() + 1;
+		else
+		{
+			timeout(d);
+			return 1;
+		}
+	}
+	switch(d->phase)
+	{
+		case P_IDLE:
+			if(d->cfg.window > 0)
+			{
+				if(d->base == d->tail)
+					return 0;
+				if(clock_idle(d) == -1)
+					return -1;
+				if(d->synced)
+				{
+					window_wait(d);
+					return 1;
+				}
+				d->attempt = 0;
+				d->phase = P_SSTART;
+				return 1;
+			}
+			if(d->next == d->tail)
+				return 0;
+			op = Q(d, d->next);
+			if(op->due > daq_now_ms())
+			{
+				d->wake = op->due;
+				return 0;
+			}
+			d->wake = LLONG_MAX;
+			if(clock_idle(d) == -1)
+				return -1;
+			d->attempt = 0;
+			op->err = 0;
+			op->first_ns = now_ns();
+			d->phase = P_LSTART;
+			return 1;
+		case P_LSTART:
+			if(!out_room(d, WIRE_MAX))
+				return 0;
+			legacy_send(d);
+			return 1;
+		case P_SSTART:
+			if(!out_room(d, 9 + 3))
+				return 0;
+			sync_send(d);
+			return 1;
+		case P_DRAIN:
+			if(d->rx_off < d->rx_len)
+			{
+				d->rx_off = d->rx_len;
+				d->deadline = daq_now_ms() + 20;
+			}
+			return 0;
+		case P_HDR_ACK:
+		case P_DATA:
+		case P_STOP_ACK:
+			return legacy_byte(d);
+		case P_SYNC:
+			if(!collect(d))
+				return 0;
+			if((d->data[0] == ACK) && (d->data[1] == (d->base & 0xFF)))
+			{
+				d->synced = 1;
+				window_wait(d);
+			}
+			else
+			{
+				d->st.nacks++;
+				sync_retry(d);
+			}
+			return 1;
+		default:						//P_STATUS, P_SEQ, P_WDATA;
+			sent = 0;
+			if(d->phase == P_STATUS)
+			{
+				if((d->base == d->next) && (d->rx_off == d->rx_len) && (clock_idle(d) == -1))
+					return -1;
+				if((sent = window_fill(d)))
+					window_wait(d);
+			}
+			return (d->cfg.cobs ? cobs_byte(d) : window_byte(d)) | sent;
+	}
+}
+
+/*
+* Runs the state machine until it waits, then writes all it queued in one go;
+* the steps that waited for room in the output get another turn once it is
+* written.
+*/
+int daq_process(struct daq *d)
+{
+	int r;
+
+	if(input(d) == -1)
+		return -1;
+	while(1)
+	{
+		if((r = step(d)) == -1)
+			return -1;
+		if(r)
+			continue;
+		if(d->iov_off == d->iov_len)
+			break;
+		if(flush(d) == -1)
+			return -1;
+		if(d->iov_len > 0)				//The tty is full, wait for POLLOUT;
+			break;
+	}
+	set_vmin(d, (d->phase == P_DATA) || (d->phase == P_WDATA) ? d->need - d->got : 1);
+	return 0;
+}
+
+int daq_fd(const struct daq *d)
+{
+	return d->fd;
+}
+
+/*
+* The poll() events the handle waits for and, in *deadline (daq_now_ms() time,
+* LLONG_MAX for none), when daq_process() has to run even without them.
+*/
+int daq_events(const struct daq *d, long long *deadline)
+{
+	long long t = d->deadline;
+	int idle = (d->phase == P_IDLE) || ((d->phase == P_STATUS) && (d->base == d->next));
+
+	if(((d->phase == P_IDLE) || (d->phase == P_STATUS)) && (d->wake < t))
+		t = d->wake;
+	if(idle && d->cfg.ts && (d->next < d->tail) && (d->clock_next < t))
+		t = d->clock_next;
+	*deadline = t;
+	return POLLIN | (d->iov_len > d->iov_off ? POLLOUT : 0);
+}
+
+/*
+* Completed ops, in submission order, without waiting. Returns the number stored.
+* None are handed back while output is queued: a resend that crossed the reply to
+* the original may still point into the payload of an op that is done.
+*/
+int daq_reap(struct daq *d, struct daq_op **done, int max)
+{
+	int n = 0;
+
+	if(d->iov_off < d->iov_len)
+		return 0;
+	while((n < max) && (d->head < d->tail) && (Q(d, d->head)->state == F_DONE))
+		done[n++] = Q(d, d->head++);
+	return n;
+}
+
+struct daq *daq_open(const char *tty, const struct daq_config *cfg)
+{
+	struct daq *d;
+	int e;
+
+	if((cfg->window < 0) || (cfg->window > WINDOW_MAX) || (cfg->timeout_ms < 1) || (cfg->retries < 0) ||
+		(cfg->retries > 255) || (cfg->cobs && (cfg->window == 0)))
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	if((d = calloc(1, sizeof(*d))) == NULL)
+		return NULL;
+	d->cfg = *cfg;
+	d->open_baud = cfg->baud;
+	d->deadline = d->wake = LLONG_MAX;
+	d->vmin = 1;
+	if((d->fd = open(tty, O_RDWR | O_NOCTTY | O_NONBLOCK)) == -1)
+	{
+		free(d);
+		return NULL;
+	}
+	if(serial_setup(d->fd, cfg->baud, &d->tio) == -1)		//Raw 8N1 at the requested rate;
+	{
+		e = errno;
+		close(d->fd);
+		free(d);
+		errno = e;
+		return NULL;
+	}
+	crc16_init();
+	clock_init(&d->clk, TICK_HZ);
+	for(e = 0; e < LATENCIES; e++)
+		hist_init(&d->st.latency[e]);
+	return d;
+}
+
+void daq_close(struct daq *d)
+{
+	if(d == NULL)
+		return;
+	close(d->fd);
+	free(d);
+}
+
+static int frame_ok(const unsigned char *f)			//An op can be run on it;
+{
+	return (f[0] == 0xFE) && (PAYLOAD_LEN(f) <= FRAME_MAX) && ((f[3] & MODE_OP) != MODE_STREAM) &&
+		((f[3] & MODE_OP) != MODE_SYNC) && ((f[3] & MODE_OP) != MODE_BAUD) &&
+		(((f[3] & MODE_OP) != MODE_COMPOUND) || (daq_reply_len(f) >= 0));
+}
+
+/*
+* Queues up to n ops, in order, behind those already queued. The frames must stay
+* valid until the ops complete; nothing is sent before the next daq_process() or
+* daq_poll_completions(). Returns the number queued (less than n when the queue
+* is full), -1 with errno = EINVAL if a frame is not valid (none queued).
+*/
+int daq_submit_batch(struct daq *d, struct daq_op *const *ops, int n)
+{
+	int k;
+
+	for(k = 0; k < n; k++)
+		if(!frame_ok(ops[k]->frame))
+		{
+			errno = EINVAL;
+			return -1;
+		}
+	for(k = 0; (k < n) && (d->tail - d->head < DAQ_QUEUE); k++)
+	{
+		ops[k]->status = DAQ_PENDING;
+		ops[k]->err = 0;
+		ops[k]->stamped = 0;
+		ops[k]->state = F_UNSENT;
+		ops[k]->tries = 0;
+		Q(d, d->tail++) = ops[k];
+	}
+	return k;
+}
+
+/*
+* Keeps frame encoded for the handle, for frames that go out again and again (LED
+* patterns, polls of the ADC): its ops skip the CRC over the payload and the
+* parsing of compound frames. Header and payload must not change while it is
+* cached. A frame whose entry another one took is simply encoded in full.
+* Returns 0, -1 with errno = EINVAL if the frame is not valid.
+*/
+int daq_cache_frame(struct daq *d, const unsigned char *frame)
+{
+	static const unsigned char zeros[1 + FRAME_MAX];
+	struct cached *c;
+	unsigned char bit;
+	int b, n;
+
+	if(!frame_ok(frame))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	c = cache_entry(d, frame);
+	c->frame = frame;
+	encode(d, frame, 0, c->hdr);
+	c->rlen = daq_reply_len(frame);
+	n = IS_READ(frame) ? 0 : PAYLOAD_LEN(frame);
+	for(b = 0; b < 8; b++)					//r1 = bit b, r2 and the payload all zeros;
+	{
+		bit = 1 << b;
+		c->seq_crc[b] = (d->cfg.window > 0) && d->cfg.crc ? crc16(crc16(0, &bit, 1), zeros, 1 + n) : 0;
+	}
+	return 0;
+}
+
+void daq_cache_clear(struct daq *d)
+{
+	memset(d->cache, 0, sizeof(d->cache));
+}
+
+int daq_pending(const struct daq *d)
+{
+	return d->tail - d->head;
+}
+
+/*
+* Runs the queued ops until max of them are complete or the queue is empty, and
+* stores the completed ones in done[], in submission order. Ops still in flight
+* when it returns go on with the next call.
+* Returns the number stored, -1 on I/O error (the ops stay queued).
+*/
+int daq_poll_completions(struct daq *d, struct daq_op **done, int max)
+{
+	struct pollfd pfd;
+	long long deadline, left;
+	int n = 0;
+
+	pfd.fd = d->fd;
+	while(1)
+	{
+		if(daq_process(d) == -1)
+			return -1;
+		n += daq_reap(d, done + n, max - n);
+		if((n == max) || (d->head == d->tail))
+			return n;
+		pfd.events = daq_events(d, &deadline);
+		left = deadline == LLONG_MAX ? -1 : deadline - daq_now_ms();
+		if(left == 0)
+			continue;
+		d->st.polls++;
+		if((poll(&pfd, 1, left < 0 ? -1 : (left > INT_MAX ? INT_MAX : left)) == -1) && (errno != EINTR))
+			return -1;
+	}
+}
+
+/*
+* Receives one stream packet (header, block of samples, stamp with MODE_TS, stop)
+* into d->pkt. Bytes before the start byte are skipped. Returns the number of
+* samples, 0 if the byte found at a packet boundary is not a start byte (it is
+* left in *first), -1 on error.
+*/
+static int stream_packet(struct daq *d, unsigned char *first, long long deadline)
+{
+	unsigned char *pkt = d->pkt;
+	int n;
+
+	if(io_read(d, first, 1, deadline) == -1)
+		return -1;
+	if(*first != 0xFE)
+		return 0;
+	pkt[0] = 0xFE;
+	if(io_read(d, pkt + 1, 7, deadline) == -1)
+		return -1;
+	n = pkt[2] + (pkt[3] & MODE_TS ? 4 : 0);
+	if(io_read(d, pkt + 8, n + 1, deadline + (long long)(n + 1) * 10000 / d->cfg.baud) == -1)
+		return -1;
+	if(((pkt[3] & MODE_OP) != MODE_STREAM) || (pkt[8 + n] != STOP))
+	{
+		errno = EPROTO;
+		return -1;
+	}
+	return pkt[2];
+}
+
+/*
+* Streaming mode: starts continuous acquisition at rate Hz in blocks of block
+* samples from the ADC of board identifier id. The start frame is a write of rate
+* (4 bytes LE) and block size. With cfg.ts every packet carries the stamp of its
+* first sample. Returns 0, -1 on error (errno = EPROTO if the firmware refused).
+*/
+int daq_stream_start(struct daq *d, unsigned char id, unsigned long rate, int block)
+{
+	unsigned char start[8 + 5 + 1], c;
+	int i;
+
+	if((block < 1) || (block > 255) || (rate == 0) || (rate > STREAM_MAX_RATE))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	memset(start, 0, sizeof(start));
+	start[0] = 0xFE;
+	start[1] = id;
+	start[2] = 5;
+	start[3] = MODE_STREAM | (d->cfg.ts ? MODE_TS : 0);
+	for(i = 0; i < 4; i++)
+		start[8 + i] = (rate >> (8 * i)) & 0xFF;
+	start[12] = block;
+	start[13] = STOP;
+	crc_header(d, start, start + 8, 5);
+	d->stream_id = id;
+	d->period = block * 1000LL / rate;
+
+	if((io_write(d, start, 8, phase_deadline(d, 8)) == -1) || (io_read(d, &c, 1, phase_deadline(d, 9)) == -1))
+	{
+		phase_failed(d, PH_HDR_ACK);
+		return -1;
+	}
+	if(c == ACK)
+	{
+		if((io_write(d, start + 8, 6, phase_deadline(d, 6)) == -1) || (io_read(d, &c, 1, phase_deadline(d, 7)) == -1))
+		{
+			phase_failed(d, PH_STOP_ACK);
+			return -1;
+		}
+		if(c == ACK)
+			return 0;
+	}
+	d->st.nacks++;
+	errno = EPROTO;
+	return -1;
+}
+
+/*
+* Next stream packet. A packet with a bad CRC is returned with corrupt set.
+* Returns 0, -1 on error (errno = ETIMEDOUT if the stream stopped).
+*/
+int daq_stream_next(struct daq *d, struct daq_packet *p)
+{
+	unsigned char c, *pkt = d->pkt;
+	int n, ts;
+
+	if((n = stream_packet(d, &c, phase_deadline(d, 8) + d->period)) <= 0)
+	{
+		if((n == -1) && (errno == ETIMEDOUT))
+			d->st.timeouts[PH_PAYLOAD]++;
+		if(n == 0)
+			errno = EPROTO;
+		return -1;
+	}
+	ts = pkt[3] & MODE_TS ? 4 : 0;
+	p->samples = pkt + 8;
+	p->n = n;
+	p->seq = pkt[4];
+	p->lost = pkt[5];
+	p->corrupt = (pkt[3] & MODE_CRC) &&
+		(crc16(crc16(CRC16_INIT, pkt + 1, 5), pkt + 8, n + ts) != ((pkt[6] << 8) | pkt[7]));
+	if(p->corrupt)
+		d->st.crc_errors++;
+	if((p->stamped = ts && !p->corrupt))
+		p->time_ns = clock_host(&d->clk, stamp_get(pkt + 8 + n), &p->bound_ns);
+	return 0;
+}
+
+/*
+* Stops the stream: the stop frame is a header with mode 04 and length 0,
+* answered with ACK after the packet in progress, whose packets are discarded.
+* Returns 0 if the stop was acknowledged, -1 otherwise.
+*/
+int daq_stream_stop(struct daq *d)
+{
+	unsigned char stopf[9], c;
+	int n;
+
+	memset(stopf, 0, sizeof(stopf));
+	stopf[0] = 0xFE;
+	stopf[1] = d->stream_id;
+	stopf[3] = MODE_STREAM;
+	stopf[8] = STOP;
+	crc_header(d, stopf, NULL, 0);
+	if(io_write(d, stopf, 9, phase_deadline(d, 9)) == -1)
+	{
+		phase_failed(d, PH_STOP_ACK);
+		return -1;
+	}
+	while((n = stream_packet(d, &c, phase_deadline(d, 8) + d->period)) > 0);
+	if(n == -1)
+	{
+		phase_failed(d, PH_STOP_ACK);
+		return -1;
+	}
+	if(c == ACK)
+		return 0;
+	d->st.nacks++;
+	errno = EPROTO;
+	return -1;
+}
+
+/*
+* One stop-and-wait transaction outside the queue, blocking and without retries:
+* a read gets its data into the frame's payload, a write sends its payload.
+* Returns 0, -1 with errno = ETIMEDOUT, EPROTO on a NACK or EBADMSG on a bad CRC.
+*/
+static int transact(struct daq *d, unsigned char *f)
+{
+	int len = PAYLOAD_LEN(f), read = IS_READ(f), n = len + (d->cfg.crc ? 2 : 0), bad = 0;
+	unsigned char c;
+
+	crc_header(d, f, f + 8, read ? 0 : len);
+	if((io_write(d, f, 8, phase_deadline(d, 8)) == -1) || (io_read(d, &c, 1, phase_deadline(d, 9)) == -1))
+	{
+		phase_failed(d, PH_HDR_ACK);
+		return -1;
+	}
+	if(c != ACK)
+		goto nack;
+	if(read)
+	{
+		if(io_read(d, d->data, n, phase_deadline(d, n)) == -1)
+		{
+			phase_failed(d, PH_PAYLOAD);
+			return -1;
+		}
+		bad = crc_check(d, d->data, len);
+		memcpy(f + 8, d->data, len);
+	}
+	if((io_write(d, read ? &stop_byte : f + 8, read ? 1 : len + 1, phase_deadline(d, len + 1)) == -1) ||
+		(io_read(d, &c, 1, phase_deadline(d, len + 2)) == -1))
+	{
+		phase_failed(d, PH_STOP_ACK);
+		return -1;
+	}
+	if(c != ACK)
+		goto nack;
+	if(bad)
+	{
+		errno = EBADMSG;
+		return -1;
+	}
+	return 0;
+
+nack:
+	d->st.nacks++;
+	errno = EPROTO;
+	return -1;
+}
+
+static void link_frame(const struct daq *d, unsigned char *f, int mode, int len)	//Probe pattern as payload;
+{
+	int i;
+
+	memset(f, 0, 8);
+	f[0] = 0xFE;
+	f[1] = d->cfg.board;
+	f[2] = len & 0xFF;
+	f[3] = mode | (len > 255 ? MODE_EXT : 0);
+	f[5] = len >> 8;
+	for(i = 0; i < len; i++)
+		f[8 + i] = PROBE_BYTE(i);
+	f[8 + len] = STOP;
+}
+
+static void baud_frame(const struct daq *d, unsigned char *f, long rate, int len)	//MODE_BAUD to rate;
+{
+	int i;
+
+	link_frame(d, f, MODE_BAUD, len);
+	for(i = 0; i < 4; i++)
+		f[8 + i] = (rate >> (8 * i)) & 0xFF;
+}
+
+static void hello_parse(struct daq_hello *h, const unsigned char *p)
+{
+	int i;
+
+	h->version = p[0];
+	h->window = p[1];
+	h->max_payload = p[2] | p[3] << 8;
+	h->ops = p[4] | p[5] << 8;
+	h->flags = p[6];
+	h->features = p[7];
+	h->baud = stamp_get(p + 8);
+	h->nrates = p[12] > HELLO_RATES ? HELLO_RATES : p[12];
+	for(i = 0; i < h->nrates; i++)
+		h->rates[i] = stamp_get(p + 16 + 4 * i);
+}
+
+/*
+* Asks the firmware for its capabilities, blocking, with cfg.retries retries.
+* Returns 0, -1 on error: EBUSY if ops are queued, EPROTO if every attempt was
+* NACKed (firmware without MODE_HELLO).
+*/
+int daq_hello(struct daq *d, struct daq_hello *h)
+{
+	unsigned char f[8 + HELLO_LEN + 1];
+	int i, e;
+
+	if(daq_pending(d))
+	{
+		errno = EBUSY;
+		return -1;
+	}
+	d->rx_off = d->rx_len;
+	set_vmin(d, 1);
+	for(i = 0; i <= d->cfg.retries; i++)
+	{
+		link_frame(d, f, MODE_HELLO, HELLO_LEN);
+		if(transact(d, f) == 0)
+		{
+			hello_parse(h, f + 8);
+			return 0;
+		}
+		if((errno != ETIMEDOUT) && (errno != EPROTO) && (errno != EBADMSG))
+			return -1;
+		e = errno;
+		if(i < d->cfg.retries)
+			d->st.retries++;
+		io_drain(d);
+		errno = e;
+	}
+	return -1;
+}
+
+static int set_rate(struct daq *d, long baud)			//Host end to baud, after what is queued;
+{
+	speed_t speed = baud_table[baud_index(baud)].speed;
+
+	tcdrain(d->fd);
+	cfsetispeed(&d->tio, speed);
+	cfsetospeed(&d->tio, speed);
+	d->st.ioctls++;
+	if(tcsetattr(d->fd, TCSANOW, &d->tio) == -1)
+		return -1;
+	d->cfg.baud = baud;
+	return 0;
+}
+
+/*
+* Probes the rate just switched to with a HELLO read of PROBE_LEN bytes: it has to
+* complete without a NACK, timeout or CRC error, with every pattern byte intact
+* and the capabilities of ref at the new rate. Returns 0 if it passes.
+*/
+static int probe(struct daq *d, const struct daq_hello *ref, long rate)
+{
+	unsigned char f[8 + PROBE_LEN + 1];
+	struct daq_hello h;
+	int i;
+
+	link_frame(d, f, MODE_HELLO, PROBE_LEN);
+	if(transact(d, f) == -1)
+		return -1;
+	for(i = HELLO_LEN; i < PROBE_LEN; i++)
+		if(f[8 + i] != PROBE_BYTE(i))
+			return -1;
+	hello_parse(&h, f + 8);
+	return (h.baud == rate) && (h.version == ref->version) && (h.ops == ref->ops) &&
+		(h.max_payload == ref->max_payload) ? 0 : -1;
+}
+
+/*
+* After a failed switch to rate: waits until the firmware has fallen back and
+* looks for it at the old rate, then at rate in case it got the confirmation but
+* its ACK was lost. Returns the rate it answers at, -1 if neither.
+*/
+static long relocate(struct daq *d, long old, long rate)
+{
+	struct timespec t = {(BAUD_CONFIRM_MS + 50) / 1000, (BAUD_CONFIRM_MS + 50) % 1000 * 1000000L};
+	struct daq_hello h;
+
+	if(set_rate(d, old) == -1)
+		return -1;
+	nanosleep(&t, NULL);
+	io_drain(d);
+	if(daq_hello(d, &h) == 0)
+		return old;
+	if((errno == EBUSY) || (set_rate(d, rate) == -1))
+		return -1;
+	io_drain(d);
+	if(daq_hello(d, &h) == 0)
+		return rate;
+	return -1;
+}
+
+/*
+* Moves the link to rate: MODE_BAUD at the current rate, the probe at the new
+* one, then MODE_BAUD again with half a probe of pattern, which confirms it.
+* Returns 1 if the link runs at rate, 0 if it is back at the old one, -1 if the
+* board is lost.
+*/
+static int try_rate(struct daq *d, const struct daq_hello *ref, long rate)
+{
+	struct timespec settle = {0, BAUD_SETTLE_MS * 1000000L};
+	unsigned char f[8 + PROBE_LEN / 2 + 1];
+	long old = d->cfg.baud, now;
+
+	baud_frame(d, f, rate, 4);
+	if(transact(d, f) == 0)
+	{
+		if(set_rate(d, rate) == -1)
+			return -1;
+		nanosleep(&settle, NULL);
+		if(probe(d, ref, rate) == 0)
+		{
+			baud_frame(d, f, rate, PROBE_LEN / 2);
+			if(transact(d, f) == 0)
+				return 1;
+		}
+	}
+	if((now = relocate(d, old, rate)) == -1)
+		return -1;
+	return now == rate;
+}
+
+static int hello_at(struct daq *d, struct daq_hello *h, long rate)	//One HELLO at rate, 0 if it answers;
+{
+	if(set_rate(d, rate) == -1)
+		return -1;
+	io_drain(d);
+	return daq_hello(d, h);
+}
+
+/*
+* Looks for a board that does not answer at the current rate with a HELLO at
+* each other rate of baud_table: the daq_open() rate first, where an idle board
+* goes back to, then the rest fastest first, where an earlier session may have
+* left it. Returns 0 with the link at the rate it answered at, -1 with the link
+* back at the current rate if none did.
+*/
+static int locate(struct daq *d, struct daq_hello *h)
+{
+	long start = d->cfg.baud;
+	int k, retries = d->cfg.retries, r = -1;
+
+	d->cfg.retries = 1;					//A second try after garbage the board took for a header;
+	if(d->open_baud != start)
+		r = hello_at(d, h, d->open_baud);
+	for(k = sizeof(baud_table) / sizeof(baud_table[0]) - 1; (k >= 0) && (r == -1); k--)
+		if((baud_table[k].baud != start) && (baud_table[k].baud != d->open_baud))
+			r = hello_at(d, h, baud_table[k].baud);
+	d->cfg.retries = retries;
+	if(r == -1)
+	{
+		set_rate(d, start);
+		errno = ETIMEDOUT;
+	}
+	return r;
+}
+
+/*
+* Moves the link to the fastest rate above the current one that the firmware
+* lists, the host supports, is not above max_baud (0: no limit) and passes the
+* probe, trying them fastest first; it stays at the current rate if none does.
+* h receives the capabilities, with the rate in use. Blocking, the queue must be
+* empty; a windowed session starts again with SYNC. A board that does not answer
+* is looked for at the other rates first (locate()), and the search goes on
+* from the rate it is found at.
+* Returns the rate in use, -1 on error or if the board no longer answers.
+*/
+long daq_negotiate(struct daq *d, struct daq_hello *h, long max_baud)
+{
+	long start, rate;
+	int i, r;
+
+	if((daq_hello(d, h) == -1) && (((errno != ETIMEDOUT) && (errno != EBADMSG)) || (locate(d, h) == -1)))
+		return -1;
+	start = d->cfg.baud;
+	for(i = h->nrates - 1; i >= 0; i--)
+	{
+		rate = h->rates[i];
+		if((rate <= start) || ((max_baud > 0) && (rate > max_baud)) || (baud_index(rate) == -1))
+			continue;
+		d->st.probes++;
+		if((r = try_rate(d, h, rate)) == -1)
+			return -1;
+		if(r)
+			break;
+		d->st.probe_failures++;
+	}
+	d->synced = 0;
+	h->baud = d->cfg.baud;
+	return d->cfg.baud;
+}
+
+const struct daq_stats *daq_stats(const struct daq *d)
+{
+	return &d->st;
+}
@@ -0,0 +1,175 @@
+/*
+* libdaq: the host side of the MCB2300 protocol as a library. A handle owns one
+* serial port. Operations are frames in the frame file layout (8 header bytes,
+* payload, stop byte); they are queued with daq_submit_batch() and run by
+* daq_poll_completions(), stop-and-wait or windowed, which hands them back in
+* order once they are done. Frames are only read, so that any number of queued ops
+may share one; read data is stored in the op's own reply buffer.
+* Streaming and the clock exchanges have their own calls.
+*
+* Event loops that drive many handles use the non-blocking calls instead of
+* daq_poll_completions(): wait for daq_events() on daq_fd() or for the deadline,
+* call daq_process(), collect the ops with daq_reap(). Frames that are sent over
+* and over can be handed to daq_cache_frame() once, so that they are not encoded
+* again for every op.
+*
+* daq_hello() asks the firmware for its capabilities; daq_negotiate() then moves
+* the link to the fastest rate both ends support that passes a bit error probe,
+* and leaves it where it was if none does. A board that does not answer at the
+* current rate is looked for at the others first: it keeps a negotiated rate
+* until the line has been idle for BAUD_IDLE_MS.
+*
+* $ gcc -O2 -c libdaq.c hist.c crc16.c clock.c && ar rcs libdaq.a libdaq.o hist.o crc16.o clock.o
+*/
+#ifndef LIBDAQ_H
+#define LIBDAQ_H
+
+#include "clock.h"
+#include "hist.h"
+
+#define ACK 0x0F
+#define NACK 0xF0
+#define STOP 0x01
+#define MODE_READ 0x01
+#define MODE_WRITE 0x02
+#define MODE_SYNC 0x03						//Windowed mode: restart sequence numbering at r1;
+#define MODE_STREAM 0x04					//Continuous ADC acquisition;
+#define MODE_READ10 0x05					//Read, 10 bit samples packed 4 into 5 bytes;
+#define MODE_SCAN 0x06						//Read, channels in r2 scanned length times;
+#define MODE_STATS 0x07						//Read the firmware profile, peripheral 1 = and clear it;
+#define MODE_COMPOUND 0x08					//Payload = sub-operations, answered with their read data;
+#define MODE_HELLO 0x09						//Read the capabilities, then the probe pattern;
+#define MODE_BAUD 0x0A						//Switch rate (4B LE) + probe pattern, see daq_negotiate();
+#define MODE_OP 0x0F						//Operation bits of the mode byte;
+#define MODE_TS 0x10						//Read data / stream blocks followed by a device stamp;
+#define MODE_SEQ 0x20						//Windowed frame, r1 = sequence number;
+#define MODE_CRC 0x40						//r3:r4 = CRC-16/CCITT of identifier..r2 and payload;
+#define MODE_EXT 0x80						//Extended frame, payload length = length | r2 << 8;
+
+#define PAYLOAD_LEN(f) (((f)[3] & MODE_OP) == MODE_SCAN ? (f)[2] * __builtin_popcount((f)[5]) : \
+	((f)[2] | (((f)[3] & MODE_EXT) ? (f)[5] << 8 : 0)))
+#define FRAME_LEN(f) (8 + PAYLOAD_LEN(f) + 1)			//Header, payload and stop byte;
+#define IS_READ(f) ((((f)[3] & MODE_OP) == MODE_READ) || (((f)[3] & MODE_OP) == MODE_READ10) || \
+	(((f)[3] & MODE_OP) == MODE_SCAN) || (((f)[3] & MODE_OP) == MODE_STATS) || (((f)[3] & MODE_OP) == MODE_HELLO))
+
+#define DEFAULT_BAUD 115200					//Must match UART_BAUD in the firmware library.h;
+#define DEFAULT_TIMEOUT 200					//ms per phase on top of the time on the wire;
+#define DEFAULT_RETRIES 3
+#define FRAME_MAX 1024						//Largest payload, POOL_SIZE in the firmware library.h;
+#define WINDOW_MAX 8						//Must not exceed WINDOW in the firmware library.h;
+#define SYNC_COBS 0x01						//SYNC frame, r2: the session goes on COBS framed;
+#define STREAM_MAX_RATE 100000					//As in the firmware library.h;
+#define TICK_HZ 1000000						//Device stamp rate, as in the firmware library.h;
+#define HELLO_LEN 48						//MODE_HELLO capability block, as in the firmware library.h;
+#define HELLO_RATES 8						//Rates it has room for;
+#define PROBE_BYTE(i) ((unsigned char)(((i) * 0x1D) ^ 0xA5))	//Test pattern at payload offset i, as in the firmware;
+#define BAUD_CONFIRM_MS 500					//Firmware falls back to the old rate unless confirmed in time;
+#define BAUD_IDLE_MS 5000					//and from a confirmed one to its start rate once the line is idle this long;
+
+#define DAQ_QUEUE 256						//Ops queued per handle (power of 2);
+
+#define PH_HDR_ACK 0						//Protocol phases with their own deadline;
+#define PH_PAYLOAD 1
+#define PH_STOP_ACK 2
+#define PH_REPLY 3						//Windowed reply;
+#define PHASES 4
+#define LAT_OP PHASES						//Latency of a whole op;
+#define LATENCIES (PHASES + 1)
+
+#define DAQ_PENDING 0						//Op status;
+#define DAQ_DONE 1
+#define DAQ_FAILED 2
+
+struct daq_config
+{
+	long baud;
+	long timeout_ms;
+	int retries;
+	int window;						//Frames in flight, 0 = stop-and-wait;
+	int crc;						//Send MODE_CRC frames and check replies;
+	int ts;							//Stamp read data, estimate the device clock;
+	unsigned char board;					//Identifier (BID << 2) of the clock exchanges;
+	int cobs;						//COBS framed windowed frames (window > 0);
+};
+
+#define DAQ_CONFIG_DEFAULT {DEFAULT_BAUD, DEFAULT_TIMEOUT, DEFAULT_RETRIES, 0, 0, 0, 0, 0}
+
+struct daq_stats
+{
+	unsigned long timeouts[PHASES];
+	unsigned long nacks, retries, failures, crc_errors;
+	unsigned long dropped;					//COBS framed replies that lost bytes;
+	long wire;						//Bytes moved on the line in both directions;
+	unsigned long frames;					//Ops done;
+	long payload;						//Payload bytes of the ops done;
+	unsigned long reads, writes, polls, ioctls;		//System calls (polls: daq_poll_completions() and blocking calls);
+	unsigned long encoded;					//Headers encoded in full, not from the cache;
+	unsigned long probes, probe_failures;			//Rates tried by daq_negotiate(), and left again;
+	struct hist latency[LATENCIES];				//ns per phase (see libdaq.c) and per op;
+};
+
+struct daq_op
+{
+	const unsigned char *frame;				//Header, payload, stop;
+	unsigned char *reply;					//daq_reply_len() bytes of read data, NULL = dropped;
+	long long due;						//daq_now_ms() before which it is not sent, 0 = at once;
+	void *user;
+	int status;						//DAQ_DONE, or DAQ_FAILED with errno in err;
+	int err;
+	int stamped;						//With ts: host time of the first sample +- bound;
+	double time_ns, bound_ns;
+	unsigned char state, tries;				//Owned by the library while queued;
+	double sent_ns, first_ns;
+};
+
+struct daq_packet						//One stream packet;
+{
+	const unsigned char *samples;				//Valid until the next daq_stream_next();
+	int n;
+	unsigned char seq, lost;
+	int corrupt;						//CRC error, the samples are not valid;
+	int stamped;
+	double time_ns, bound_ns;
+};
+
+struct daq_hello						//Firmware capabilities, see daq_hello();
+{
+	int version;
+	int window;						//Frames in flight it holds;
+	int max_payload;
+	unsigned int ops;					//Bit n set: mode n is supported;
+	unsigned char flags;					//Mode flag bits it accepts (MODE_TS..MODE_EXT);
+	unsigned char features;					//Bit 0 COBS framing, bit 1 profile;
+	long baud;						//Rate it runs at;
+	int nrates;
+	long rates[HELLO_RATES];				//Supported rates, slowest first;
+};
+
+struct daq;
+
+struct daq *daq_open(const char *tty, const struct daq_config *cfg);	//NULL on error, errno set;
+void daq_close(struct daq *d);
+int daq_submit_batch(struct daq *d, struct daq_op *const *ops, int n);	//Ops queued, -1 if invalid;
+int daq_reply_len(const unsigned char *frame);				//Data answering it, -1 for writes;
+int daq_poll_completions(struct daq *d, struct daq_op **done, int max);	//Ops done, -1 on I/O error;
+int daq_cache_frame(struct daq *d, const unsigned char *frame);		//Kept encoded, -1 if invalid;
+void daq_cache_clear(struct daq *d);
+int daq_pending(const struct daq *d);
+int daq_fd(const struct daq *d);
+int daq_events(const struct daq *d, long long *deadline);		//poll() events, deadline in ms;
+int daq_process(struct daq *d);						//Never blocks, -1 on I/O error;
+int daq_reap(struct daq *d, struct daq_op **done, int max);		//Ops done, without waiting;
+int daq_clock_sync(struct daq *d, int n);				//Exchanges that succeeded;
+const struct clock_est *daq_clock(const struct daq *d);
+int daq_stream_start(struct daq *d, unsigned char id, unsigned long rate, int block);
+int daq_stream_next(struct daq *d, struct daq_packet *p);
+int daq_stream_stop(struct daq *d);
+int daq_hello(struct daq *d, struct daq_hello *h);			//0, -1 on error (EPROTO: no HELLO);
+long daq_negotiate(struct daq *d, struct daq_hello *h, long max_baud);	//Rate in use, -1 if the board is lost;
+const struct daq_stats *daq_stats(const struct daq *d);
+long long daq_now_ms(void);						//CLOCK_MONOTONIC in milliseconds;
+
+extern const char *const daq_phase_name[PHASES];
+extern const char *const daq_latency_name[LATENCIES];		//Identifiers, for exported metrics;
+
+#endif
@@ -33,185 +33,878 @@ ADC-----0 (default)  (Sensor / pot is attached)
 
 #include<stdio.h>
 #include<stdlib.h>
+#include<stdint.h>
 #include<unistd.h>
 #include<string.h>
+#include<errno.h>
 #include<sys/types.h>
 #include<sys/stat.h>
 #include<fcntl.h>
+#include<time.h>
+#include<sys/mman.h>
 
+#include "libdaq.h"
+#include "multiport.h"
+#include "capture.h"
+#include "metrics.h"
+#include "pack10.h"
 
-#define BUFSIZE 100
-#define FLAG O_RDWR
-#define F_FLAG O_TRUNC | O_RDWR
 
-struct data
-{	
-	char enter;
-	unsigned char array[100];
-	unsigned char ack[1];
-	unsigned char stop[1];	
-}dt;
+#define FLAG O_RDONLY
 
-int main(int argc,char *argv[])
+#define CLOCK_BURST 8						//Clock exchanges before a run;
+#define SERVE_MS 100						//Longest a metrics scraper waits in a multi-port run;
+#define PROF_STATS_LEN 264					//MODE_STATS data, as in the firmware library.h;
+#define PROF_POINTS 12
+
+struct column							//One channel of an interleaved scan block;
+{
+	const unsigned char *p;					//First sample, in the block itself;
+	int stride;						//Bytes between samples (channels scanned);
+	int channel;						//AD0.n;
+};
+
+struct batch							//Frame file, mapped and indexed once;
+{
+	unsigned char *map;
+	size_t size;
+	unsigned char **frame;					//Start of every frame in the map;
+	int count;
+}bt;
+
+struct ports							//Multi-port names and stats for metrics_write();
 {
-	int fdwr1,fdwr2;					//fdwr1 & fdwr2 are file descriptors;
-	int fread;
-	char r,i;
-	unsigned char fdata[BUFSIZE];				//fdata is buffer;
-	      
-	dt.stop[0] = 0x01;
+	const char **name;
+	const struct daq_stats **st;
+};
+
+struct daq_config cfg = DAQ_CONFIG_DEFAULT;
+struct cap *cap;						//-c: capture store for read data, NULL;
+struct metrics *mx;						//-m: metrics snapshots, NULL;
+const char *tty;						//Port label of the metrics;
+int quiet;							//-q: no read data or samples printed;
+
+const char *const prof_name[PROF_POINTS] = {"frame", "idle", "header", "alloc", "rx", "adc", "tx", "led", "lcd",
+	"stream", "rx wait", "tx wait"};			//Firmware profiling points, PROF_ in library.h;
+
+/*
+* Prints the effective throughput of a run against the raw line
+* rate (10 bits per byte on the wire for 8N1).
+*/
+void report_rate(const struct timespec *t0, long wire_bytes, long baud)
+{
+	struct timespec t1;
+	double sec;
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	sec = (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+	if(sec <= 0)
+		return;
+	printf("\n%ld bytes in %.3f ms: %.0f B/s (%.1f%% of %ld baud)\n", wire_bytes, sec * 1e3,
+		wire_bytes / sec, 100.0 * wire_bytes * 10 / sec / baud, baud);
+}
 
-	if(argc < 3)
+
+/*
+* Prints the error counters and, for every phase seen, the latency median, 99th
+* percentile and maximum in microseconds.
+*/
+void print_stats(struct daq *dq)
+{
+	const struct daq_stats *st = daq_stats(dq);
+	const struct hist *h;
+	int k;
+
+	printf("\ntimeouts: header ack %lu, payload %lu, stop ack %lu, reply %lu | nacks %lu, retries %lu, failed %lu, crc errors %lu, dropped %lu\n",
+		st->timeouts[PH_HDR_ACK], st->timeouts[PH_PAYLOAD], st->timeouts[PH_STOP_ACK], st->timeouts[PH_REPLY],
+		st->nacks, st->retries, st->failures, st->crc_errors, st->dropped);
+	printf("syscalls: read %lu, write %lu, poll %lu, ioctl %lu | headers encoded %lu\n", st->reads, st->writes,
+		st->polls, st->ioctls, st->encoded);
+	printf("latency us (p50/p99/max):");
+	for(k = 0; k < LATENCIES; k++)
 	{
-		printf("ERROR Usage: %s <wrFile>\n",argv[0]);
-		exit(EXIT_FAILURE);
+		h = &st->latency[k];
+		if(h->n)
+			printf(" %s %.0f/%.0f/%.0f", daq_latency_name[k], hist_quantile(h, 0.5) / 1e3,
+				hist_quantile(h, 0.99) / 1e3, h->max / 1e3);
 	}
+	printf("\n");
+}
 
-	
-	if((fdwr1 = open(argv[1],F_FLAG))== -1)			//Open ttyS0 file;
-	{							//fdwr1-- file descriptor for ttyS0 file;
-		perror("ERROR open()");
+static unsigned long le32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned long)p[3] << 24;
+}
+
+static double prof_sum(const unsigned char *pt)		//64 bit cycle sum of a profiling point;
+{
+	return le32(pt + 12) + le32(pt + 16) * 4294967296.0;
+}
+
+/*
+* With -P: reads the firmware profile with a MODE_STATS frame to the file's
+* board, and clears it (clear) or prints it: per point the passes, the cycles
+* per pass (min/avg/max), the average in us and the share of the profiled
+* time (frame + idle), then the UART and payload pool counters.
+*/
+void profile(struct daq *dq, int clear)
+{
+	static unsigned char frame[8 + PROF_STATS_LEN + 1], p[PROF_STATS_LEN];
+	struct daq_op op = {0}, *o = &op;
+	const unsigned char *pt;
+	unsigned long hz, n, k, count;
+	double sum, total;
+	char cycles[40];
+
+	frame[0] = 0xFE;
+	frame[1] = cfg.board | (clear ? 1 : 0);
+	frame[2] = PROF_STATS_LEN & 0xFF;
+	frame[3] = MODE_STATS | MODE_EXT;
+	frame[5] = PROF_STATS_LEN >> 8;
+	frame[8 + PROF_STATS_LEN] = STOP;
+	op.frame = frame;
+	op.reply = p;
+	if((daq_submit_batch(dq, &o, 1) != 1) || (daq_poll_completions(dq, &o, 1) != 1) || (op.status != DAQ_DONE))
+	{
+		printf("\nERROR profile: %s\n", strerror(op.err ? op.err : errno));
+		return;
+	}
+	if(clear)
+		return;
+	hz = le32(p);
+	n = le32(p + 4);
+	if((hz == 0) || (n > PROF_POINTS))
+	{
+		printf("\nERROR profile: %lu points at %lu Hz\n", n, hz);
+		return;
+	}
+	pt = p + 8;						//count, min, max, sum low, sum high;
+	total = prof_sum(pt) + prof_sum(pt + 20);		//PROF_FRAME + PROF_IDLE;
+	printf("\nfirmware profile (%.0f MHz cycles): passes, cycles min/avg/max, avg us, %% of time\n", hz / 1e6);
+	for(k = 0; k < n; k++, pt += 20)
+	{
+		if((count = le32(pt)) == 0)
+			continue;
+		sum = prof_sum(pt);
+		snprintf(cycles, sizeof(cycles), "%lu/%.0f/%lu", le32(pt + 4), sum / count, le32(pt + 8));
+		printf("%-8s %9lu %28s %10.1f %5.1f%%\n", prof_name[k], count, cycles, sum / count / hz * 1e6,
+			total > 0 ? 100 * sum / total : 0);
+	}
+	printf("uart overruns %lu, rx dropped %lu | pool high water %lu, exhausted %lu\n", le32(pt), le32(pt + 4),
+		le32(pt + 8), le32(pt + 12));
+}
+
+/*
+* With -m, publishes a snapshot of the handle's stats when the -M period has
+* passed (or with force) and answers waiting scrapers of a metrics socket.
+*/
+void export_metrics(struct daq *dq, int force)
+{
+	const struct daq_stats *st;
+
+	if(mx == NULL)
+		return;
+	if(!force && !metrics_due(mx))
+	{
+		metrics_serve(mx);
+		return;
+	}
+	st = daq_stats(dq);
+	if(metrics_write(mx, &tty, &st, 1) == -1)
+		perror("ERROR metrics");
+}
+
+void export_ports(struct mp_port *port, int nports, void *arg)	//Multi-port tick, snapshots locked;
+{
+	struct ports *ps = arg;
+
+	(void)port;
+	if(!metrics_due(mx))
+		metrics_serve(mx);
+	else if(metrics_write(mx, ps->name, ps->st, nports) == -1)
+		perror("ERROR metrics");
+}
+
+/*
+* With -T, runs n clock exchanges and prints the estimate.
+*/
+void clock_sync(struct daq *dq, int n)
+{
+	const struct clock_est *c = daq_clock(dq);
+	int ok;
+
+	if(!cfg.ts)
+		return;
+	if((ok = daq_clock_sync(dq, n)) == -1)
+	{
+		perror("ERROR daq_clock_sync()");
 		exit(EXIT_FAILURE);
 	}
+	printf("\nclock: %d/%d exchanges, device %+.1f ppm, +-%.0f us\n", ok, n, clock_drift_ppm(c), c->err / 1e3);
+}
+
+void print_stamp(double time_ns, double bound_ns)		//Host time of a block's first sample;
+{
+	printf("\nsampled at %.6f s +-%.0f us\n", time_ns / 1e9, bound_ns / 1e3);
+}
+
+/*
+* Splits an interleaved scan block into one column per channel in mask. The
+* columns point into the block (no copy); sample r of column k is
+* col[k].p[r * col[k].stride]. Returns the number of columns.
+*/
+int scan_columns(const unsigned char *data, unsigned char mask, struct column *col)
+{
+	int ch, n = 0, stride = __builtin_popcount(mask);
+
+	for(ch = 0; ch < 8; ch++)
+		if(mask & (1 << ch))
+		{
+			col[n].p = data + n;
+			col[n].stride = stride;
+			col[n].channel = ch;
+			n++;
+		}
+	return n;
+}
+
+/*
+* Prints the data of a read: bytes, the unpacked samples for mode 05 or one
+* line per channel for mode 06.
+*/
+void print_read(const unsigned char *hdr, const unsigned char *data, int len)
+{
+	uint16_t samples[FRAME_MAX / 5 * 4];
+	struct column col[8];
+	int i, k, n;
+
+	if((hdr[3] & MODE_OP) == MODE_SCAN)
+	{
+		n = scan_columns(data, hdr[5], col);
+		for(k = 0; k < n; k++)
+		{
+			printf("\nAD0.%d:", col[k].channel);
+			for(i = 0; i < hdr[2]; i++)
+				printf(" %x\t", col[k].p[i * col[k].stride]);
+		}
+		return;
+	}
+	if((hdr[3] & MODE_OP) != MODE_READ10)
+	{
+		for(i=0;i<len;i++)
+			printf(" %x\t", data[i]);
+		return;
+	}
+	unpack10(data, samples, len / 5);
+	for(i = 0; i < len / 5 * 4; i++)
+		printf(" %x\t", samples[i]);
+}
 
+double host_ns(void)						//CLOCK_MONOTONIC, for records without a stamp;
+{
+	struct timespec t;
 
-	if((fdwr2 = open(argv[2],FLAG))== -1)			//Open header file (contains hex binary values);
-	{							//fdwr2-- file descriptor for header file;
-		perror("ERROR open()");
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+/*
+* With -c, appends the data of a completed read to the capture store: scans as
+* one record per channel, 10 bit reads unpacked. The data is the op's own reply
+* buffer, never the frame, which other ops in flight may share. A read without a
+* stamp is recorded at the host time it completed. board is the position of the
+* op's tty on the command line: the frames' BID is 0 on every board.
+*/
+void capture_read(const struct daq_op *op, int board)
+{
+	const unsigned char *hdr = op->frame, *data = op->reply;
+	uint16_t samples[FRAME_MAX / 5 * 4];
+	unsigned char column[FRAME_MAX];
+	struct column col[8];
+	double t = op->time_ns, bound = op->bound_ns;
+	int len = PAYLOAD_LEN(hdr), flags = CAP_STAMPED, i, k, n, r = 0;
+
+	if((cap == NULL) || (op->status != DAQ_DONE) || (data == NULL) || !IS_READ(hdr) ||
+		((hdr[3] & MODE_OP) == MODE_STATS))
+		return;
+	if(!op->stamped)
+	{
+		t = host_ns();
+		bound = 0;
+		flags = 0;
+	}
+	if((hdr[3] & MODE_OP) == MODE_SCAN)
+	{
+		n = scan_columns(data, hdr[5], col);
+		for(k = 0; k < n; k++)
+		{
+			for(i = 0; i < hdr[2]; i++)
+				column[i] = col[k].p[i * col[k].stride];
+			r |= cap_append(cap, board, col[k].channel, 1, column, hdr[2], t, bound, flags);
+		}
+	}
+	else if((hdr[3] & MODE_OP) == MODE_READ10)
+	{
+		unpack10(data, samples, len / 5);
+		r = cap_append(cap, board, 0, 2, samples, len / 5 * 4, t, bound, flags);
+	}
+	else
+		r = cap_append(cap, board, 0, 1, data, len, t, bound, flags);
+	if(r == -1)
+	{
+		perror("ERROR cap_append()");
 		exit(EXIT_FAILURE);
 	}
-	
-	while(1)
+}
+
+void capture_close(void)					//Syncs and closes the store, prints what it took;
+{
+	if(cap == NULL)
+		return;
+	printf("\ncapture: %lu records, %lu bytes, %lu new segments, %lu msync calls\n", cap->records, cap->bytes,
+		cap->segments, cap->syncs);
+	if(cap_close(cap) == -1)
+		perror("ERROR capture store");
+	cap = NULL;
+}
+
+void capture_op(struct mp_port *p, struct daq_op *op)	//Multi-port completions;
+{
+	capture_read(op, p->id);
+}
+
+/*
+* Maps the frame file and indexes the frames in it. A file holds any number of
+* frames back to back, each 8 header bytes, length payload bytes (also for
+* reads, where they are ignored) and the stop byte. The map is read only: read
+* data goes to the ops' reply buffers (see -c to keep it).
+* Returns 0 on success, -1 on error (errno set, or a message for a bad frame).
+*/
+int batch_load(const char *path, struct batch *b)
+{
+	struct stat sb;
+	unsigned char **idx;
+	size_t off = 0;
+	int fd, cap = 0;
+
+	memset(b, 0, sizeof(*b));
+	if((fd = open(path, FLAG)) == -1)
+		return -1;
+	if(fstat(fd, &sb) == -1)
 	{
-		do
-		{	
-			printf("\nPress Enter\n");			//Program is waiting for user input;
-			dt.enter = getchar();
-			lseek(fdwr2,0,SEEK_SET);			//Setting cursor position to 0(at the start of header;
-			if((r=read(fdwr2,fdata,8))== -1)		//Read first 8 bytes(header);
-			{
-				perror("ERROR read()");
-				exit(EXIT_FAILURE);	
-			} 	
-			printf("\nr=%d\n",r);				//Prints no.of bytes read;
-
-			for(i=0;i<8;i++)				//Storing the read contents in array;
-			{		
-				*(dt.array+i) = *(fdata+i);
-				printf(" %x\t", *(dt.array+i));
-			}		
-	
-			if((write(fdwr1,fdata,8)) == -1)		//Writting header bytes to ttyS0 file;
+		close(fd);
+		return -1;
+	}
+	if(sb.st_size < 9)					//Not even one frame;
+	{
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	b->size = sb.st_size;
+	b->map = mmap(NULL, b->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);						//The mapping keeps the file;
+	if(b->map == MAP_FAILED)
+		return -1;
+
+	while(off < b->size)
+	{
+		if((b->size - off < 9) || (b->map[off] != 0xFE) || (PAYLOAD_LEN(b->map + off) > FRAME_MAX) ||
+			(off + FRAME_LEN(b->map + off) > b->size) ||
+			(((b->map[off + 3] & MODE_OP) == MODE_COMPOUND) && (daq_reply_len(b->map + off) < 0)))
+		{
+			printf("\nBad frame %d at offset %zu\n", b->count, off);
+			munmap(b->map, b->size);
+			free(b->frame);
+			errno = EINVAL;
+			return -1;
+		}
+		if(b->count == cap)
+		{
+			cap = cap ? 2 * cap : 64;
+			if((idx = realloc(b->frame, cap * sizeof(*idx))) == NULL)
 			{
-				perror("ERROR write");
-				exit(EXIT_FAILURE);
+				munmap(b->map, b->size);
+				free(b->frame);
+				return -1;
 			}
-		
-			while((read(fdwr1,dt.ack,1)) == 0);		//Waiting for ACK;		
-			printf("\ncontent of ack:%x\n",dt.ack[0]);
-			if(dt.ack[0] == 0x0F)				//If ACK != 0x0f
-				printf("\nACK received\n");		//Prints error in communication;
-			else 
-				printf("\nError in communication\n");	
-		} while(dt.ack[0] != 0x0F);				//If ACK != 0x0f go back to the start; 
-
-		printf("\nEntering the switch\n");			//If ACK arrives correctly, control enters into switch statement;	
-		
-		switch(dt.array[3])					// Read or Write operations based on mode bits
-		{
-			default :					//default--Write mode;
-			{
-				lseek(fdwr2,8,SEEK_SET);		//Setting the file descriptor to after header bytes(after 8 bytes);
-
-				if((r=read(fdwr2,fdata,(dt.array[2]+1)))== -1)	//Read the data bytes a/c to length of Payload field+ stop bits;
-				{
-					perror("ERROR read()");
-					exit(EXIT_FAILURE);	
-				} 
-				
-				printf("\nWrite data:\n");
-				
-				for(i=0;i<(dt.array[2]+1);i++)
-				{		
-					printf(" %x\t", *(fdata+i));
-				}
-
-				if((write(fdwr1,fdata,(dt.array[2]+1))) == -1)	//Write the data bytes a/c to length of Payload field+ stop bits;
-				{
-					perror("ERROR write");
-					exit(EXIT_FAILURE);
-				}
-				
-				printf("\nwrite is over\n");			//Prints write is over;
-
-				while((read(fdwr1,dt.ack,1)) == 0);		//Waiting for ACK;
-
-				printf("\ncontent of ack:%x\n",dt.ack[0]);	//Prints contents of ACK received;
-				
-				if(dt.ack[0] == 0xf0)				//If ACK == 0xf0, Stop bits error and prints error in stop bits;
-				{
-					printf("\nError in Stop bits\n");
-					break;
-				}
-				printf("\nsuccess\n");				//prints success if everything is perfect in write operation;				
-				break;		
-			}							//default case ends;
-
-			case 1:							//case 1-- Read mode;
-			{				
-				while((r=read(fdwr1,fdata,(dt.array[2])))== 0);	// waiting for Data bytes;
-				
-				if(r == -1)
-				{
-					perror("ERROR read()");
-					exit(EXIT_FAILURE);
-				} 
-				
-				printf("\nread data:\n");			// Prints read contents(ADC values);
-
-				for(i=0;i<(dt.array[2]);i++)
-				{
-					printf(" %x\t", *(fdata+i));
-				}
-								
-				if((write(fdwr2,fdata,(dt.array[2]))) == -1)	//Write the read contents into header file;
-				{
-					perror("ERROR write");
-					exit(EXIT_FAILURE);
-				}
-				printf("\ndata read success\n");		//Prints read success;
-						
-				if((r=read(fdwr2,fdata,1)) == -1)		//Read the stop bits;
-				{
-					perror("ERROR read()");
-					exit(EXIT_FAILURE);
-				} 
-
-				printf("\nStop bits: %x\n",*fdata);
-
-				if((write(fdwr1,fdata,1)) == -1)		//Sending stop bits;
-				{
-					perror("ERROR write");
-					exit(EXIT_FAILURE);
-				}
-			
-				while((read(fdwr1,dt.ack,1)) == 0);		//Waiting for ACK;
-
-				printf("\ncontent of ack:%x\n",dt.ack[0]);	//Prints contents of ACK received;
-				
-				if(dt.ack[0] == 0xf0)				//If ACK == 0xf0, Stop bits error and prints error in stop bits;
-				{
-					printf("\nError in Stop bits\n");					
-					break;
-				}
-				
-				printf("\nsuccess\n");				//In read operation, of everything is success, prints success;
-				break;			
-			}							//case 1 -- ends
-		}								//Switch case ends
-	}					
-	exit(EXIT_SUCCESS);
-	//	while ends
+			b->frame = idx;
+		}
+		b->frame[b->count++] = b->map + off;
+		off += FRAME_LEN(b->map + off);
+	}
+	return 0;
+}
+
+/*
+* Frames that go out more than once (replays longer than the file, every Enter)
+* are kept encoded by the library; with more than its cache holds, later frames
+* take the place of earlier ones.
+*/
+void cache_frames(struct daq *dq, unsigned char **frame, int n)
+{
+	int k;
+
+	for(k = 0; k < n; k++)
+		daq_cache_frame(dq, frame[k]);
+}
+
+/*
+* With -N: prints the firmware capabilities and moves the line to the fastest
+* rate up to max_baud (0 = any) that passes the probe. Firmware without HELLO
+* is left at the -b rate.
+*/
+void link_setup(struct daq *dq, long max_baud)
+{
+	const struct daq_stats *st = daq_stats(dq);
+	struct daq_hello h;
+	long baud;
+	int k;
+
+	if((baud = daq_negotiate(dq, &h, max_baud)) == -1)
+	{
+		if(errno != EPROTO)
+		{
+			perror("ERROR negotiate");
+			exit(EXIT_FAILURE);
+		}
+		printf("\nfirmware has no HELLO, staying at %ld baud\n", cfg.baud);
+		return;
+	}
+	printf("\nfirmware: protocol %d, window %d, payload %d, ops 0x%04x, flags 0x%02x, cobs %s, profile %s\nrates:",
+		h.version, h.window, h.max_payload, h.ops, h.flags, h.features & 0x01 ? "yes" : "no",
+		h.features & 0x02 ? "yes" : "no");
+	for(k = 0; k < h.nrates; k++)
+		printf(" %ld", h.rates[k]);
+	printf("\nline: %ld -> %ld baud (%lu rates probed, %lu failed)\n", cfg.baud, baud, st->probes,
+		st->probe_failures);
+	cfg.baud = baud;
+}
+
+/*
+* Prints a completed op: its header and, for reads, the data and its stamp.
+*/
+void print_op(const struct daq_op *op, long i)
+{
+	const unsigned char *hdr = op->frame;
+	int k;
+
+	printf("\nframe %ld:", i);
+	for(k = 0; k < 8; k++)
+		printf(" %x\t", hdr[k]);
+	if(op->status != DAQ_DONE)
+	{
+		printf("\nfailed: %s\n", strerror(op->err));
+		return;
+	}
+	if(IS_READ(hdr))
+	{
+		printf("\nread data:\n");				// Prints read contents(ADC values);
+		print_read(hdr, op->reply, PAYLOAD_LEN(hdr));
+		if(op->stamped)
+			print_stamp(op->time_ns, op->bound_ns);
+	}
+	else if(((hdr[3] & MODE_OP) == MODE_COMPOUND) && (daq_reply_len(hdr) > 0))
+	{
+		printf("\nreply data:\n");				// Read sub-operations, in order;
+		for(k = 0; k < daq_reply_len(hdr); k++)
+			printf(" %x\t", op->reply[k]);
+		if(op->stamped)
+			print_stamp(op->time_ns, op->bound_ns);
+	}
+	printf("\nsuccess\n");
+}
+
+/*
+* Runs count frames of the frame file through the library, frame i being
+* b->frame[i % b->count], at rate frames/s (0 = as fast as the line allows), and
+* prints every frame as it completes. Ops are taken round robin from a fixed
+* array, each with its own reply buffer, so at most DAQ_QUEUE are queued at a
+* time; ops replaying the same frame share it.
+* Returns the number of frames that failed.
+*/
+int run(struct daq *dq, struct batch *b, int count, double rate)
+{
+	static struct daq_op ops[DAQ_QUEUE];
+	static unsigned char reply[DAQ_QUEUE][FRAME_MAX];	//Read data of ops[k];
+	struct daq_op *batch[DAQ_QUEUE], *done[1];
+	struct timespec t0;
+	long long start;
+	long wire = daq_stats(dq)->wire;
+	int sent = 0, completed = 0, failed = 0, k;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	start = daq_now_ms();
+	while(completed < count)
+	{
+		for(k = 0; (sent < count) && (sent - completed < DAQ_QUEUE); k++, sent++)
+		{
+			batch[k] = &ops[sent % DAQ_QUEUE];
+			batch[k]->frame = b->frame[sent % b->count];
+			batch[k]->reply = reply[sent % DAQ_QUEUE];
+			batch[k]->due = rate > 0 ? start + (long long)(sent * 1000.0 / rate) : 0;
+			batch[k]->user = (void *)(long)sent;
+		}
+		daq_submit_batch(dq, batch, k);
+		if(daq_poll_completions(dq, done, 1) == -1)	//One at a time, printed as it completes;
+		{
+			perror("ERROR daq_poll_completions()");
+			exit(EXIT_FAILURE);
+		}
+		if(!quiet || (done[0]->status != DAQ_DONE))
+			print_op(done[0], (long)done[0]->user);
+		capture_read(done[0], 0);			//The only tty;
+		export_metrics(dq, 0);
+		failed += done[0]->status != DAQ_DONE;
+		completed++;
+	}
+	report_rate(&t0, daq_stats(dq)->wire - wire, cfg.baud);
+	return failed;
+}
+
+/*
+* Streaming mode: starts continuous acquisition at rate Hz in blocks of the
+* frame file's payload length, receives count packets and stops the stream.
+*/
+int stream_transfer(struct daq *dq, const unsigned char *hdr, unsigned long rate, int count)
+{
+	struct daq_packet p;
+	struct timespec t0;
+	unsigned char seq = 0;
+	unsigned long lost = 0, gaps = 0, corrupt = 0;
+	long wire = daq_stats(dq)->wire;
+	int i, r, got = 0;
+
+	if(hdr[2] == 0)
+	{
+		printf("\nStream block size (payload length) must not be 0\n");
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if(daq_stream_start(dq, hdr[1], rate, hdr[2]) == -1)
+	{
+		printf("\nStream start failed: %s\n", strerror(errno));
+		return -1;
+	}
+	while(got < count)
+	{
+		if(daq_stream_next(dq, &p) == -1)
+		{
+			printf("\nStream lost\n");
+			break;
+		}
+		got++;
+		export_metrics(dq, 0);
+		if(p.corrupt)					//Samples dropped, numbering goes on;
+		{
+			corrupt++;
+			if(!quiet)
+				printf("\npacket with CRC error\n");
+			continue;
+		}
+		if(p.seq != seq)
+			gaps++;
+		seq = p.seq + 1;
+		lost += p.lost;
+		if(!quiet)
+		{
+			printf("\npacket %u (%d samples, %u lost):\n", p.seq, p.n, p.lost);
+			for(i = 0; i < p.n; i++)
+				printf(" %x\t", p.samples[i]);
+			if(p.stamped)
+				print_stamp(p.time_ns, p.bound_ns);
+		}
+		if((cap != NULL) && (cap_append(cap, 0, 0, 1, p.samples, p.n, p.stamped ? p.time_ns : host_ns(),
+			p.stamped ? p.bound_ns : 0, (p.stamped ? CAP_STAMPED : 0) | (p.lost ? CAP_LOST : 0)) == -1))
+		{
+			perror("ERROR cap_append()");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	r = daq_stream_stop(dq);				//Stop, then drain packets until the ACK;
+	printf("\n%d packets, %lu samples lost, %lu packets missing, %lu corrupt, stop %s\n", got, lost, gaps,
+		corrupt, r == 0 ? "acknowledged" : "rejected");
+	report_rate(&t0, daq_stats(dq)->wire - wire, cfg.baud);
+	return r;
+}
+
+/*
+* Multi-port replay: runs count frames of the frame file on each of the nports
+* ttys, the ports sharded across workers threads (pinned to CPUs with pin). The
+* ports share the mapped frames; read data is not printed (use -c to keep it). The run prints one line per port and per worker; with -m the ports'
+* stats are exported while it runs.
+* Returns the number of frames that failed, -1 on error.
+*/
+int multi_run(char **tty, int nports, int workers, int pin, int count, double rate)
+{
+	struct mp_port *port;
+	struct mp_worker w[MP_WORKERS_MAX];
+	struct ports ps;
+	long long start, ms;
+	long tick_ms;
+	long frames = 0, failed = 0;
+	int i, k, r = -1;
+
+	port = calloc(nports, sizeof(*port));
+	ps.name = calloc(nports, sizeof(*ps.name));
+	ps.st = calloc(nports, sizeof(*ps.st));
+	if((port == NULL) || (ps.name == NULL) || (ps.st == NULL))
+	{
+		free(port);
+		free(ps.name);
+		free(ps.st);
+		return -1;
+	}
+	for(i = 0; i < nports; i++)
+	{
+		port[i].tty = ps.name[i] = tty[i];
+		port[i].id = i;
+		ps.st[i] = &port[i].snap;
+		port[i].frame = bt.frame;
+		port[i].count = bt.count;
+		port[i].total = count;
+		port[i].complete = cap != NULL ? capture_op : NULL;
+		if((port[i].dq = daq_open(tty[i], &cfg)) == NULL)
+		{
+			printf("\n%s: %s\n", tty[i], strerror(errno));
+			goto out;
+		}
+		if(count > bt.count)
+			cache_frames(port[i].dq, port[i].frame, bt.count);
+		if(cfg.ts && (daq_clock_sync(port[i].dq, CLOCK_BURST) == -1))
+		{
+			printf("\n%s: %s\n", tty[i], strerror(errno));
+			goto out;
+		}
+	}
+
+	start = daq_now_ms();
+	tick_ms = (mx != NULL) && (mx->period_ms < SERVE_MS) ? mx->period_ms : SERVE_MS;
+	if(mp_run(port, nports, w, workers, rate, pin, mx != NULL ? export_ports : NULL, &ps, tick_ms) == -1)
+	{
+		perror("ERROR mp_run()");
+		goto out;
+	}
+	ms = daq_now_ms() - start + 1;
+	for(i = 0; i < nports; i++)
+	{
+		printf("\nport %s: %ld frames, %ld failed, %.1f frames/s", port[i].tty, port[i].done, port[i].failed,
+			port[i].done * 1000.0 / (port[i].elapsed_ms + 1));
+		if(port[i].err)
+			printf(", stopped: %s", strerror(port[i].err));
+	}
+	printf("\n");
+	for(k = 0; k < workers; k++)
+	{
+		printf("\nworker %d (cpu %d): %d ports, %lu frames, %lu failed, %ld bytes, %lu wakeups, %.3f s cpu",
+			k, w[k].cpu, w[k].nports, w[k].frames, w[k].failed, w[k].wire, w[k].wakeups, w[k].cpu_s);
+		if(w[k].err)
+			printf(", not started: %s", strerror(w[k].err));
+		frames += w[k].frames;
+		failed += w[k].failed;
+	}
+	printf("\n\n%d ports, %d workers: %ld frames, %ld failed, %.1f frames/s\n", nports, workers, frames, failed,
+		frames * 1000.0 / ms);
+	r = failed;
+
+out:
+	for(i = 0; i < nports; i++)
+		daq_close(port[i].dq);
+	free(port);
+	free(ps.name);
+	free(ps.st);
+	return r;
 }
 
+int main(int argc,char *argv[])
+{
+	struct daq *dq;
+	long long start;
+	int opt, failed, nports;
+	int count = 0;
+	int workers = 0, pin = 0;				//-j: multi-port worker threads, -A: pin them;
+	int prof = 0;						//-P: firmware profile of every run;
+	int usage_error = 0;					//An option value out of range;
+	long negotiate = -1;					//-N: fastest rate up to this one, 0 = any;
+	const char *capdir = NULL, *metrics = NULL;
+	long period_ms = 1000;					//-M: between metrics snapshots;
+	unsigned long rate = 0;					//Stream sample rate, 0 = no streaming;
+	double replay_rate = -1;				//Frames/s for -R, -1 = prompt for every transaction;
+	long long idle;						//daq_now_ms() when the prompt came up;
+	char enter;
 
+	while((opt = getopt(argc, argv, "b:w:n:t:r:S:R:CTFj:Ac:qm:M:PN:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'b':				//Line rate, must match the firmware;
+				cfg.baud = strtol(optarg, NULL, 10);
+				break;
+			case 'w':				//Frames in flight, 0 = stop-and-wait;
+				cfg.window = atoi(optarg);
+				break;
+			case 'n':				//Frames per Enter / replay, packets in streaming mode;
+				count = atoi(optarg);
+				break;
+			case 't':				//Timeout per protocol phase (ms);
+				cfg.timeout_ms = atol(optarg);
+				break;
+			case 'r':				//Retries before a transaction fails;
+				cfg.retries = atoi(optarg);
+				break;
+			case 'S':				//Stream at this sample rate (Hz);
+				rate = strtoul(optarg, NULL, 10);
+				if((rate == 0) || (rate > STREAM_MAX_RATE))
+					usage_error = 1;
+				break;
+			case 'R':				//Replay the frame file at this many frames/s, 0 = full speed;
+				replay_rate = strtod(optarg, NULL);
+				if(replay_rate < 0)
+					usage_error = 1;
+				break;
+			case 'C':				//CRC-16 in r3:r4 of every frame and after read data;
+				cfg.crc = 1;
+				break;
+			case 'T':				//Stamp read data and stream packets with host time;
+				cfg.ts = 1;
+				break;
+			case 'F':				//COBS framing, windowed mode only;
+				cfg.cobs = 1;
+				break;
+			case 'j':				//Replay on every tty, across this many threads;
+				workers = atoi(optarg);
+				if((workers < 1) || (workers > MP_WORKERS_MAX))
+					usage_error = 1;
+				break;
+			case 'A':				//Pin worker k to CPU k;
+				pin = 1;
+				break;
+			case 'c':				//Append read data and stream packets to this capture store;
+				capdir = optarg;
+				break;
+			case 'q':				//Quiet: no read data, stream samples or per-frame lines;
+				quiet = 1;
+				break;
+			case 'm':				//Export stats to this file, or unix:path socket;
+				metrics = optarg;
+				break;
+			case 'M':				//Metrics snapshot period (ms);
+				period_ms = atol(optarg);
+				if(period_ms < 1)
+					usage_error = 1;
+				break;
+			case 'P':				//Clear the firmware profile before a run, print it after;
+				prof = 1;
+				break;
+			case 'N':				//Negotiate the fastest rate up to this one (0 = any);
+				negotiate = strtol(optarg, NULL, 10);
+				if(negotiate < 0)
+					usage_error = 1;
+				break;
+			default:
+				usage_error = 1;
+				break;
+		}
+	}
+
+	nports = argc - optind - 1;				//Several ttys: multi-port replay;
+	if((nports > 1) && (workers == 0))
+		workers = 1;
+	if(usage_error || (nports < 1) || (cfg.window < 0) || (cfg.window > WINDOW_MAX) || (count < 0) ||
+		(cfg.timeout_ms < 1) || (cfg.retries < 0) || (cfg.retries > 255) || (cfg.cobs && (cfg.window == 0)) ||
+		(workers && ((replay_rate < 0) || (rate > 0) || prof || (negotiate >= 0))) ||
+		((negotiate >= 0) && (replay_rate > 0) && (replay_rate * BAUD_IDLE_MS < 1000)))
+	{
+		printf("ERROR Usage: %s [-b baud] [-w window(0-%d)] [-n count] [-t timeout_ms] [-r retries] [-S rate] [-R frames/s] [-C] [-T] [-F] [-c capture dir] [-q] [-m file|unix:path] [-M period_ms] [-P] [-N max_baud] <tty> <wrFile>\n"
+			"       %s -R frames/s [-j workers] [-A] [options] <tty> [<tty>...] <wrFile>\n",
+			argv[0], WINDOW_MAX, argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	if(batch_load(argv[argc - 1], &bt) == -1)		//Map the frame file (contains hex binary values);
+	{
+		perror("ERROR frame file");
+		exit(EXIT_FAILURE);
+	}
+	cfg.board = bt.frame[0][1] & 0xFC;			//Clock exchanges go to the file's board;
+	if((capdir != NULL) && ((cap = cap_open(capdir, 0, 0)) == NULL))
+	{
+		perror("ERROR capture store");
+		exit(EXIT_FAILURE);
+	}
+	if((metrics != NULL) && ((mx = metrics_open(metrics, period_ms)) == NULL))
+	{
+		perror("ERROR metrics");
+		exit(EXIT_FAILURE);
+	}
+	tty = argv[optind];
+	if(workers)
+	{
+		failed = multi_run(argv + optind, nports, workers, pin, count ? count : bt.count, replay_rate);
+		capture_close();
+		metrics_close(mx);
+		exit(failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	if((dq = daq_open(argv[optind], &cfg)) == NULL)		//Open ttyS0, raw 8N1 at the requested rate;
+	{
+		perror("ERROR daq_open()");
+		exit(EXIT_FAILURE);
+	}
+	if(negotiate >= 0)
+		link_setup(dq, negotiate);
+	if(count == 0)						//Default: one transaction, or the whole file on replay;
+		count = ((replay_rate >= 0) && (rate == 0)) ? bt.count : 1;
+	if((rate == 0) && ((replay_rate < 0) || (count > bt.count)))
+		cache_frames(dq, bt.frame, bt.count);
+
+	if(replay_rate >= 0)					//Replay without prompting;
+	{
+		clock_sync(dq, CLOCK_BURST);
+		if(prof)
+			profile(dq, 1);
+		if(rate > 0)
+			failed = stream_transfer(dq, bt.frame[0], rate, count) != 0;
+		else
+		{
+			start = daq_now_ms();
+			failed = run(dq, &bt, count, replay_rate);
+			printf("\n%d frames replayed, %d failed, %.1f frames/s\n", count, failed,
+				count * 1000.0 / (daq_now_ms() - start + 1));
+		}
+		clock_sync(dq, CLOCK_BURST);
+		print_stats(dq);
+		if(prof)
+			profile(dq, 0);
+		export_metrics(dq, 1);
+		daq_close(dq);
+		capture_close();
+		metrics_close(mx);
+		exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	while(1)
+	{
+		printf("\nPress Enter\n");				//Program is waiting for user input;
+		idle = daq_now_ms();
+		if((enter = getchar()) == EOF)
+			break;
+		if((negotiate >= 0) && (daq_now_ms() - idle >= BAUD_IDLE_MS / 2))	//The board may be back at its start rate;
+			link_setup(dq, negotiate);
+		clock_sync(dq, CLOCK_BURST);
+		if(prof)
+			profile(dq, 1);
+		if(rate > 0)						//Streaming mode, -n packets;
+			stream_transfer(dq, bt.frame[0], rate, count);
+		else							//Every frame in the file (stop-and-wait) or -n frames (windowed);
+			run(dq, &bt, cfg.window > 0 ? count : bt.count, 0);
+		print_stats(dq);
+		if(prof)
+			profile(dq, 0);
+		export_metrics(dq, 1);
+	}
+	daq_close(dq);
+	capture_close();
+	metrics_close(mx);
+	exit(EXIT_SUCCESS);
+}
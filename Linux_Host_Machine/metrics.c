@@ -0,0 +1,207 @@
+/*
+* Snapshots are rendered into one buffer, metric family by metric family with
+* a label per port, and published in one step: a file is written beside the
+* target and renamed over it, a socket serves the buffer until the next one.
+*/
+
+#define _GNU_SOURCE
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdarg.h>
+#include<unistd.h>
+#include<string.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<sys/socket.h>
+#include<sys/un.h>
+
+#include "metrics.h"
+
+static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+static void put(struct metrics *m, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+	char *b;
+
+	while(1)
+	{
+		va_start(ap, fmt);
+		n = vsnprintf(m->buf + m->len, m->cap - m->len, fmt, ap);
+		va_end(ap);
+		if(n < 0)
+			return;
+		if(m->len + n < m->cap)
+		{
+			m->len += n;
+			return;
+		}
+		if((b = realloc(m->buf, 2 * m->cap + n)) == NULL)
+			return;
+		m->buf = b;
+		m->cap = 2 * m->cap + n;
+	}
+}
+
+struct metrics *metrics_open(const char *target, long period_ms)
+{
+	struct metrics *m;
+	struct sockaddr_un sa;
+	int unix_sock = strncmp(target, "unix:", 5) == 0, e;
+
+	if((period_ms < 1) || (unix_sock && (strlen(target + 5) >= sizeof(sa.sun_path))))
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	if((m = calloc(1, sizeof(*m))) == NULL)
+		return NULL;
+	m->sock = -1;
+	m->period_ms = period_ms;
+	m->cap = 4096;
+	if(((m->path = strdup(unix_sock ? target + 5 : target)) == NULL) || ((m->buf = malloc(m->cap)) == NULL))
+		goto fail;
+	if(unix_sock)
+	{
+		memset(&sa, 0, sizeof(sa));
+		sa.sun_family = AF_UNIX;
+		strcpy(sa.sun_path, m->path);
+		unlink(m->path);					//Left by an earlier run;
+		if(((m->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) ||
+			(bind(m->sock, (struct sockaddr *)&sa, sizeof(sa)) == -1) || (listen(m->sock, 8) == -1))
+			goto fail;
+	}
+	return m;
+
+fail:
+	e = errno;
+	if(m->sock != -1)
+		close(m->sock);
+	free(m->path);
+	free(m->buf);
+	free(m);
+	errno = e;
+	return NULL;
+}
+
+int metrics_due(struct metrics *m)
+{
+	return daq_now_ms() >= m->next;
+}
+
+#define COUNTER(name, help, field) do { \
+	put(m, "# HELP " name " " help "\n# TYPE " name " counter\n"); \
+	for(i = 0; i < n; i++) \
+		put(m, name "{port=\"%s\"} %lu\n", port[i], (unsigned long)st[i]->field); \
+} while(0)
+
+/*
+* Renders a snapshot of n ports and publishes it. Returns 0, -1 on error (the
+* previous snapshot stays).
+*/
+int metrics_write(struct metrics *m, const char *const *port, const struct daq_stats *const *st, int n)
+{
+	const struct hist *h;
+	char tmp[4096];
+	int i, k, q, fd, ok;
+
+	m->len = 0;
+	m->next = daq_now_ms() + m->period_ms;
+	COUNTER("daq_frames_total", "Operations completed.", frames);
+	COUNTER("daq_failures_total", "Operations that ran out of retries.", failures);
+	COUNTER("daq_nacks_total", "NACKs received.", nacks);
+	COUNTER("daq_retries_total", "Frames sent again.", retries);
+	COUNTER("daq_crc_errors_total", "Replies with a bad CRC.", crc_errors);
+	COUNTER("daq_dropped_total", "COBS framed replies that lost bytes.", dropped);
+	COUNTER("daq_wire_bytes_total", "Bytes on the line, both directions.", wire);
+	COUNTER("daq_payload_bytes_total", "Payload bytes of the operations completed.", payload);
+	COUNTER("daq_encoded_total", "Frame headers encoded in full, not from the cache.", encoded);
+	COUNTER("daq_probes_total", "Faster line rates probed.", probes);
+	COUNTER("daq_probe_failures_total", "Line rates that failed the probe.", probe_failures);
+
+	put(m, "# HELP daq_syscalls_total System calls of the engine.\n# TYPE daq_syscalls_total counter\n");
+	for(i = 0; i < n; i++)
+		put(m, "daq_syscalls_total{port=\"%s\",call=\"read\"} %lu\ndaq_syscalls_total{port=\"%s\",call=\"write\"} %lu\n"
+			"daq_syscalls_total{port=\"%s\",call=\"poll\"} %lu\ndaq_syscalls_total{port=\"%s\",call=\"ioctl\"} %lu\n",
+			port[i], st[i]->reads, port[i], st[i]->writes, port[i], st[i]->polls, port[i], st[i]->ioctls);
+
+	put(m, "# HELP daq_timeouts_total Protocol phases that timed out.\n# TYPE daq_timeouts_total counter\n");
+	for(i = 0; i < n; i++)
+		for(k = 0; k < PHASES; k++)
+			put(m, "daq_timeouts_total{port=\"%s\",phase=\"%s\"} %lu\n", port[i], daq_latency_name[k],
+				st[i]->timeouts[k]);
+
+	put(m, "# HELP daq_latency_seconds Latency per protocol phase and per operation.\n"
+		"# TYPE daq_latency_seconds summary\n");
+	for(i = 0; i < n; i++)
+		for(k = 0; k < LATENCIES; k++)
+		{
+			h = &st[i]->latency[k];
+			for(q = 0; q < (int)(sizeof(quantiles) / sizeof(quantiles[0])); q++)
+				put(m, "daq_latency_seconds{port=\"%s\",phase=\"%s\",quantile=\"%g\"} %.9f\n", port[i],
+					daq_latency_name[k], quantiles[q], hist_quantile(h, quantiles[q]) / 1e9);
+			put(m, "daq_latency_seconds_sum{port=\"%s\",phase=\"%s\"} %.9f\n", port[i], daq_latency_name[k],
+				h->sum / 1e9);
+			put(m, "daq_latency_seconds_count{port=\"%s\",phase=\"%s\"} %lu\n", port[i], daq_latency_name[k],
+				(unsigned long)h->n);
+		}
+	put(m, "# HELP daq_latency_max_seconds Largest latency seen.\n# TYPE daq_latency_max_seconds gauge\n");
+	for(i = 0; i < n; i++)
+		for(k = 0; k < LATENCIES; k++)
+			put(m, "daq_latency_max_seconds{port=\"%s\",phase=\"%s\"} %.9f\n", port[i], daq_latency_name[k],
+				st[i]->latency[k].max / 1e9);
+	m->snapshots++;
+
+	if(m->sock != -1)
+		return metrics_serve(m);
+	if(snprintf(tmp, sizeof(tmp), "%s.tmp", m->path) >= (int)sizeof(tmp))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	if((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+		return -1;
+	ok = write(fd, m->buf, m->len) == (ssize_t)m->len;
+	if((close(fd) == -1) || !ok || (rename(tmp, m->path) == -1))
+	{
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+* Sends the latest snapshot to every scraper waiting on the socket. Never
+* blocks; a scraper that does not take the snapshot at once gets what fits.
+*/
+int metrics_serve(struct metrics *m)
+{
+	int fd;
+
+	if(m->sock == -1)
+		return 0;
+	while((fd = accept4(m->sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+	{
+		if(write(fd, m->buf, m->len) != (ssize_t)m->len)
+			m->short_writes++;				//Scraper too slow or gone;
+		close(fd);
+		m->scrapes++;
+	}
+	return (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == ECONNABORTED) ? 0 : -1;
+}
+
+void metrics_close(struct metrics *m)
+{
+	if(m == NULL)
+		return;
+	if(m->sock != -1)
+	{
+		close(m->sock);
+		unlink(m->path);
+	}
+	free(m->path);
+	free(m->buf);
+	free(m);
+}
@@ -0,0 +1,29 @@
+/*
+* Exports libdaq counters and latency histograms in the Prometheus text format,
+* to a file (replaced atomically, e.g. for the node_exporter textfile collector)
+* or to a Unix socket (unix:/path) that answers every connection with the latest
+* snapshot and closes it.
+*/
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "libdaq.h"
+
+struct metrics
+{
+	char *path;
+	int sock;						//Listening socket, -1 when writing a file;
+	long period_ms;
+	long long next;						//daq_now_ms() of the next snapshot;
+	char *buf;						//Latest snapshot;
+	size_t len, cap;
+	unsigned long snapshots, scrapes, short_writes;
+};
+
+struct metrics *metrics_open(const char *target, long period_ms);	//NULL on error, errno set;
+int metrics_due(struct metrics *m);					//1 once period_ms have passed;
+int metrics_write(struct metrics *m, const char *const *port, const struct daq_stats *const *st, int n);
+int metrics_serve(struct metrics *m);					//Answers waiting scrapers;
+void metrics_close(struct metrics *m);
+
+#endif
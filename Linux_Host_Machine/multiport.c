@@ -0,0 +1,296 @@
+/*
+* Multi-port runner. A worker registers the tty of each of its ports with its
+* epoll instance for the events the port's handle waits for (daq_events()), and
+* sleeps in epoll_wait() until one is ready or the nearest deadline of its ports
+* passes. A port that is serviced runs its state machine, hands the completed
+* ops back and is refilled up to DAQ_QUEUE queued ops. Clock exchanges (cfg.ts)
+* block the worker for the ~15 bytes of the exchange.
+*
+* With a tick, every period_ms a worker copies its ports' stats into port->snap
+* under the run's lock, and the calling thread runs tick() with the lock held
+* while it waits for the workers.
+*/
+
+#define _GNU_SOURCE
+#include<stdlib.h>
+#include<unistd.h>
+#include<string.h>
+#include<errno.h>
+#include<limits.h>
+#include<time.h>
+#include<poll.h>
+#include<sched.h>
+#include<sys/epoll.h>
+
+#include "multiport.h"
+
+#define MP_EVENTS 64						//epoll events per wakeup;
+
+struct run
+{
+	pthread_mutex_t lock;					//Snapshots and finished;
+	pthread_cond_t cond;					//Signalled by a finishing worker;
+	int finished;
+};
+
+static double thread_cpu_s(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/*
+* Queues the port's next ops until its queue is full or all have been sent.
+* Returns the number queued.
+*/
+static int refill(struct mp_port *p, long long start, double rate)
+{
+	struct daq_op *batch[DAQ_QUEUE], *op;
+	int k;
+
+	for(k = 0; (p->sent + k < p->total) && (daq_pending(p->dq) + k < DAQ_QUEUE); k++)
+	{
+		op = batch[k] = &p->ops[(p->sent + k) % DAQ_QUEUE];
+		op->frame = p->frame[(p->sent + k) % p->count];
+		op->reply = p->reply[(p->sent + k) % DAQ_QUEUE];
+		op->due = rate > 0 ? start + (long long)((p->sent + k) * 1000.0 / rate) : 0;
+	}
+	if(k == 0)
+		return 0;
+	k = daq_submit_batch(p->dq, batch, k);			//Frames were checked by the caller;
+	p->sent += k > 0 ? k : 0;
+	return k;
+}
+
+static void publish(struct mp_worker *w)			//Snapshots of the worker's ports;
+{
+	struct run *r = w->run;
+	int i;
+
+	pthread_mutex_lock(&r->lock);
+	for(i = 0; i < w->nports; i++)
+		w->port[i]->snap = *daq_stats(w->port[i]->dq);
+	pthread_mutex_unlock(&r->lock);
+}
+
+/*
+* Registers port i of the worker with epoll for the events its handle waits for
+* now. Returns the deadline of the handle.
+*/
+static long long arm(int epfd, struct mp_port *p, int i)
+{
+	struct epoll_event ev;
+	long long deadline;
+	int e = daq_events(p->dq, &deadline);
+
+	ev.events = (e & POLLIN ? EPOLLIN : 0) | (e & POLLOUT ? EPOLLOUT : 0);
+	ev.data.u32 = i;
+	if(ev.events != (unsigned int)p->events)
+	{
+		epoll_ctl(epfd, p->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, daq_fd(p->dq), &ev);
+		p->events = ev.events;
+	}
+	return deadline;
+}
+
+/*
+* Runs the port's state machine, collects its completed ops and refills it.
+* Returns 1 while the port has ops left, 0 once it is finished or failed.
+*/
+static int service(struct mp_worker *w, struct mp_port *p, long long start)
+{
+	struct daq_op *done[DAQ_QUEUE];
+	int n, k;
+
+	do
+	{
+		if(daq_process(p->dq) == -1)
+		{
+			p->err = errno;
+			return 0;
+		}
+		n = daq_reap(p->dq, done, DAQ_QUEUE);
+		for(k = 0; k < n; k++)
+		{
+			p->failed += done[k]->status != DAQ_DONE;
+			if(p->complete != NULL)
+				p->complete(p, done[k]);
+		}
+		p->done += n;
+		w->frames += n;
+	}while(refill(p, start, w->rate) > 0);
+	if(p->done < p->total)
+		return 1;
+	p->elapsed_ms = daq_now_ms() - start;
+	return 0;
+}
+
+static void *worker(void *arg)
+{
+	struct mp_worker *w = arg;
+	struct epoll_event ev[MP_EVENTS];
+	struct mp_port *p;
+	long long start, now, next, snap, *deadline;
+	char *state;						//Per port: 0 finished, 1 running, 2 tty ready;
+	double cpu0;
+	cpu_set_t set;
+	int epfd, i, n, active = 0;
+
+	if(w->cpu >= 0)
+	{
+		CPU_ZERO(&set);
+		CPU_SET(w->cpu, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);	//Best effort;
+	}
+	deadline = calloc(w->nports, sizeof(*deadline));
+	state = calloc(w->nports, 1);
+	if((deadline == NULL) || (state == NULL) || ((epfd = epoll_create1(0)) == -1))
+	{
+		w->err = errno;
+		free(deadline);
+		free(state);
+		goto out;
+	}
+	cpu0 = thread_cpu_s();
+	start = snap = daq_now_ms();
+	for(i = 0; i < w->nports; i++)
+	{
+		p = w->port[i];
+		p->events = 0;
+		if((state[i] = service(w, p, start)))
+		{
+			deadline[i] = arm(epfd, p, i);
+			active++;
+		}
+	}
+
+	while(active > 0)
+	{
+		next = LLONG_MAX;
+		for(i = 0; i < w->nports; i++)
+			if(state[i] && (deadline[i] < next))
+				next = deadline[i];
+		now = daq_now_ms();
+		if(w->period_ms && (now >= snap))
+		{
+			publish(w);
+			snap = now + w->period_ms;
+		}
+		if(w->period_ms && (snap < next))
+			next = snap;
+		n = epoll_wait(epfd, ev, MP_EVENTS, next == LLONG_MAX ? -1 : (next <= now ? 0 :
+			(next - now > INT_MAX ? INT_MAX : next - now)));
+		w->wakeups++;
+		for(i = 0; i < n; i++)
+			state[ev[i].data.u32] = 2;
+		now = daq_now_ms();
+		for(i = 0; i < w->nports; i++)				//Ready ports and ports past their deadline;
+		{
+			p = w->port[i];
+			if((state[i] == 0) || ((state[i] == 1) && (deadline[i] > now)))
+				continue;
+			if((state[i] = service(w, p, start)))
+				deadline[i] = arm(epfd, p, i);
+			else
+			{
+				epoll_ctl(epfd, EPOLL_CTL_DEL, daq_fd(p->dq), NULL);
+				active--;
+			}
+		}
+	}
+
+	for(i = 0; i < w->nports; i++)
+	{
+		w->failed += w->port[i]->failed;
+		w->wire += daq_stats(w->port[i]->dq)->wire;
+	}
+	w->cpu_s = thread_cpu_s() - cpu0;
+	close(epfd);
+	free(deadline);
+	free(state);
+	if(w->period_ms)
+		publish(w);
+
+out:
+	pthread_mutex_lock(&((struct run *)w->run)->lock);
+	((struct run *)w->run)->finished++;
+	pthread_cond_signal(&((struct run *)w->run)->cond);
+	pthread_mutex_unlock(&((struct run *)w->run)->lock);
+	return NULL;
+}
+
+/*
+* Runs every port's ops on nworkers threads, port i on worker i % nworkers,
+* rate frames/s per port (0 = as fast as the line allows). With pin, worker k is
+* pinned to CPU k modulo the CPUs online. With tick, runs tick(port, nports,
+* arg) every period_ms on the calling thread until the workers are done, with
+* the ports' snap up to date within period_ms. Returns when all ports are done,
+* 0, -1 if a worker could not be started (errno set).
+*/
+int mp_run(struct mp_port *port, int nports, struct mp_worker *w, int nworkers, double rate, int pin,
+	mp_tick tick, void *arg, long period_ms)
+{
+	struct run r = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0};
+	struct timespec at;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int i, k, e = 0, started;
+
+	if((nworkers < 1) || (nworkers > MP_WORKERS_MAX) || (nports < 1) || ((tick != NULL) && (period_ms < 1)))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	memset(w, 0, nworkers * sizeof(*w));
+	for(k = 0; k < nworkers; k++)
+	{
+		w[k].id = k;
+		w[k].cpu = pin ? k % (cpus > 0 ? cpus : 1) : -1;
+		w[k].rate = rate;
+		w[k].period_ms = tick != NULL ? period_ms : 0;
+		w[k].run = &r;
+		if((w[k].port = calloc(nports / nworkers + 1, sizeof(*w[k].port))) == NULL)
+		{
+			while(k-- > 0)
+				free(w[k].port);
+			return -1;
+		}
+	}
+	for(i = 0; i < nports; i++)
+	{
+		port[i].sent = port[i].done = port[i].failed = 0;
+		port[i].err = 0;
+		port[i].snap = *daq_stats(port[i].dq);
+		w[i % nworkers].port[w[i % nworkers].nports++] = &port[i];
+	}
+
+	for(started = 0; started < nworkers; started++)
+		if((e = pthread_create(&w[started].thread, NULL, worker, &w[started])) != 0)
+			break;
+	if(tick != NULL)
+	{
+		pthread_mutex_lock(&r.lock);
+		while(r.finished < started)
+		{
+			clock_gettime(CLOCK_REALTIME, &at);	//pthread_cond_timedwait() clock;
+			at.tv_nsec += period_ms % 1000 * 1000000;
+			at.tv_sec += period_ms / 1000 + at.tv_nsec / 1000000000;
+			at.tv_nsec %= 1000000000;
+			while((r.finished < started) && (pthread_cond_timedwait(&r.cond, &r.lock, &at) != ETIMEDOUT))
+				;
+			tick(port, nports, arg);
+		}
+		pthread_mutex_unlock(&r.lock);
+	}
+	for(k = 0; k < started; k++)
+		pthread_join(w[k].thread, NULL);
+	for(k = 0; k < nworkers; k++)
+		free(w[k].port);
+	if(started < nworkers)
+	{
+		errno = e;
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,60 @@
+/*
+* Multi-port runner: drives several boards at once, each on its own serial port
+* and libdaq handle. The ports are sharded round robin across a fixed pool of
+* worker threads; every worker runs one epoll loop over its ports and advances
+* each port's state machine (daq_process()) when its tty is ready or a protocol
+* deadline passes, so a worker never blocks on a single board. Workers keep their
+* own stats; nothing is shared between them while they run, except the copies
+* of each port's libdaq stats they publish for mp_run()'s tick.
+*
+* $ gcc -O2 -c multiport.c libdaq.c hist.c crc16.c clock.c (link with -lpthread -lm)
+*/
+#ifndef MULTIPORT_H
+#define MULTIPORT_H
+
+#include<pthread.h>
+
+#include "libdaq.h"
+
+#define MP_WORKERS_MAX 64
+
+struct mp_port
+{
+	const char *tty;
+	int id;							//Position of tty, the board its captures are stored as;
+	struct daq *dq;						//Opened by the caller;
+	unsigned char **frame;					//Frames replayed round robin, only read;
+	int count;						//Frames in frame[];
+	long total;						//Ops to run;
+	long sent, done, failed;
+	int err;						//errno of the I/O error that stopped the port, 0;
+	long long elapsed_ms;					//Until its last op completed;
+	int events;						//Registered with epoll;
+	void (*complete)(struct mp_port *p, struct daq_op *op);	//Every op done, on the worker; NULL;
+	void *user;
+	struct daq_stats snap;					//Published by the worker, read in tick();
+	struct daq_op ops[DAQ_QUEUE];
+	unsigned char reply[DAQ_QUEUE][FRAME_MAX];		//Read data of ops[k];
+};
+
+struct mp_worker
+{
+	pthread_t thread;
+	int id, cpu;						//CPU it is pinned to, -1 = not pinned;
+	struct mp_port **port;
+	int nports;
+	double rate;						//Frames/s per port, 0 = as fast as the line allows;
+	unsigned long frames, failed, wakeups;
+	long wire;
+	double cpu_s;						//Thread CPU time of the run;
+	int err;						//Worker could not start (errno), 0;
+	long period_ms;						//Between snapshots, 0 = none;
+	void *run;						//State shared by the run (multiport.c);
+};
+
+typedef void (*mp_tick)(struct mp_port *port, int nports, void *arg);
+
+int mp_run(struct mp_port *port, int nports, struct mp_worker *w, int nworkers, double rate, int pin,
+	mp_tick tick, void *arg, long period_ms);
+
+#endif
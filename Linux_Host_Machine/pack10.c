@@ -0,0 +1,122 @@
+/*
+* Unpacking of 10 bit samples (see pack10.h). Every sample k of a 5 byte group
+* sits in the little-endian 16 bit word at byte k, shifted right by 2k bits. The
+* vector kernels gather those byte pairs into 16 bit lanes with pshufb, move
+* each sample to the top of its lane with a multiply by 2^(6 - 2k) (which also
+* drops the neighbour's bits) and shift it down by 6. SSSE3 handles 2 groups
+* per step, AVX2 4 groups; the tail goes through the scalar loop. unpack10()
+* picks the widest kernel the CPU supports on first use.
+*/
+
+#include "pack10.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include<immintrin.h>
+#define HAVE_X86 1
+#endif
+
+void unpack10_scalar(const uint8_t *in, uint16_t *out, size_t groups)
+{
+	while(groups--)
+	{
+		out[0] = (in[0] | in[1] << 8) & 0x3FF;
+		out[1] = (in[1] >> 2 | in[2] << 6) & 0x3FF;
+		out[2] = (in[2] >> 4 | in[3] << 4) & 0x3FF;
+		out[3] = (in[3] >> 6 | in[4] << 2) & 0x3FF;
+		in += 5;
+		out += 4;
+	}
+}
+
+#ifdef HAVE_X86
+
+__attribute__((target("ssse3")))
+void unpack10_ssse3(const uint8_t *in, uint16_t *out, size_t groups)
+{
+	const __m128i shuf = _mm_setr_epi8(0, 1, 1, 2, 2, 3, 3, 4, 5, 6, 6, 7, 7, 8, 8, 9);
+	const __m128i mul = _mm_setr_epi16(64, 16, 4, 1, 64, 16, 4, 1);
+	__m128i v;
+
+	while(groups >= 4)					//The 16 byte load needs 2 groups after the pair;
+	{
+		v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)in), shuf);
+		v = _mm_srli_epi16(_mm_mullo_epi16(v, mul), 6);
+		_mm_storeu_si128((__m128i *)out, v);
+		in += 10;
+		out += 8;
+		groups -= 2;
+	}
+	unpack10_scalar(in, out, groups);
+}
+
+__attribute__((target("avx2")))
+void unpack10_avx2(const uint8_t *in, uint16_t *out, size_t groups)
+{
+	const __m256i shuf = _mm256_setr_epi8(0, 1, 1, 2, 2, 3, 3, 4, 5, 6, 6, 7, 7, 8, 8, 9,
+		0, 1, 1, 2, 2, 3, 3, 4, 5, 6, 6, 7, 7, 8, 8, 9);
+	const __m256i mul = _mm256_setr_epi16(64, 16, 4, 1, 64, 16, 4, 1, 64, 16, 4, 1, 64, 16, 4, 1);
+	__m256i v;
+
+	while(groups >= 6)					//Loads bytes 0..15 and 10..25;
+	{
+		v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)in)),
+			_mm_loadu_si128((const __m128i *)(in + 10)), 1);
+		v = _mm256_shuffle_epi8(v, shuf);
+		v = _mm256_srli_epi16(_mm256_mullo_epi16(v, mul), 6);
+		_mm256_storeu_si256((__m256i *)out, v);
+		in += 20;
+		out += 16;
+		groups -= 4;
+	}
+	unpack10_ssse3(in, out, groups);
+}
+
+#else
+
+void unpack10_ssse3(const uint8_t *in, uint16_t *out, size_t groups)
+{
+	unpack10_scalar(in, out, groups);
+}
+
+void unpack10_avx2(const uint8_t *in, uint16_t *out, size_t groups)
+{
+	unpack10_scalar(in, out, groups);
+}
+
+#endif
+
+static void (*kernel)(const uint8_t *, uint16_t *, size_t);
+static const char *kernel_name;
+
+static void pick(void)
+{
+	kernel = unpack10_scalar;
+	kernel_name = "scalar";
+#ifdef HAVE_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+	{
+		kernel = unpack10_avx2;
+		kernel_name = "avx2";
+	}
+	else if(__builtin_cpu_supports("ssse3"))
+	{
+		kernel = unpack10_ssse3;
+		kernel_name = "ssse3";
+	}
+#endif
+}
+
+void unpack10(const uint8_t *in, uint16_t *out, size_t groups)
+{
+	if(kernel == NULL)
+		pick();
+	kernel(in, out, groups);
+}
+
+const char *unpack10_kernel(void)
+{
+	if(kernel == NULL)
+		pick();
+	return kernel_name;
+}
@@ -0,0 +1,17 @@
+/*
+* 10 bit ADC samples packed 4 into 5 bytes (read mode 05): the 40 bits
+* s0 | s1 << 10 | s2 << 20 | s3 << 30, least significant byte first.
+*/
+#ifndef PACK10_H
+#define PACK10_H
+
+#include<stddef.h>
+#include<stdint.h>
+
+void unpack10(const uint8_t *in, uint16_t *out, size_t groups);	//Best kernel for this CPU;
+void unpack10_scalar(const uint8_t *in, uint16_t *out, size_t groups);
+void unpack10_ssse3(const uint8_t *in, uint16_t *out, size_t groups);	//Scalar if not x86;
+void unpack10_avx2(const uint8_t *in, uint16_t *out, size_t groups);
+const char *unpack10_kernel(void);					//Name of the one unpack10() uses;
+
+#endif
@@ -0,0 +1,117 @@
+/****************************************************************************/
+/* LPC23XX.H: Register shim for building the firmware on Linux              */
+/****************************************************************************/
+/**
+* @file lpc23xx.h
+*
+* Stands in for the Keil LPC23xx.H device header so that the firmware
+* sources build unchanged as a Linux process. Plain configuration registers
+* are ordinary variables. Registers whose access has a side effect (UART
+* RBR/LSR/IIR/THR, ADC data, GPIO output) are routed to the device models
+* in sim_uart.c and sim_devices.c; the LCD driver is replaced by sim_lcd.c.
+*
+* @note
+*
+* THR and FIO2PIN are lvalues returning a slot in the model, so every
+* "U1THR = ch" queues exactly one byte and every LED write is seen by the
+* model. Interrupts are delivered from CPU_IDLE(), which the firmware
+* calls whenever it waits.
+*
+*****************************************************************************/
+
+#ifndef __LPC23XX_SHIM_H
+#define __LPC23XX_SHIM_H
+
+/***************************** Include Files ********************************/
+
+/************************** Constant Definitions ****************************/
+
+#define __irq                            /* ISRs are plain calls on Linux   */
+
+#define CPU_IDLE()       sim_idle()      /* Delivers interrupts, sleeps     */
+
+/* Registers with side effects                                              */
+#define U1RBR            (sim_uart_rbr())
+#define U1LSR            (sim_uart_lsr())
+#define U1IIR            (sim_uart_iir())
+#define U1THR            (*sim_uart_thr())
+#define FIO2PIN          (*sim_gpio_fio2pin())
+#define AD0DR0           (sim_adc_dr(0))
+#define AD0DR1           (sim_adc_dr(1))
+#define AD0DR2           (sim_adc_dr(2))
+#define AD0DR3           (sim_adc_dr(3))
+#define AD0DR4           (sim_adc_dr(4))
+#define AD0DR5           (sim_adc_dr(5))
+#define AD0DR6           (sim_adc_dr(6))
+#define AD0DR7           (sim_adc_dr(7))
+
+/* Timers: TC runs from the host clock, see sim_timer.c                     */
+#define T0TC             (sim_timer_tc(0))
+#define T1TC             (sim_timer_tc(1))
+#define T2TC             (sim_timer_tc(2))
+#define T3TC             (sim_timer_tc(3))
+#define T0TCR            (SimTimer[0].tcr)
+#define T0PR             (SimTimer[0].pr)
+#define T0MR0            (SimTimer[0].mr0)
+#define T0MCR            (SimTimer[0].mcr)
+#define T0IR             (SimTimer[0].ir)
+#define T1TCR            (SimTimer[1].tcr)
+#define T1PR             (SimTimer[1].pr)
+#define T1MR0            (SimTimer[1].mr0)
+#define T1MCR            (SimTimer[1].mcr)
+#define T1IR             (SimTimer[1].ir)
+#define T2TCR            (SimTimer[2].tcr)
+#define T2PR             (SimTimer[2].pr)
+#define T2MR0            (SimTimer[2].mr0)
+#define T2MCR            (SimTimer[2].mcr)
+#define T2IR             (SimTimer[2].ir)
+#define T3TCR            (SimTimer[3].tcr)
+#define T3PR             (SimTimer[3].pr)
+#define T3MR0            (SimTimer[3].mr0)
+#define T3MCR            (SimTimer[3].mcr)
+#define T3IR             (SimTimer[3].ir)
+
+/**************************** Type Definitions ******************************/
+
+typedef volatile unsigned long SimReg;
+
+typedef struct {
+  SimReg tcr, pr, mr0, mcr, ir;
+} SimTimerRegs;
+
+/************************** Variable Definitions ****************************/
+
+/* System control and pin connect                                           */
+extern SimReg PCONP, PCLKSEL0, PCLKSEL1;
+extern SimReg PINSEL0, PINSEL1, PINSEL3, PINSEL4, PINMODE4;
+
+/* GPIO and ADC configuration                                               */
+extern SimReg FIO2DIR, AD0CR;
+
+/* UART1 configuration                                                      */
+extern SimReg U1LCR, U1DLL, U1DLM, U1FDR, U1FCR, U1IER;
+
+/* Vectored interrupt controller                                            */
+extern SimReg VICIntEnable, VICIntEnClr, VICVectAddr;
+extern SimReg VICVectAddr4, VICVectPriority4;   /* Timer0              */
+extern SimReg VICVectAddr5, VICVectPriority5;   /* Timer1              */
+extern SimReg VICVectAddr7, VICVectPriority7;   /* UART1               */
+extern SimReg VICVectAddr26, VICVectPriority26; /* Timer2              */
+extern SimReg VICVectAddr27, VICVectPriority27; /* Timer3              */
+
+extern SimTimerRegs SimTimer[4];
+
+/************************** Function Prototypes *****************************/
+
+unsigned long sim_uart_rbr (void);
+unsigned long sim_uart_lsr (void);
+unsigned long sim_uart_iir (void);
+SimReg *sim_uart_thr (void);
+
+SimReg *sim_gpio_fio2pin (void);
+unsigned long sim_adc_dr (int ch);
+unsigned long sim_timer_tc (int n);
+
+void sim_idle (void);
+
+#endif
@@ -0,0 +1,60 @@
+/****************************************************************************/
+/* SIM.H: Interfaces between the simulator modules                          */
+/****************************************************************************/
+/**
+* @file sim.h
+*
+* Declarations shared by the device models and the simulator main loop.
+* The firmware itself only sees lpc23xx.h.
+*
+*****************************************************************************/
+
+#ifndef __SIM_H
+#define __SIM_H
+
+/***************************** Include Files ********************************/
+
+#include <stdio.h>
+
+#include "lpc23xx.h"
+
+/************************** Constant Definitions ****************************/
+
+#define SIM_PCLK         48000000        /* CCLK, divided as PCLKSEL0/1 say */
+
+#define ADC_SINE         0               /* Synthetic ADC sources           */
+#define ADC_RAMP         1
+#define ADC_NOISE        2
+#define ADC_CONST        3
+
+/************************** Function Prototypes *****************************/
+
+/* sim_main.c                                                               */
+long long sim_now (void);                /* CLOCK_MONOTONIC in ns           */
+unsigned long sim_random (void);
+void sim_log (const char *fmt, ...);
+
+/* sim_uart.c                                                               */
+void sim_uart_attach (int fd);
+void sim_uart_config (int pace, double error_rate, unsigned long cable);
+int sim_uart_service (long long now, long long *wake, short *events);
+unsigned long sim_uart_baud (void);
+void sim_uart_stats (unsigned long *rx, unsigned long *tx, unsigned long *errors);
+
+/* sim_devices.c                                                            */
+void sim_adc_config (int source, double freq, unsigned int value);
+void sim_devices_flush (void);
+
+/* sim_timer.c                                                              */
+int sim_timer_service (long long now, long long *wake);
+void sim_timer_skew (double ppm);
+
+/* sim_lcd.c                                                                */
+void sim_lcd_flush (void);
+
+/* Firmware counters logged on exit (serial.c, pool.c)                      */
+extern volatile unsigned long UartOverruns, UartRxDropped;
+extern volatile unsigned int PoolHighWater;
+extern volatile unsigned long PoolExhausted;
+
+#endif
@@ -0,0 +1,153 @@
+/****************************************************************************/
+/* SIM_DEVICES.C: GPIO (LED) and ADC models behind the register shim        */
+/****************************************************************************/
+/**
+* @file sim_devices.c
+*
+* FIO2PIN is captured so that every LED pattern the firmware shows ends up
+* in the capture log. AD0DRn return samples of a synthetic source (sine,
+* ramp, noise or a constant) in the 10 bit result field.
+*
+* @note
+*
+* A conversion completes immediately: a read of AD0DRn with DONE clear
+* starts and finishes a new conversion and returns it with DONE set, the
+* next read returns the same result with DONE cleared, as the hardware
+* does after the result has been read. In BURST mode every read returns a
+* fresh conversion.
+*
+*****************************************************************************/
+
+/***************************** Include Files ********************************/
+
+#include <math.h>
+
+#include "sim.h"
+
+/************************** Constant Definitions ****************************/
+
+#define ADC_CHANNELS     8
+#define ADC_DONE         0x80000000UL
+#define AD0CR_BURST      0x00010000
+
+/************************** Variable Definitions ****************************/
+
+SimReg FIO2DIR, AD0CR;
+
+static SimReg Fio2Pin;
+static unsigned long LedShown = ~0UL;
+
+static int AdcSource = ADC_SINE;
+static double AdcFreq = 1.0;             /* Sine frequency in Hz            */
+static unsigned int AdcValue;            /* Constant / ramp state           */
+static int AdcDone[ADC_CHANNELS];
+static unsigned long AdcResult[ADC_CHANNELS];
+
+/****************************************************************************/
+/**
+* Log the LED state if the firmware changed it since the last check.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		None.
+*
+*****************************************************************************/
+
+static void LedCheck (void)
+{
+  if ((Fio2Pin & 0xFF) != LedShown)  {
+    LedShown = Fio2Pin & 0xFF;
+    sim_log("LED %02lx", LedShown);
+  }
+}
+
+SimReg *sim_gpio_fio2pin (void)
+{
+  LedCheck();                            /* Catches the previous write      */
+  return (&Fio2Pin);
+}
+
+
+/****************************************************************************/
+/**
+* Select the synthetic ADC source.
+*
+* @param	source is ADC_SINE, ADC_RAMP, ADC_NOISE or ADC_CONST.
+*
+* @param	freq is the sine frequency in Hz.
+*
+* @param	value is the constant value (ADC_CONST, 0..1023).
+*
+* @return	None.
+*
+* @note		None.
+*
+*****************************************************************************/
+
+void sim_adc_config (int source, double freq, unsigned int value)
+{
+  AdcSource = source;
+  AdcFreq = freq;
+  AdcValue = value & 0x3FF;
+}
+
+
+/****************************************************************************/
+/**
+* Next 10 bit sample of the synthetic source.
+*
+* @param	ch is the ADC channel; channels are 45 degrees apart.
+*
+* @return	Sample value 0..1023.
+*
+* @note		None.
+*
+*****************************************************************************/
+
+static unsigned long AdcSample (int ch)
+{
+  double t;
+
+  switch (AdcSource)  {
+    case ADC_RAMP:
+      return (AdcValue++ & 0x3FF);
+    case ADC_NOISE:
+      return (sim_random() & 0x3FF);
+    case ADC_CONST:
+      return (AdcValue);
+    default:
+      t = sim_now() / 1e9;
+      return ((unsigned long)(511.5 + 511.5 * sin(2 * M_PI * AdcFreq * t + ch * M_PI / 4)));
+  }
+}
+
+unsigned long sim_adc_dr (int ch)
+{
+  if (!AdcDone[ch] || (AD0CR & AD0CR_BURST))  {
+    AdcResult[ch] = AdcSample(ch);
+    AdcDone[ch] = 1;
+    return (ADC_DONE | (AdcResult[ch] << 6));
+  }
+  AdcDone[ch] = 0;
+  return (AdcResult[ch] << 6);
+}
+
+
+/****************************************************************************/
+/**
+* Log device state that changed since the last call.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		Called from sim_idle().
+*
+*****************************************************************************/
+
+void sim_devices_flush (void)
+{
+  LedCheck();
+}
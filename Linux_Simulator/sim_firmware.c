@@ -0,0 +1,38 @@
+/****************************************************************************/
+/* SIM_FIRMWARE.C: The unchanged protocol core, built for the simulator     */
+/****************************************************************************/
+/**
+* @file sim_firmware.c
+*
+* Compiles arm_communicate_uart.c as it runs on the MCB2300, with its main()
+* renamed so that sim_main.c can set up the line first, and the clock
+* setup the Keil startup code does before main().
+*
+*****************************************************************************/
+
+#define main firmware_main
+
+#include "arm_communicate_uart.c"
+
+
+/****************************************************************************/
+/**
+* Peripheral clock selection of the startup code.
+*
+* @param	stock leaves PCLKSEL0/1 at their reset value (all peripherals
+*		at CCLK/4), as the unmodified Keil LPC2300.s does.
+*
+* @return	None.
+*
+* @note		LPC2300.s writes PCLKSEL0/1 before it connects the PLL; the
+*		firmware only reads the result.
+*
+*****************************************************************************/
+
+void firmware_startup (int stock)
+{
+  if (stock)
+    return;
+  PCLKSEL0 = PCLKSEL0_VAL;
+  PCLKSEL1 = PCLKSEL1_VAL;
+}
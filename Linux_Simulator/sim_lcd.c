@@ -0,0 +1,149 @@
+/****************************************************************************/
+/* SIM_LCD.C: Text LCD model replacing lcd.c in the simulator               */
+/****************************************************************************/
+/**
+* @file sim_lcd.c
+*
+* Implements the lcd.c interface on a model of the controller DDRAM and
+* logs the visible 16x2 characters whenever they changed. Line 2 starts at
+* DDRAM address 40, as LcdSetCursor() in lcd.c addresses it.
+*
+* @note
+*
+* Commands and data writes are counted as bus operations; each costs a
+* busy-flag poll and two 4-bit transfers on the real board.
+*
+*****************************************************************************/
+
+/***************************** Include Files ********************************/
+
+#include <string.h>
+
+#include "sim.h"
+
+/************************** Constant Definitions ****************************/
+
+#define LineLen     16                  /* Width (in characters)            */
+#define NumLines     2                  /* Hight (in lines)                 */
+#define DDRAM_SIZE   0x80
+#define Line2        40                 /* DDRAM address of line 2          */
+
+/************************** Variable Definitions ****************************/
+
+static unsigned char Ddram[DDRAM_SIZE];
+static unsigned char Addr;              /* DDRAM address counter            */
+static int Cgram;                       /* Data goes to CGRAM               */
+static int Dirty;
+
+unsigned long LcdBusOps;                /* Commands + data writes           */
+
+/****************************************************************************/
+/**
+* Write command to LCD controller.
+*
+* @param	c is the command to be written.
+*
+* @return	None.
+*
+* @note		Clear, set DDRAM and set CGRAM address are modelled.
+*
+*****************************************************************************/
+
+void LcdWriteCmd (unsigned char c)
+{
+  LcdBusOps++;
+  if (c == 0x01)  {                     /* Display clear                    */
+    memset(Ddram, ' ', sizeof(Ddram));
+    Addr = 0;
+    Cgram = 0;
+    Dirty = 1;
+  }
+  else if (c & 0x80)  {                 /* Set DDRAM address                */
+    Addr = c & 0x7F;
+    Cgram = 0;
+  }
+  else if (c & 0x40)                    /* Set CGRAM address                */
+    Cgram = 1;
+}
+
+
+/****************************************************************************/
+/**
+* Write data to LCD controller.
+*
+* @param	c is the data to be written.
+*
+* @return	None.
+*
+* @note		None.
+*
+*****************************************************************************/
+
+void LcdWriteData (unsigned char c)
+{
+  LcdBusOps++;
+  if (Cgram)
+    return;
+  if (Ddram[Addr] != c)
+    Dirty = 1;
+  Ddram[Addr] = c;
+  Addr = (Addr + 1) & (DDRAM_SIZE - 1);
+}
+
+void LcdPutchar (char c)
+{
+  LcdWriteData (c);
+}
+
+void LcdInit (void)
+{
+  memset(Ddram, ' ', sizeof(Ddram));
+  LcdWriteCmd (0x28);                 /* 2 lines, 5x8 character matrix      */
+  LcdWriteCmd (0x0C);                 /* Display ctrl:Disp=ON,Curs/Blnk=OFF */
+  LcdWriteCmd (0x06);                 /* Entry mode: Move right, no shift   */
+  LcdWriteCmd (0x80);                 /* Set DDRAM address counter to 0     */
+}
+
+void LcdSetCursor (unsigned char column, unsigned char line)
+{
+  unsigned char address;
+
+  address = (line * 40) + column;
+  address = 0x80 + (address & 0x7F);
+  LcdWriteCmd(address);               /* Set DDRAM address counter to 0     */
+}
+
+void LcdClear (void)
+{
+  LcdWriteCmd(0x01);                  /* Display clear                      */
+  LcdSetCursor (0, 0);
+}
+
+void LcdPrint (unsigned char const *string)
+{
+  while (*string)  {
+    LcdPutchar (*string++);
+  }
+}
+
+
+/****************************************************************************/
+/**
+* Log the visible characters if they changed.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		Called from sim_idle().
+*
+*****************************************************************************/
+
+void sim_lcd_flush (void)
+{
+  if (!Dirty)
+    return;
+  Dirty = 0;
+  sim_log("LCD \"%.*s\" \"%.*s\" (%lu bus ops)", LineLen, (char *)&Ddram[0],
+          LineLen, (char *)&Ddram[Line2], LcdBusOps);
+}
@@ -0,0 +1,305 @@
+/****************************************************************************/
+/* SIM_MAIN.C: MCB2300 firmware simulator on a pty pair                     */
+/****************************************************************************/
+/**
+* @file sim_main.c
+*
+* Runs the protocol core of arm_communicate_uart.c as a Linux process. The
+* UART is attached to the master side of a new pty pair; the host tool
+* opens the slave side, whose name is printed on stdout, as it would open
+* /dev/ttyS0.
+*
+* @note
+*
+* Usage: mcb2300_sim [-p] [-e error_rate] [-B baud] [-s seed]
+*                    [-a sine|ramp|noise|N] [-f freq] [-k ppm] [-K]
+*                    [-l capture_log] [-L link]
+*
+*   -p  pace the line at the baud rate the firmware programmed
+*   -e  probability that a byte is corrupted on the line (both directions)
+*   -B  cable limit: faster rates also lose 2 % of the bytes
+*   -s  seed of the error / noise generator
+*   -a  synthetic ADC source, N is a constant 10 bit value
+*   -f  sine frequency in Hz
+*   -k  timer counters run fast by ppm (negative: slow), see sim_timer.c
+*   -K  stock Keil startup: PCLKSEL0/1 stay at reset, peripherals at CCLK/4
+*   -l  file receiving the LED / LCD capture (default stderr)
+*   -L  symlink created to the slave pty
+*
+*****************************************************************************/
+
+/***************************** Include Files ********************************/
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sim.h"
+
+/************************** Constant Definitions ****************************/
+
+#define IDLE_MAX_NS      10000000LL      /* Longest sleep, see sim_idle()   */
+
+/************************** Variable Definitions ****************************/
+
+static int LineFd = -1;                 /* Master side of the pty           */
+static FILE *Capture;
+static long long Start;
+static unsigned long long Seed = 0x9E3779B97F4A7C15ULL;
+static volatile sig_atomic_t Quit;
+static const char *Link;
+
+/************************** Function Prototypes *****************************/
+
+int firmware_main ();
+void firmware_startup (int stock);
+
+/****************************************************************************/
+/**
+* Time base of the models.
+*
+* @param	None.
+*
+* @return	CLOCK_MONOTONIC in ns.
+*
+* @note		None.
+*
+*****************************************************************************/
+
+long long sim_now (void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((long long)t.tv_sec * 1000000000LL + t.tv_nsec);
+}
+
+
+/****************************************************************************/
+/**
+* xorshift64 generator for line errors and ADC noise.
+*
+* @param	None.
+*
+* @return	Next pseudo random number.
+*
+* @note		Repeatable for a given -s seed.
+*
+*****************************************************************************/
+
+unsigned long sim_random (void)
+{
+  Seed ^= Seed << 13;
+  Seed ^= Seed >> 7;
+  Seed ^= Seed << 17;
+  return ((unsigned long)Seed);
+}
+
+
+/****************************************************************************/
+/**
+* Write one line to the capture log, stamped with ms since start.
+*
+* @param	fmt is a printf format.
+*
+* @return	None.
+*
+* @note		None.
+*
+*****************************************************************************/
+
+void sim_log (const char *fmt, ...)
+{
+  va_list ap;
+
+  fprintf(Capture, "%10.3f ", (sim_now() - Start) / 1e6);
+  va_start(ap, fmt);
+  vfprintf(Capture, fmt, ap);
+  va_end(ap);
+  fputc('\n', Capture);
+  fflush(Capture);
+}
+
+
+/****************************************************************************/
+/**
+* Called by the firmware whenever it waits (CPU_IDLE). Runs the device
+* models and sleeps until the line or a model needs attention.
+*
+* @param	None.
+*
+* @return	None.
+*
+* @note		Exits on SIGINT / SIGTERM after logging the line counters.
+*		Sleeps at most IDLE_MAX_NS: the target spins in its wait loops,
+*		and some of them watch T0TC (the baud rate fallback in serial.c).
+*
+*****************************************************************************/
+
+void sim_idle (void)
+{
+  long long now = sim_now(), wake = LLONG_MAX;
+  unsigned long rx, tx, errors;
+  struct timespec ts;
+  struct pollfd pfd;
+  short events = 0;
+  int progress;
+
+  if (Quit)  {
+    sim_uart_stats(&rx, &tx, &errors);
+    sim_log("exit: %lu bytes received, %lu sent, %lu corrupted", rx, tx, errors);
+    sim_log("exit: %lu overruns, %lu dropped, payload pool high-water %u, %lu exhausted",
+            UartOverruns, UartRxDropped, PoolHighWater, PoolExhausted);
+    if (Link)
+      unlink(Link);
+    exit(EXIT_SUCCESS);
+  }
+
+  progress = sim_uart_service(now, &wake, &events);
+  progress |= sim_timer_service(now, &wake);
+  sim_devices_flush();
+  sim_lcd_flush();
+  if (progress)
+    return;
+
+  if (wake > now + IDLE_MAX_NS)
+    wake = now + IDLE_MAX_NS;
+  wake = wake > now ? wake - now : 0;
+  ts.tv_sec = wake / 1000000000LL;
+  ts.tv_nsec = wake % 1000000000LL;
+  pfd.fd = LineFd;
+  pfd.events = events;
+  ppoll(&pfd, 1, &ts, NULL);
+}
+
+static void OnSignal (int sig)
+{
+  (void)sig;
+  Quit = 1;
+}
+
+
+/****************************************************************************/
+/**
+* Open a pty pair, keep the slave open so the line survives host restarts
+* and put it into raw mode.
+*
+* @param	None.
+*
+* @return	Master descriptor; the slave name is printed on stdout.
+*
+* @note		None.
+*
+*****************************************************************************/
+
+static int OpenLine (void)
+{
+  struct termios tio;
+  const char *name;
+  int master, slave;
+
+  if (((master = posix_openpt(O_RDWR | O_NOCTTY)) == -1) ||
+      (grantpt(master) == -1) || (unlockpt(master) == -1) ||
+      ((name = ptsname(master)) == NULL))  {
+    perror("ERROR pty");
+    exit(EXIT_FAILURE);
+  }
+  if ((slave = open(name, O_RDWR | O_NOCTTY)) == -1)  {
+    perror("ERROR open()");
+    exit(EXIT_FAILURE);
+  }
+  tcgetattr(slave, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(slave, TCSANOW, &tio);
+
+  if (Link)  {
+    unlink(Link);
+    if (symlink(name, Link) == -1)  {
+      perror("ERROR symlink()");
+      exit(EXIT_FAILURE);
+    }
+  }
+  printf("%s\n", name);
+  fflush(stdout);
+  return (master);
+}
+
+int main (int argc, char *argv[])
+{
+  double error_rate = 0, freq = 1.0;
+  int opt, pace = 0, source = ADC_SINE, stock = 0;
+  unsigned int value = 0;
+  unsigned long cable = 0;
+
+  Capture = stderr;
+  while ((opt = getopt(argc, argv, "pe:B:s:a:f:k:Kl:L:")) != -1)  {
+    switch (opt)  {
+      case 'p':
+        pace = 1;
+        break;
+      case 'e':
+        error_rate = atof(optarg);
+        break;
+      case 'B':
+        cable = strtoul(optarg, NULL, 0);
+        break;
+      case 's':
+        Seed = strtoull(optarg, NULL, 0) | 1;
+        break;
+      case 'a':
+        if (!strcmp(optarg, "ramp"))
+          source = ADC_RAMP;
+        else if (!strcmp(optarg, "noise"))
+          source = ADC_NOISE;
+        else if (!strcmp(optarg, "sine"))
+          source = ADC_SINE;
+        else  {
+          source = ADC_CONST;
+          value = strtoul(optarg, NULL, 0);
+        }
+        break;
+      case 'f':
+        freq = atof(optarg);
+        break;
+      case 'k':
+        sim_timer_skew(atof(optarg));
+        break;
+      case 'K':
+        stock = 1;
+        break;
+      case 'l':
+        if ((Capture = fopen(optarg, "w")) == NULL)  {
+          perror("ERROR fopen()");
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'L':
+        Link = optarg;
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-p] [-e error_rate] [-B baud] [-s seed] [-a sine|ramp|noise|N]"
+                " [-f freq] [-k ppm] [-K] [-l capture_log] [-L link]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  signal(SIGINT, OnSignal);
+  signal(SIGTERM, OnSignal);
+  Start = sim_now();
+  sim_adc_config(source, freq, value);
+  sim_uart_config(pace, error_rate, cable);
+  LineFd = OpenLine();
+  sim_uart_attach(LineFd);
+  firmware_startup(stock);
+
+  return (firmware_main());
+}
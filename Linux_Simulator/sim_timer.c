@@ -0,0 +1,187 @@
+/****************************************************************************/
+/* SIM_TIMER.C: Timer0..3 and their interrupts behind the register shim     */
+/****************************************************************************/
+/**
+* @file sim_timer.c
+*
+* Models the LPC23xx timers as far as the firmware uses them: TC counts at
+* PCLK / (PR + 1) from the host clock while TCR bit 0 is set, MR0 can
+* interrupt and reset the counter (MCR bits 0 and 1). Match interrupts are
+* delivered to the handler installed in the timer's VIC vector.
+* sim_timer_skew() makes the TC of every timer run fast or slow by a number
+* of ppm, like an off-frequency crystal, against the host clock.
+*
+* @note
+*
+* Matches missed while the firmware did not reach CPU_IDLE() are delivered
+* in a burst afterwards, so the average interrupt rate stays exact.
+*
+*****************************************************************************/
+
+/***************************** Include Files ********************************/
+
+#include "sim.h"
+
+/************************** Constant Definitions ****************************/
+
+#define TIMERS           4
+#define MAX_BURST        1000            /* Late matches delivered at once  */
+
+/************************** Variable Definitions ****************************/
+
+SimTimerRegs SimTimer[TIMERS];
+static double Skew = 1.0;                /* TC counts per nominal count     */
+SimReg VICVectAddr4, VICVectPriority4;
+SimReg VICVectAddr5, VICVectPriority5;
+SimReg VICVectAddr26, VICVectPriority26;
+SimReg VICVectAddr27, VICVectPriority27;
+
+static struct {
+  int running;
+  long long start;                       /* Time TC was 0                   */
+  double match;                          /* Time of the next MR0 match      */
+} State[TIMERS];
+
+/****************************************************************************/
+/**
+* Peripheral clock of a timer, from PCLKSEL0/1.
+*
+* @param	n is the timer number.
+*
+* @return	PCLK_TIMERn in Hz.
+*
+* @note		None.
+*
+*****************************************************************************/
+
+static long long TimerPclk (int n)
+{
+  static const int div[4] = { 4, 1, 2, 8 };
+  unsigned long sel;
+
+  switch (n)  {
+    case 0:  sel = PCLKSEL0 >> 2;  break;
+    case 1:  sel = PCLKSEL0 >> 4;  break;
+    case 2:  sel = PCLKSEL1 >> 12; break;
+    default: sel = PCLKSEL1 >> 14; break;
+  }
+  return (SIM_PCLK / div[sel & 3]);
+}
+
+static double TickNs (int n)             /* Length of one TC count in ns    */
+{
+  return ((SimTimer[n].pr + 1) * 1e9 / TimerPclk(n));
+}
+
+
+/****************************************************************************/
+/**
+* Follow TCR: a timer that has just been enabled starts counting from 0.
+*
+* @param	n is the timer number.
+*
+* @param	now is the current time in ns.
+*
+* @return	None.
+*
+* @note		None.
+*
+*****************************************************************************/
+
+static void TimerTrack (int n, long long now)
+{
+  int run = (SimTimer[n].tcr & 0x03) == 0x01;
+
+  if (run && !State[n].running)  {
+    State[n].start = now;
+    State[n].match = now + (SimTimer[n].mr0 + 1) * TickNs(n);
+  }
+  State[n].running = run;
+}
+
+
+/****************************************************************************/
+/**
+* Crystal error of the timer counters.
+*
+* @param	ppm is how much faster (negative: slower) than nominal they count.
+*
+* @return	None.
+*
+* @note		Only the TC values are skewed, match interrupts keep the host
+*		clock.
+*
+*****************************************************************************/
+
+void sim_timer_skew (double ppm)
+{
+  Skew = 1.0 + ppm / 1e6;
+}
+
+
+/****************************************************************************/
+/**
+* Timer counter register.
+*
+* @param	n is the timer number.
+*
+* @return	Current TC value.
+*
+* @note		None.
+*
+*****************************************************************************/
+
+unsigned long sim_timer_tc (int n)
+{
+  long long now = sim_now(), ticks;
+
+  TimerTrack(n, now);
+  if (!State[n].running)
+    return (0);
+  ticks = (long long)((now - State[n].start) * Skew / TickNs(n));
+  if (SimTimer[n].mcr & 0x02)            /* Reset on MR0                    */
+    ticks %= SimTimer[n].mr0 + 1;
+  return ((unsigned long)ticks);
+}
+
+
+/****************************************************************************/
+/**
+* Deliver the match interrupts that are due.
+*
+* @param	now is the current time in ns.
+*
+* @param	wake is lowered to the time of the next match.
+*
+* @return	Non-zero if an interrupt was delivered.
+*
+* @note		None.
+*
+*****************************************************************************/
+
+int sim_timer_service (long long now, long long *wake)
+{
+  static SimReg *const vect[TIMERS] = { &VICVectAddr4, &VICVectAddr5,
+                                        &VICVectAddr26, &VICVectAddr27 };
+  double period;
+  int n, k, progress = 0;
+
+  for (n = 0; n < TIMERS; n++)  {
+    TimerTrack(n, now);
+    if (!State[n].running || !(SimTimer[n].mcr & 0x01) || !*vect[n])
+      continue;
+    period = (SimTimer[n].mr0 + 1) * TickNs(n);
+    for (k = 0; (k < MAX_BURST) && (State[n].match <= now) && State[n].running; k++)  {
+      SimTimer[n].ir |= 0x01;
+      ((void (*)(void))*vect[n])();
+      State[n].match += period;
+      TimerTrack(n, now);                /* The ISR may stop the timer      */
+      progress = 1;
+    }
+    if (k == MAX_BURST)
+      State[n].match = now + period;     /* Too far behind, drop the rest   */
+    if (State[n].running && (State[n].match < *wake))
+      *wake = State[n].match;
+  }
+  return (progress);
+}
@@ -0,0 +1,464 @@
+/****************************************************************************/
+/* SIM_UART.C: UART1 and interrupt model behind the register shim           */
+/****************************************************************************/
+/**
+* @file sim_uart.c
+*
+* Models UART1 of the LPC23xx (16 byte RX/TX FIFOs, RX trigger level, IIR
+* priorities, THRE interrupt) on top of a file descriptor, and delivers the
+* UART interrupt to the handler installed in VICVectAddr7.
+*
+* @note
+*
+* With pacing on, bytes cross the line at the rate programmed into the
+* divisor latches and fractional divider (10 bits per byte), and bytes that
+* arrive while the RX FIFO is full are lost with OE set, as on the hardware.
+* Without pacing the line is as fast as the descriptor. A character time-out
+* is reported as soon as data below the trigger level is left in the FIFO.
+*
+* With pacing the rate the host set on its end of the pty also matters:
+* while it differs from the programmed one by more than RATE_TOLERANCE,
+* every byte arrives as garbage, in both directions. A cable limit makes
+* every rate above it lose bytes with CABLE_ERROR probability on top of the
+* -e rate, which is what a baud rate probe has to find.
+*
+*****************************************************************************/
+
+/***************************** Include Files ********************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "sim.h"
+
+/************************** Constant Definitions ****************************/
+
+#define FIFO_DEPTH       16
+
+#define LSR_RDR          0x01
+#define LSR_OE           0x02
+#define LSR_THRE         0x20
+#define LSR_TEMT         0x40
+
+#define IER_RBR          0x01
+#define IER_THRE         0x02
+#define IER_RLS          0x04
+
+#define RATE_TOLERANCE   0.03            /* Host and firmware rates match   */
+#define RATE_CHECK_NS    1000000LL       /* Host rate re-read every 1 ms    */
+#define CABLE_ERROR      0.02            /* Byte error rate above the limit */
+
+/************************** Variable Definitions ****************************/
+
+SimReg PCONP, PCLKSEL0, PCLKSEL1;
+SimReg PINSEL0, PINSEL1, PINSEL3, PINSEL4, PINMODE4;
+SimReg U1LCR, U1DLL, U1DLM, U1FDR, U1FCR, U1IER;
+SimReg VICIntEnable, VICIntEnClr, VICVectAddr;
+SimReg VICVectAddr7, VICVectPriority7;
+
+static int UartFd = -1;
+static int Pace;                         /* Pace bytes at the baud rate     */
+static double ErrorRate;                 /* Probability of a bad byte       */
+static unsigned long Cable;              /* Highest clean rate, 0: no limit */
+static double LineRate;                  /* ErrorRate at the current rates  */
+static int Mismatch;                     /* Host rate differs, all garbage  */
+static long long RateCheck;              /* Next look at the host rate      */
+
+static unsigned char RxFifo[FIFO_DEPTH];
+static int RxCount, RxRd;
+static int Overrun;                      /* OE latched until LSR is read    */
+static long long RxNext;                 /* Earliest arrival of next byte   */
+static int RxBacklog;                    /* Line has data, rate limited     */
+
+static SimReg TxFifo[FIFO_DEPTH];
+static SimReg TxDiscard;                 /* THR write with a full FIFO      */
+static int TxCount;
+static int ThrePending;
+static long long TxFree;                 /* Line free from this time on     */
+
+static unsigned long RxBytes, TxBytes, LineErrors;
+
+/****************************************************************************/
+/**
+* RX FIFO trigger level selected in U1FCR[7:6].
+*
+* @param	None.
+*
+* @return	Number of bytes that raise the RDA interrupt.
+*
+* @note		None.
+*
+*****************************************************************************/
+
+static int RxTrigger (void)
+{
+  static const int level[4] = { 1, 4, 8, 14 };
+
+  return (level[(U1FCR >> 6) & 3]);
+}
+
+
+/****************************************************************************/
+/**
+* Highest priority UART interrupt, as IIR reports it.
+*
+* @param	None.
+*
+* @return	IIR value, 0x01 if no interrupt is pending.
+*
+* @note		Has no side effects, see sim_uart_iir().
+*
+*****************************************************************************/
+
+static unsigned long PendingIIR (void)
+{
+  if (Overrun && (U1IER & IER_RLS))
+    return (0x06);
+  if ((RxCount >= RxTrigger()) && (U1IER & IER_RBR))
+    return (0x04);
+  if (RxCount && (U1IER & IER_RBR))
+    return (0x0C);
+  if (ThrePending && (U1IER & IER_THRE))
+    return (0x02);
+  return (0x01);
+}
+
+
+/****************************************************************************/
+/**
+* Rate the host set on its end of the line.
+*
+* @param	None.
+*
+* @return	Baud rate, 0 if the descriptor is no tty or the speed unknown.
+*
+* @note		The pty master reports the speed set on the slave.
+*
+*****************************************************************************/
+
+static unsigned long HostBaud (void)
+{
+  static const struct { speed_t speed; unsigned long baud; } rates[] = {
+    { B9600, 9600 }, { B19200, 19200 }, { B38400, 38400 }, { B57600, 57600 },
+    { B115200, 115200 }, { B230400, 230400 }, { B460800, 460800 },
+    { B921600, 921600 }
+  };
+  struct termios tio;
+  speed_t speed;
+  unsigned int i;
+
+  if (tcgetattr(UartFd, &tio) == -1)
+    return (0);
+  speed = cfgetospeed(&tio);
+  for (i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)
+    if (rates[i].speed == speed)
+      return (rates[i].baud);
+  return (0);
+}
+
+
+/****************************************************************************/
+/**
+* Updates the error model from the rates of both ends.
+*
+* @param	now is the current time in ns.
+*
+* @return	None.
+*
+* @note		The host rate is read at most every RATE_CHECK_NS; the
+*		firmware one is taken as it is programmed.
+*
+*****************************************************************************/
+
+static void RateService (long long now)
+{
+  static unsigned long host;
+  unsigned long baud = sim_uart_baud();
+
+  if (now >= RateCheck)  {
+    host = HostBaud();
+    RateCheck = now + RATE_CHECK_NS;
+  }
+  Mismatch = Pace && host && baud &&
+             ((baud > host * (1 + RATE_TOLERANCE)) || (baud < host * (1 - RATE_TOLERANCE)));
+  LineRate = ErrorRate;
+  if (Cable && (baud > Cable * (1 + RATE_TOLERANCE)))
+    LineRate += CABLE_ERROR;
+}
+
+
+/****************************************************************************/
+/**
+* Corrupt a byte with the configured probability by flipping one bit, or
+* replace it while the two ends run at different rates.
+*
+* @param	ch is the byte on the line.
+*
+* @return	The byte as it arrives.
+*
+* @note		None.
+*
+*****************************************************************************/
+
+static unsigned char LineNoise (unsigned char ch)
+{
+  if (Mismatch)  {
+    LineErrors++;
+    return ((unsigned char)sim_random());
+  }
+  if ((LineRate > 0) && ((sim_random() & 0xFFFFFF) < LineRate * 0x1000000))  {
+    LineErrors++;
+    ch ^= 1 << (sim_random() & 7);
+  }
+  return (ch);
+}
+
+
+/****************************************************************************/
+/**
+* Register accessors used by the shim macros.
+*
+* @param	None.
+*
+* @return	Register value (U1THR: slot the written byte goes to).
+*
+* @note		Reading IIR clears a pending THRE interrupt, reading LSR clears
+*		OE, reading RBR pops the RX FIFO; as on the hardware.
+*
+*****************************************************************************/
+
+unsigned long sim_uart_rbr (void)
+{
+  unsigned long ch = 0;
+
+  if (RxCount)  {
+    ch = RxFifo[RxRd];
+    RxRd = (RxRd + 1) % FIFO_DEPTH;
+    RxCount--;
+  }
+  return (ch);
+}
+
+unsigned long sim_uart_lsr (void)
+{
+  unsigned long lsr = 0;
+
+  if (RxCount)
+    lsr |= LSR_RDR;
+  if (Overrun)
+    lsr |= LSR_OE;
+  if (TxCount == 0)
+    lsr |= LSR_THRE | LSR_TEMT;
+  Overrun = 0;
+  return (lsr);
+}
+
+unsigned long sim_uart_iir (void)
+{
+  unsigned long iir = PendingIIR();
+
+  if (iir == 0x02)
+    ThrePending = 0;
+  return (iir);
+}
+
+SimReg *sim_uart_thr (void)
+{
+  ThrePending = 0;
+  if (TxCount == FIFO_DEPTH)
+    return (&TxDiscard);
+  return (&TxFifo[TxCount++]);
+}
+
+
+/****************************************************************************/
+/**
+* Connect the UART to a file descriptor (one end of a pty pair or socket).
+*
+* @param	fd is the descriptor carrying the serial line.
+*
+* @return	None.
+*
+* @note		The descriptor is switched to non-blocking mode.
+*
+*****************************************************************************/
+
+void sim_uart_attach (int fd)
+{
+  UartFd = fd;
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+
+/****************************************************************************/
+/**
+* Set up the line model.
+*
+* @param	pace enables pacing at the programmed baud rate.
+*
+* @param	error_rate is the probability that a byte is corrupted, in
+*		either direction.
+*
+* @param	cable is the highest rate the line carries at error_rate, 0
+*		for no limit.
+*
+* @return	None.
+*
+* @note		None.
+*
+*****************************************************************************/
+
+void sim_uart_config (int pace, double error_rate, unsigned long cable)
+{
+  Pace = pace;
+  ErrorRate = LineRate = error_rate;
+  Cable = cable;
+}
+
+
+/****************************************************************************/
+/**
+* Baud rate programmed by the firmware.
+*
+* @param	None.
+*
+* @return	PCLK / (16 * DL * (1 + DIVADDVAL / MULVAL)), 0 if not set up.
+*
+* @note		None.
+*
+*****************************************************************************/
+
+unsigned long sim_uart_baud (void)
+{
+  unsigned long dl = (U1DLM << 8) | U1DLL;
+  unsigned long mul = (U1FDR >> 4) & 0xF, divadd = U1FDR & 0xF;
+  static const unsigned long div[4] = { 4, 1, 2, 8 };
+  unsigned long pclk = SIM_PCLK / div[(PCLKSEL0 >> 8) & 3];  /* PCLK_UART1 */
+
+  if ((dl == 0) || (mul == 0))
+    return (0);
+  return ((unsigned long)((double)pclk * mul / (16.0 * dl * (mul + divadd))));
+}
+
+
+/****************************************************************************/
+/**
+* Byte counters of the line.
+*
+* @param	rx, tx and errors receive the bytes received, sent and
+*		corrupted so far.
+*
+* @return	None.
+*
+* @note		None.
+*
+*****************************************************************************/
+
+void sim_uart_stats (unsigned long *rx, unsigned long *tx, unsigned long *errors)
+{
+  *rx = RxBytes;
+  *tx = TxBytes;
+  *errors = LineErrors;
+}
+
+
+/****************************************************************************/
+/**
+* Moves bytes between the FIFOs and the line and delivers pending UART
+* interrupts.
+*
+* @param	now is the current time in ns.
+*
+* @param	wake is lowered to the time the model next needs service.
+*
+* @param	events receives POLLIN if the model waits for line data.
+*
+* @return	Non-zero if anything changed.
+*
+* @note		Exits the process when the line goes away.
+*
+*****************************************************************************/
+
+int sim_uart_service (long long now, long long *wake, short *events)
+{
+  unsigned char buf[256];
+  long long bt = 0;
+  int i, n, room, progress = 0;
+
+  if (Pace && sim_uart_baud())
+    bt = 10000000000LL / sim_uart_baud();   /* ns per byte, 8N1           */
+  RateService(now);
+
+  /* Transmitter shifts out what the line has had time for                 */
+  if (TxCount)  {
+    if (TxFree < now - bt)
+      TxFree = now;                      /* Line was idle                   */
+    for (n = 0; (n < TxCount) && (!bt || (TxFree <= now)); n++)  {
+      buf[n] = LineNoise((unsigned char)TxFifo[n]);
+      TxFree += bt;
+    }
+    for (i = 0; i < n; )  {
+      int w = write(UartFd, buf + i, n - i);
+      if (w > 0)
+        i += w;
+      else if ((w == -1) && (errno != EAGAIN) && (errno != EINTR))
+        exit(EXIT_SUCCESS);
+    }
+    if (n)  {
+      for (i = n; i < TxCount; i++)
+        TxFifo[i - n] = TxFifo[i];
+      TxCount -= n;
+      TxBytes += n;
+      if (TxCount == 0)
+        ThrePending = 1;
+      progress = 1;
+    }
+    if (TxCount && (TxFree < *wake))
+      *wake = TxFree;
+  }
+
+  /* Receiver: without pacing take what fits, with pacing take what has
+     arrived by now and lose what does not fit                             */
+  room = FIFO_DEPTH - RxCount;
+  if (!bt)
+    n = room;
+  else  {
+    if (RxNext < now - bt)
+      RxNext = now;
+    n = (int)((now - RxNext) / bt) + 1;
+    if (n > (int)sizeof(buf))
+      n = sizeof(buf);
+  }
+  if (n > 0)  {
+    n = read(UartFd, buf, n);
+    if ((n == 0) || ((n == -1) && (errno != EAGAIN) && (errno != EINTR)))
+      exit(EXIT_SUCCESS);
+    RxBacklog = 0;
+    for (i = 0; i < n; i++)  {
+      if (RxCount < FIFO_DEPTH)
+        RxFifo[(RxRd + RxCount++) % FIFO_DEPTH] = LineNoise(buf[i]);
+      else
+        Overrun = 1;
+      RxNext += bt;
+      RxBytes++;
+      progress = 1;
+    }
+    if (bt && (n > 0))
+      RxBacklog = 1;                     /* More may be queued behind       */
+  }
+  if (RxBacklog && (RxNext < *wake))
+    *wake = RxNext;
+  else if (RxCount < FIFO_DEPTH)
+    *events |= POLLIN;
+
+  while (VICVectAddr7 && (PendingIIR() != 0x01))  {
+    ((void (*)(void))VICVectAddr7)();
+    progress = 1;
+  }
+
+  return (progress);
+}